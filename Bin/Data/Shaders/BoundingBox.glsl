@@ -2,10 +2,10 @@
 
 #ifdef COMPILEVS
 
-#include "Transform.glsl"
-
 in vec3 position;
 
+uniform mat3x4 worldMatrix;
+
 #else
 
 out vec4 fragColor;
@@ -14,8 +14,7 @@ out vec4 fragColor;
 
 void vert()
 {
-    mat3x4 modelMatrix = GetWorldMatrix();
-    vec3 worldPos = vec4(position, 1.0) * modelMatrix;
+    vec3 worldPos = vec4(position, 1.0) * worldMatrix;
     gl_Position = vec4(worldPos, 1.0) * viewProjMatrix;
 }
 
@@ -3,13 +3,35 @@ uniform sampler2DShadow shadowTex9;
 uniform samplerCube faceSelectionTex10;
 uniform samplerCube faceSelectionTex11;
 uniform usampler3D clusterTex12;
+uniform samplerBuffer lightDataTex14;
+uniform usamplerBuffer lightIndexTex15;
+
+// Light data texels: position, direction, attenuation, color, shadow parameters and the shadow matrix columns
+const int LIGHT_TEXELS = 9;
+const int LIGHT_POSITION = 0;
+const int LIGHT_DIRECTION = 1;
+const int LIGHT_ATTENUATION = 2;
+const int LIGHT_COLOR = 3;
+const int LIGHT_SHADOWPARAMETERS = 4;
+const int LIGHT_SHADOWMATRIX = 5;
+
+mat4 GetLightShadowMatrix(int lightBase)
+{
+    return mat4(
+        texelFetch(lightDataTex14, lightBase + LIGHT_SHADOWMATRIX),
+        texelFetch(lightDataTex14, lightBase + LIGHT_SHADOWMATRIX + 1),
+        texelFetch(lightDataTex14, lightBase + LIGHT_SHADOWMATRIX + 2),
+        texelFetch(lightDataTex14, lightBase + LIGHT_SHADOWMATRIX + 3)
+    );
+}
 
 vec3 CalculateClusterPos(vec2 screenPos, float depth)
 {
+    // Invert the Z-slice distribution: a root of the linear depth, or a logarithm between the near and far clip distances
     return vec3(
         screenPos.x,
         screenPos.y,
-        sqrt(depth)
+        clusterParameters.z > 0.0 ? log(max(depth, 1.0e-6)) * clusterParameters.y + 1.0 : pow(max(depth, 0.0), clusterParameters.x)
     );
 }
 
@@ -77,10 +99,10 @@ void CalculateDirLight(vec4 worldPos, vec3 normal, vec4 matDiffColor, vec4 matSp
     }
 }
 
-vec4 GetPointShadowPos(uint index, vec3 lightVec)
+vec4 GetPointShadowPos(int lightBase, vec3 lightVec)
 {
-    vec4 pointParameters = lights[index].shadowMatrix[0];
-    vec4 pointParameters2 = lights[index].shadowMatrix[1];
+    vec4 pointParameters = texelFetch(lightDataTex14, lightBase + LIGHT_SHADOWMATRIX);
+    vec4 pointParameters2 = texelFetch(lightDataTex14, lightBase + LIGHT_SHADOWMATRIX + 1);
     float zoom = pointParameters2.x;
     float q = pointParameters2.y;
     float r = pointParameters2.z;
@@ -95,9 +117,10 @@ vec4 GetPointShadowPos(uint index, vec3 lightVec)
 
 void CalculateLight(uint index, vec4 worldPos, vec3 normal, vec4 matDiffColor, vec4 matSpecColor, inout vec3 diffuseLight, inout vec3 specularLight)
 {
-    vec3 lightPosition = lights[index].position.xyz;
-    vec4 lightAttenuation = lights[index].attenuation;
-    vec4 lightColor = lights[index].color;
+    int lightBase = int(index) * LIGHT_TEXELS;
+    vec3 lightPosition = texelFetch(lightDataTex14, lightBase + LIGHT_POSITION).xyz;
+    vec4 lightAttenuation = texelFetch(lightDataTex14, lightBase + LIGHT_ATTENUATION);
+    vec4 lightColor = texelFetch(lightDataTex14, lightBase + LIGHT_COLOR);
 
     vec3 lightVec = lightPosition - worldPos.xyz;
     vec3 scaledLightVec = lightVec * lightAttenuation.x;
@@ -108,11 +131,11 @@ void CalculateLight(uint index, vec4 worldPos, vec3 normal, vec4 matDiffColor, v
     if (atten <= 0.0 || NdotL <= 0.0)
         return;
 
-    vec4 shadowParameters = lights[index].shadowParameters;
+    vec4 shadowParameters = texelFetch(lightDataTex14, lightBase + LIGHT_SHADOWPARAMETERS);
 
     if (lightAttenuation.y > 0.0)
     {
-        vec3 lightSpotDirection = lights[index].direction.xyz;
+        vec3 lightSpotDirection = texelFetch(lightDataTex14, lightBase + LIGHT_DIRECTION).xyz;
         float spotEffect = dot(lightDir, lightSpotDirection);
         float spotAtten = (spotEffect - lightAttenuation.y) * lightAttenuation.z;
         if (spotAtten <= 0.0)
@@ -121,10 +144,10 @@ void CalculateLight(uint index, vec4 worldPos, vec3 normal, vec4 matDiffColor, v
         atten *= spotAtten;
 
         if (shadowParameters.z < 1.0)
-            atten *= clamp(shadowParameters.z + SampleShadowMap(shadowTex9, vec4(worldPos.xyz, 1.0) * lights[index].shadowMatrix, shadowParameters), 0.0, 1.0);
+            atten *= clamp(shadowParameters.z + SampleShadowMap(shadowTex9, vec4(worldPos.xyz, 1.0) * GetLightShadowMatrix(lightBase), shadowParameters), 0.0, 1.0);
     }
     else if (shadowParameters.z < 1.0)
-        atten *= clamp(shadowParameters.z + SampleShadowMap(shadowTex9, GetPointShadowPos(index, lightVec), shadowParameters), 0.0, 1.0);
+        atten *= clamp(shadowParameters.z + SampleShadowMap(shadowTex9, GetPointShadowPos(lightBase, lightVec), shadowParameters), 0.0, 1.0);
 
     diffuseLight += atten * NdotL * lightColor.rgb * matDiffColor.rgb;
 
@@ -144,26 +167,10 @@ void CalculateLighting(vec4 worldPos, vec3 normal, vec2 screenPos, vec4 matDiffC
 
     CalculateDirLight(worldPos, normal, matDiffColor, matSpecColor, diffuseLight, specularLight);
 
-    uvec4 lightClusterData = texture(clusterTex12, CalculateClusterPos(screenPos, worldPos.w));
+    // The cluster holds the start and count of its lights in the light index list
+    uvec2 lightCluster = texture(clusterTex12, CalculateClusterPos(screenPos, worldPos.w)).xy;
+    uint lightEnd = lightCluster.x + lightCluster.y;
 
-    while (lightClusterData.x > 0U)
-    {
-        CalculateLight((lightClusterData.x & 0xffU), worldPos, normal, matDiffColor, matSpecColor, diffuseLight, specularLight);
-        lightClusterData.x >>= 8U;
-    }
-    while (lightClusterData.y > 0U)
-    {
-        CalculateLight((lightClusterData.y & 0xffU), worldPos, normal, matDiffColor, matSpecColor, diffuseLight, specularLight);
-        lightClusterData.y >>= 8U;
-    }
-    while (lightClusterData.z > 0U)
-    {
-        CalculateLight((lightClusterData.z & 0xffU), worldPos, normal, matDiffColor, matSpecColor, diffuseLight, specularLight);
-        lightClusterData.z >>= 8U;
-    }
-    while (lightClusterData.w > 0U)
-    {
-        CalculateLight((lightClusterData.w & 0xffU), worldPos, normal, matDiffColor, matSpecColor, diffuseLight, specularLight);
-        lightClusterData.w >>= 8U;
-    }
+    for (uint i = lightCluster.x; i < lightEnd; ++i)
+        CalculateLight(texelFetch(lightIndexTex15, int(i)).x, worldPos, normal, matDiffColor, matSpecColor, diffuseLight, specularLight);
 }
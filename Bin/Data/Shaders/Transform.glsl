@@ -1,4 +1,20 @@
-#if defined(INSTANCED)
+#if defined(SKINNED) && defined(INSTANCED)
+in vec4 blendWeights;
+in vec4 blendIndices;
+
+mat3x4 GetSkinMatrix(int index)
+{
+    int texel = skinPaletteParameters.x + gl_InstanceID * skinPaletteParameters.y + index * 3;
+    return mat3x4(texelFetch(skinPaletteTex13, texel), texelFetch(skinPaletteTex13, texel + 1), texelFetch(skinPaletteTex13, texel + 2));
+}
+
+mat3x4 GetWorldMatrix()
+{
+    ivec4 indices = ivec4(blendIndices);
+    return GetSkinMatrix(indices.x) * blendWeights.x + GetSkinMatrix(indices.y) * blendWeights.y +
+           GetSkinMatrix(indices.z) * blendWeights.z + GetSkinMatrix(indices.w) * blendWeights.w;
+}
+#elif defined(INSTANCED)
 in vec4 texCoord3;
 in vec4 texCoord4;
 in vec4 texCoord5;
@@ -18,7 +34,10 @@ mat3x4 GetWorldMatrix()
            skinMatrices[indices.z] * blendWeights.z + skinMatrices[indices.w] * blendWeights.w;
 }
 #else
-uniform mat3x4 worldMatrix;
+layout(std140) uniform PerObjectData2
+{
+    mat3x4 worldMatrix;
+};
 
 mat3x4 GetWorldMatrix()
 {
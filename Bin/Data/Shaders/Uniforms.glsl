@@ -8,6 +8,7 @@ layout(std140) uniform PerViewData0
     uniform vec4 ambientColor;
     uniform vec3 fogColor;
     uniform vec2 fogParameters;
+    uniform vec4 clusterParameters;
     uniform vec3 dirLightDirection;
     uniform vec4 dirLightColor;
     uniform vec4 dirLightShadowSplits;
@@ -15,22 +16,15 @@ layout(std140) uniform PerViewData0
     uniform mat4x4 dirLightShadowMatrices[2];
 };
 
-struct Light
-{
-    vec4 position;
-    vec4 direction;
-    vec4 attenuation;
-    vec4 color;
-    vec4 shadowParameters;
-    mat4 shadowMatrix;
-};
-
-layout(std140) uniform LightData1
+#if defined(SKINNED) && defined(INSTANCED)
+layout(std140) uniform PerObjectData2
 {
-    Light lights[256];
+    // First texel of the skin matrices and texels per instance
+    ivec4 skinPaletteParameters;
 };
 
-#ifdef SKINNED
+uniform samplerBuffer skinPaletteTex13;
+#elif defined(SKINNED)
 layout(std140) uniform PerObjectData2
 {
     mat3x4 skinMatrices[96];
@@ -0,0 +1,239 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "../IO/Log.h"
+#include "../Math/Math.h"
+#include "GpuRingBuffer.h"
+#include "Graphics.h"
+#include "Texture.h"
+#include "UniformBuffer.h"
+
+#include <glew.h>
+#include <tracy/Tracy.hpp>
+
+// Timeout for one wait on a region's fence, after which the wait is retried
+static const GLuint64 FENCE_WAIT_TIMEOUT = 1000000000;
+static const size_t MIN_ALIGNMENT = 16;
+
+GpuRingBuffer::GpuRingBuffer() :
+    buffer(0),
+    mappedData(nullptr),
+    frameSize(0),
+    numFrames(0),
+    regionIndex(0),
+    alignment(MIN_ALIGNMENT),
+    frameIndex(0),
+    usedBytes(0),
+    flushedBytes(0),
+    persistent(false),
+    textureViewDirty(true)
+{
+    assert(Object::Subsystem<Graphics>()->IsInitialized());
+}
+
+GpuRingBuffer::~GpuRingBuffer()
+{
+    // Context may be gone at destruction time. In this case just no-op the cleanup
+    if (Object::Subsystem<Graphics>())
+        Release();
+}
+
+bool GpuRingBuffer::Define(size_t frameSize_, size_t numFrames_)
+{
+    ZoneScoped;
+
+    Release();
+
+    if (!frameSize_ || !numFrames_)
+    {
+        LOGERROR("Can not define empty ring buffer");
+        return false;
+    }
+
+    GLint uniformAlignment = 0;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uniformAlignment);
+    alignment = Max((size_t)uniformAlignment, MIN_ALIGNMENT);
+
+    // Keep all regions aligned so that allocations only need to round their size
+    frameSize = (frameSize_ + alignment - 1) / alignment * alignment;
+    numFrames = numFrames_;
+    regionIndex = 0;
+    usedBytes = 0;
+    flushedBytes = 0;
+    persistent = IsSupported();
+    fences.resize(numFrames);
+
+    return Create();
+}
+
+void GpuRingBuffer::NextFrame()
+{
+    ZoneScoped;
+
+    if (!buffer)
+        return;
+
+    size_t lastUsedBytes = usedBytes;
+
+    if (lastUsedBytes > frameSize)
+    {
+        // Grow if allocations did not fit. Redefining waits for all regions, so this should only happen during the first frames
+        LOGDEBUGF("Growing ring buffer frame size to %u", NextPowerOfTwo((unsigned)lastUsedBytes));
+        Define(NextPowerOfTwo((unsigned)lastUsedBytes), numFrames);
+    }
+    else
+    {
+        fences[regionIndex] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        regionIndex = (regionIndex + 1) % numFrames;
+        WaitRegion(regionIndex);
+    }
+
+    usedBytes = 0;
+    flushedBytes = 0;
+    ++frameIndex;
+}
+
+unsigned char* GpuRingBuffer::Allocate(size_t numBytes, size_t& offset)
+{
+    if (!mappedData || !numBytes)
+        return nullptr;
+
+    numBytes = (numBytes + alignment - 1) / alignment * alignment;
+
+    // The used byte count keeps growing also on failure, so that the next frame knows how much space would have been needed
+    size_t start = usedBytes.fetch_add(numBytes);
+    if (start + numBytes > frameSize)
+        return nullptr;
+
+    offset = regionIndex * frameSize + start;
+    return mappedData + offset;
+}
+
+void GpuRingBuffer::Flush()
+{
+    if (persistent || !buffer)
+        return;
+
+    size_t endBytes = Min((size_t)usedBytes, frameSize);
+    if (endBytes <= flushedBytes)
+        return;
+
+    // The fence guarantees the GPU is not reading this region, so the driver does not need to synchronize
+    size_t offset = regionIndex * frameSize + flushedBytes;
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, offset, endBytes - flushedBytes, mappedData + offset);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    flushedBytes = endBytes;
+}
+
+void GpuRingBuffer::BindUniformRange(size_t index, size_t offset, size_t numBytes)
+{
+    if (buffer)
+        UniformBuffer::BindRange(index, buffer, offset, numBytes);
+}
+
+Texture* GpuRingBuffer::TextureView()
+{
+    if (!buffer)
+        return nullptr;
+
+    if (!textureView)
+        textureView = new Texture();
+
+    if (textureViewDirty)
+    {
+        textureView->DefineBuffer(buffer, FMT_RGBA32F);
+        textureViewDirty = false;
+    }
+
+    return textureView.Get();
+}
+
+bool GpuRingBuffer::IsSupported()
+{
+    return GLEW_ARB_buffer_storage || GLEW_VERSION_4_4;
+}
+
+bool GpuRingBuffer::Create()
+{
+    glGenBuffers(1, &buffer);
+    if (!buffer)
+    {
+        LOGERROR("Failed to create ring buffer");
+        return false;
+    }
+
+    size_t totalSize = frameSize * numFrames;
+    textureViewDirty = true;
+
+    // Use the copy targets so that the array and uniform buffer bindings are not disturbed
+    glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+
+    if (persistent)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_COPY_WRITE_BUFFER, totalSize, nullptr, flags);
+        mappedData = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, totalSize, flags);
+    }
+    else
+    {
+        glBufferData(GL_COPY_WRITE_BUFFER, totalSize, nullptr, GL_STREAM_DRAW);
+        shadowData = new unsigned char[totalSize];
+        mappedData = shadowData.Get();
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    if (!mappedData)
+    {
+        LOGERROR("Failed to map ring buffer");
+        Release();
+        return false;
+    }
+
+    LOGDEBUGF("Created ring buffer frame size %u frames %u persistent %d", (unsigned)frameSize, (unsigned)numFrames, persistent ? 1 : 0);
+
+    return true;
+}
+
+void GpuRingBuffer::WaitRegion(size_t index)
+{
+    GLsync fence = (GLsync)fences[index];
+    if (!fence)
+        return;
+
+    ZoneScoped;
+
+    for (;;)
+    {
+        GLenum result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_WAIT_TIMEOUT);
+        if (result != GL_TIMEOUT_EXPIRED)
+            break;
+    }
+
+    glDeleteSync(fence);
+    fences[index] = nullptr;
+}
+
+void GpuRingBuffer::Release()
+{
+    for (size_t i = 0; i < fences.size(); ++i)
+        WaitRegion(i);
+
+    if (buffer)
+    {
+        Object::Subsystem<Graphics>()->ReleaseVertexArrays(buffer);
+
+        if (persistent && mappedData)
+        {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        }
+
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
+    }
+
+    mappedData = nullptr;
+    shadowData.Reset();
+}
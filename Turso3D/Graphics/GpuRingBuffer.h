@@ -0,0 +1,94 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Object/AutoPtr.h"
+#include "../Object/Ptr.h"
+#include "GraphicsDefs.h"
+
+#include <atomic>
+#include <vector>
+
+class Texture;
+
+/// GPU ring buffer for per-frame streaming of vertex and uniform data, such as instance transforms, world matrices and skinning matrices. Divided into regions for several frames in flight, which are fenced so that the CPU never overwrites data the GPU is still reading. Persistently mapped if GL_ARB_buffer_storage is supported. Without GL_ARB_buffer_storage, data is written to a CPU shadow copy and must be uploaded with Flush() before use.
+class GpuRingBuffer : public RefCounted
+{
+public:
+    /// Construct. Graphics subsystem must have been initialized.
+    GpuRingBuffer();
+    /// Destruct.
+    ~GpuRingBuffer();
+
+    /// Define with the byte size of one frame's region and the number of frames in flight. Waits for the GPU if redefining. Return true on success.
+    bool Define(size_t frameSize, size_t numFrames = 3);
+    /// Fence the current frame's region and advance to the next, waiting for the GPU to finish reading it. If last frame's allocations did not fit, grow the regions first.
+    void NextFrame();
+    /// Allocate bytes from the current frame's region and return the write pointer and byte offset into the whole buffer, or null if the region is full. Allocations are aligned for uniform buffer binding. Safe to call from worker threads.
+    unsigned char* Allocate(size_t numBytes, size_t& offset);
+    /// Upload data written since the last flush if not persistently mapped. No-op otherwise. Must not be called while other threads are writing.
+    void Flush();
+    /// Bind a range to a uniform buffer slot.
+    void BindUniformRange(size_t index, size_t offset, size_t numBytes);
+    /// Return a buffer texture that views the whole buffer as RGBA32F texels, for reading larger data such as skinning matrices in shaders. Created on first use.
+    Texture* TextureView();
+
+    /// Return byte size of one frame's region.
+    size_t FrameSize() const { return frameSize; }
+    /// Return number of frames in flight.
+    size_t NumFrames() const { return numFrames; }
+    /// Return allocation alignment in bytes.
+    size_t Alignment() const { return alignment; }
+    /// Return whether is persistently mapped.
+    bool IsPersistent() const { return persistent; }
+    /// Return the frame counter, which is incremented on each advance. Can be used to check whether data was already written this frame.
+    unsigned FrameIndex() const { return frameIndex; }
+
+    /// Return the OpenGL object identifier.
+    unsigned GLBuffer() const { return buffer; }
+
+    /// Return whether persistent mapping is supported by the OpenGL context.
+    static bool IsSupported();
+
+private:
+    /// Prevent copy construction.
+    GpuRingBuffer(const GpuRingBuffer& rhs);
+    /// Prevent assignment.
+    GpuRingBuffer& operator = (const GpuRingBuffer& rhs);
+
+    /// Create and map the GPU-side buffer. Return true on success.
+    bool Create();
+    /// Wait for a region's fence, if any, and delete it.
+    void WaitRegion(size_t regionIndex);
+    /// Wait for all regions and release the buffer.
+    void Release();
+
+    /// OpenGL object identifier.
+    unsigned buffer;
+    /// Mapped buffer memory, or the CPU shadow copy if not persistently mapped.
+    unsigned char* mappedData;
+    /// CPU shadow copy if not persistently mapped.
+    AutoArrayPtr<unsigned char> shadowData;
+    /// Byte size of one frame's region.
+    size_t frameSize;
+    /// Number of frames in flight.
+    size_t numFrames;
+    /// Current region index.
+    size_t regionIndex;
+    /// Allocation alignment.
+    size_t alignment;
+    /// Frame counter.
+    unsigned frameIndex;
+    /// Bytes allocated from the current region, including allocations that did not fit.
+    std::atomic<size_t> usedBytes;
+    /// Bytes uploaded from the current region if not persistently mapped.
+    size_t flushedBytes;
+    /// Persistent mapping flag.
+    bool persistent;
+    /// Fences of the regions. Null if not in use by the GPU.
+    std::vector<void*> fences;
+    /// Buffer texture view.
+    AutoPtr<Texture> textureView;
+    /// Buffer texture view needs to be redefined flag.
+    bool textureViewDirty;
+};
@@ -1,9 +1,11 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
+#include "../IO/FileSystem.h"
 #include "../IO/Log.h"
 #include "../Math/Math.h"
 #include "../Resource/ResourceCache.h"
 #include "FrameBuffer.h"
+#include "GpuRingBuffer.h"
 #include "Graphics.h"
 #include "IndexBuffer.h"
 #include "Shader.h"
@@ -82,6 +84,10 @@ static const unsigned glBlendOp[] =
     GL_FUNC_REVERSE_SUBTRACT
 };
 
+// Initial size of one frame's region in the frame data ring buffer. Grows if necessary
+static const size_t FRAME_DATA_BUFFER_SIZE = 1024 * 1024;
+static const size_t FRAME_DATA_BUFFER_FRAMES = 3;
+
 unsigned occlusionQueryType = GL_SAMPLES_PASSED;
 
 Graphics::Graphics(const char* windowTitle, const IntVector2& windowSize, FullScreenMode mode) :
@@ -95,7 +101,14 @@ Graphics::Graphics(const char* windowTitle, const IntVector2& windowSize, FullSc
     lastDepthBias(false),
     vsync(false),
     hasInstancing(false),
+    hasBaseInstance(false),
+    hasProgramBinary(false),
+    hasParallelShaderCompile(false),
     instancingEnabled(false),
+    lastVertexArrayKey(),
+    lastVertexArray(0),
+    vertexArrayIndexSize(0),
+    vertexArrayGeneration(1),
     lastFrameTime(0.0f)
 {
     RegisterSubsystem(this);
@@ -159,6 +172,31 @@ Graphics::Graphics(const char* windowTitle, const IntVector2& windowSize, FullSc
     if (GLEW_VERSION_3_3)
         occlusionQueryType = GL_ANY_SAMPLES_PASSED;
 
+    // Program binaries are only usable if the driver exposes at least one format
+    if (GLEW_ARB_get_program_binary || GLEW_VERSION_4_1)
+    {
+        GLint numBinaryFormats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numBinaryFormats);
+        hasProgramBinary = numBinaryFormats > 0;
+    }
+
+    // Let the driver compile shaders on its own threads, so that compile status can be polled without blocking
+    if (GLEW_ARB_parallel_shader_compile)
+    {
+        glMaxShaderCompilerThreadsARB(0xffffffff);
+        hasParallelShaderCompile = true;
+    }
+    else if (SDL_GL_ExtensionSupported("GL_KHR_parallel_shader_compile"))
+    {
+        typedef void (GLAPIENTRY *PFNMAXSHADERCOMPILERTHREADSKHR)(GLuint count);
+        PFNMAXSHADERCOMPILERTHREADSKHR maxShaderCompilerThreadsKHR = (PFNMAXSHADERCOMPILERTHREADSKHR)SDL_GL_GetProcAddress("glMaxShaderCompilerThreadsKHR");
+        if (maxShaderCompilerThreadsKHR)
+            maxShaderCompilerThreadsKHR(0xffffffff);
+        hasParallelShaderCompile = true;
+    }
+
+    driverId = std::string((const char*)glGetString(GL_VENDOR)) + " " + (const char*)glGetString(GL_RENDERER) + " " + (const char*)glGetString(GL_VERSION);
+
     glPixelStorei(GL_PACK_ALIGNMENT, 1);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     glEnable(GL_DEPTH_TEST);
@@ -171,6 +209,7 @@ Graphics::Graphics(const char* windowTitle, const IntVector2& windowSize, FullSc
     GLuint defaultVao;
     glGenVertexArrays(1, &defaultVao);
     glBindVertexArray(defaultVao);
+    VertexBuffer::SetDefaultVertexArray(defaultVao);
 
     // Use texcoords 3-5 for instancing if supported
     if (glVertexAttribDivisorARB)
@@ -180,10 +219,16 @@ Graphics::Graphics(const char* windowTitle, const IntVector2& windowSize, FullSc
         glVertexAttribDivisorARB(ATTR_TEXCOORD3, 1);
         glVertexAttribDivisorARB(ATTR_TEXCOORD4, 1);
         glVertexAttribDivisorARB(ATTR_TEXCOORD5, 1);
+
+        hasBaseInstance = GLEW_ARB_base_instance || GLEW_VERSION_4_2;
     }
 
     DefineQuadVertexBuffer();
 
+    frameDataBuffer = new GpuRingBuffer();
+    if (!frameDataBuffer->Define(FRAME_DATA_BUFFER_SIZE, FRAME_DATA_BUFFER_FRAMES))
+        frameDataBuffer.Reset();
+
     SetVSync(vsync);
     frameTimer.Reset();
 
@@ -250,6 +295,25 @@ void Graphics::SetFullScreen(FullScreenMode mode)
     SDL_RaiseWindow(window);
 }
 
+void Graphics::SetShaderCacheDir(const std::string& pathName)
+{
+    if (pathName.empty() || !hasProgramBinary)
+    {
+        shaderCacheDir.clear();
+        return;
+    }
+
+    std::string dir = AddTrailingSlash(pathName);
+    if (!DirExists(dir) && !CreateDir(dir))
+    {
+        LOGERRORF("Could not create shader cache directory %s", dir.c_str());
+        shaderCacheDir.clear();
+        return;
+    }
+
+    shaderCacheDir = dir;
+}
+
 void Graphics::SetVSync(bool enable)
 {
     if (IsInitialized())
@@ -265,6 +329,9 @@ void Graphics::Present()
 
     SDL_GL_SwapWindow(window);
 
+    if (frameDataBuffer)
+        frameDataBuffer->NextFrame();
+
     lastFrameTime = 0.000001f * frameTimer.ElapsedUSec();
     frameTimer.Reset();
 }
@@ -449,6 +516,94 @@ void Graphics::SetIndexBuffer(IndexBuffer* buffer)
         buffer->Bind();
 }
 
+void Graphics::BindVertexArray(VertexBuffer* vertexBuffer, IndexBuffer* indexBuffer, unsigned attributeMask, unsigned instanceBuffer)
+{
+    unsigned vertexArray = VertexArray(vertexBuffer, indexBuffer, attributeMask, instanceBuffer);
+    if (vertexArray)
+        BindVertexArray(vertexArray, indexBuffer ? (unsigned)indexBuffer->IndexSize() : 0);
+}
+
+void Graphics::BindVertexArray(unsigned vertexArray, unsigned indexSize)
+{
+    VertexBuffer::BindVertexArray(vertexArray);
+    vertexArrayIndexSize = indexSize;
+}
+
+unsigned Graphics::VertexArray(VertexBuffer* vertexBuffer, IndexBuffer* indexBuffer, unsigned attributeMask, unsigned instanceBuffer)
+{
+    if (!vertexBuffer || !vertexBuffer->GLBuffer())
+        return 0;
+
+    VertexArrayKey key;
+    key.vertexBuffer = vertexBuffer->GLBuffer();
+    key.indexBuffer = indexBuffer ? indexBuffer->GLBuffer() : 0;
+    key.instanceBuffer = hasInstancing ? instanceBuffer : 0;
+    key.attributeMask = attributeMask & vertexBuffer->Attributes();
+
+    // Consecutive queries of the same geometry do not need the lookup
+    if (lastVertexArray && key == lastVertexArrayKey)
+        return lastVertexArray;
+
+    auto it = vertexArrays.find(key);
+    if (it != vertexArrays.end())
+        lastVertexArray = it->second;
+    else
+    {
+        GLuint vertexArray;
+        glGenVertexArrays(1, &vertexArray);
+        VertexBuffer::BindVertexArray(vertexArray);
+        vertexBuffer->SetupVertexArray(key.attributeMask);
+
+        if (key.indexBuffer)
+            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, key.indexBuffer);
+
+        // The instance attributes point to the start of the buffer, and the draw offset is given as the base instance if supported. Divisors are per vertex array
+        if (key.instanceBuffer)
+        {
+            VertexBuffer::BindExternal(key.instanceBuffer);
+            glEnableVertexAttribArray(ATTR_TEXCOORD3);
+            glEnableVertexAttribArray(ATTR_TEXCOORD4);
+            glEnableVertexAttribArray(ATTR_TEXCOORD5);
+            glVertexAttribDivisorARB(ATTR_TEXCOORD3, 1);
+            glVertexAttribDivisorARB(ATTR_TEXCOORD4, 1);
+            glVertexAttribDivisorARB(ATTR_TEXCOORD5, 1);
+            SetInstanceAttributes(0, sizeof(Matrix3x4));
+        }
+
+        vertexArrays[key] = vertexArray;
+        lastVertexArray = vertexArray;
+        vertexArrayIndexSize = indexBuffer ? (unsigned)indexBuffer->IndexSize() : 0;
+    }
+
+    lastVertexArrayKey = key;
+    return lastVertexArray;
+}
+
+void Graphics::ReleaseVertexArrays(unsigned glBuffer)
+{
+    if (!glBuffer)
+        return;
+
+    for (auto it = vertexArrays.begin(); it != vertexArrays.end();)
+    {
+        const VertexArrayKey& key = it->first;
+        if (key.vertexBuffer == glBuffer || key.indexBuffer == glBuffer || key.instanceBuffer == glBuffer)
+        {
+            GLuint vertexArray = it->second;
+            if (VertexBuffer::BoundVertexArray() == vertexArray)
+                VertexBuffer::BindVertexArray(0);
+            if (lastVertexArray == vertexArray)
+                lastVertexArray = 0;
+
+            glDeleteVertexArrays(1, &vertexArray);
+            it = vertexArrays.erase(it);
+            ++vertexArrayGeneration;
+        }
+        else
+            ++it;
+    }
+}
+
 void Graphics::SetRenderState(BlendMode blendMode, CullMode cullMode, CompareMode depthTest, bool colorWrite, bool depthWrite)
 {
     if (blendMode != lastBlendMode)
@@ -568,7 +723,8 @@ void Graphics::Blit(FrameBuffer* dest, const IntRect& destRect, FrameBuffer* src
 
 void Graphics::Draw(PrimitiveType type, size_t drawStart, size_t drawCount)
 {
-    if (instancingEnabled)
+    // Cached vertex array objects without an instance buffer never have the instance attributes enabled
+    if (instancingEnabled && !VertexBuffer::BoundVertexArray())
     {
         glDisableVertexAttribArray(ATTR_TEXCOORD3);
         glDisableVertexAttribArray(ATTR_TEXCOORD4);
@@ -581,7 +737,7 @@ void Graphics::Draw(PrimitiveType type, size_t drawStart, size_t drawCount)
 
 void Graphics::DrawIndexed(PrimitiveType type, size_t drawStart, size_t drawCount)
 {
-    if (instancingEnabled)
+    if (instancingEnabled && !VertexBuffer::BoundVertexArray())
     {
         glDisableVertexAttribArray(ATTR_TEXCOORD3);
         glDisableVertexAttribArray(ATTR_TEXCOORD4);
@@ -589,7 +745,7 @@ void Graphics::DrawIndexed(PrimitiveType type, size_t drawStart, size_t drawCoun
         instancingEnabled = false;
     }
 
-    unsigned indexSize = (unsigned)IndexBuffer::BoundIndexSize();
+    unsigned indexSize = CurrentIndexSize();
     if (indexSize)
         glDrawElements(glPrimitiveTypes[type], (GLsizei)drawCount, indexSize == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (const void*)(drawStart * indexSize));
 }
@@ -599,45 +755,33 @@ void Graphics::DrawInstanced(PrimitiveType type, size_t drawStart, size_t drawCo
     if (!hasInstancing || !instanceVertexBuffer)
         return;
 
-    if (!instancingEnabled)
-    {
-        glEnableVertexAttribArray(ATTR_TEXCOORD3);
-        glEnableVertexAttribArray(ATTR_TEXCOORD4);
-        glEnableVertexAttribArray(ATTR_TEXCOORD5);
-        instancingEnabled = true;
-    }
-
-    unsigned instanceVertexSize = (unsigned)instanceVertexBuffer->VertexSize();
-
-    instanceVertexBuffer->Bind(0);
-    glVertexAttribPointer(ATTR_TEXCOORD3, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize));
-    glVertexAttribPointer(ATTR_TEXCOORD4, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize + sizeof(Vector4)));
-    glVertexAttribPointer(ATTR_TEXCOORD5, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize + 2 * sizeof(Vector4)));
-    glDrawArraysInstanced(glPrimitiveTypes[type], (GLint)drawStart, (GLsizei)drawCount, (GLsizei)instanceCount);
+    size_t stride = instanceVertexBuffer->VertexSize();
+    DrawInstancedInternal(false, type, drawStart, drawCount, instanceVertexBuffer->GLBuffer(), instanceStart * stride, stride, instanceCount);
 }
 
 void Graphics::DrawIndexedInstanced(PrimitiveType type, size_t drawStart, size_t drawCount, VertexBuffer* instanceVertexBuffer, size_t instanceStart, size_t instanceCount)
 {
-    unsigned indexSize = (unsigned)IndexBuffer::BoundIndexSize();
+    if (!hasInstancing || !instanceVertexBuffer)
+        return;
 
-    if (!hasInstancing || !instanceVertexBuffer || !indexSize)
+    size_t stride = instanceVertexBuffer->VertexSize();
+    DrawInstancedInternal(true, type, drawStart, drawCount, instanceVertexBuffer->GLBuffer(), instanceStart * stride, stride, instanceCount);
+}
+
+void Graphics::DrawInstanced(PrimitiveType type, size_t drawStart, size_t drawCount, GpuRingBuffer* instanceBuffer, size_t instanceOffset, size_t instanceCount)
+{
+    if (!hasInstancing || !instanceBuffer)
         return;
 
-    if (!instancingEnabled)
-    {
-        glEnableVertexAttribArray(ATTR_TEXCOORD3);
-        glEnableVertexAttribArray(ATTR_TEXCOORD4);
-        glEnableVertexAttribArray(ATTR_TEXCOORD5);
-        instancingEnabled = true;
-    }
+    DrawInstancedInternal(false, type, drawStart, drawCount, instanceBuffer->GLBuffer(), instanceOffset, sizeof(Matrix3x4), instanceCount);
+}
 
-    unsigned instanceVertexSize = (unsigned)instanceVertexBuffer->VertexSize();
+void Graphics::DrawIndexedInstanced(PrimitiveType type, size_t drawStart, size_t drawCount, GpuRingBuffer* instanceBuffer, size_t instanceOffset, size_t instanceCount)
+{
+    if (!hasInstancing || !instanceBuffer)
+        return;
 
-    instanceVertexBuffer->Bind(0);
-    glVertexAttribPointer(ATTR_TEXCOORD3, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize));
-    glVertexAttribPointer(ATTR_TEXCOORD4, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize + sizeof(Vector4)));
-    glVertexAttribPointer(ATTR_TEXCOORD5, 4, GL_FLOAT, GL_FALSE, instanceVertexSize, (const void*)(instanceStart * instanceVertexSize + 2 * sizeof(Vector4)));
-    glDrawElementsInstanced(glPrimitiveTypes[type], (GLsizei)drawCount, indexSize == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, (const void*)(drawStart * indexSize), (GLsizei)instanceCount);
+    DrawInstancedInternal(true, type, drawStart, drawCount, instanceBuffer->GLBuffer(), instanceOffset, sizeof(Matrix3x4), instanceCount);
 }
 
 void Graphics::DrawQuad()
@@ -792,6 +936,66 @@ void Graphics::DefineQuadVertexBuffer()
     quadVertexBuffer->Define(USAGE_DEFAULT, 6, vertexDeclaration, quadVertexData);
 }
 
+void Graphics::SetInstanceAttributes(size_t byteOffset, size_t stride)
+{
+    // Cached vertex array objects with an instance buffer have the instance attributes always enabled
+    if (!instancingEnabled && !VertexBuffer::BoundVertexArray())
+    {
+        glEnableVertexAttribArray(ATTR_TEXCOORD3);
+        glEnableVertexAttribArray(ATTR_TEXCOORD4);
+        glEnableVertexAttribArray(ATTR_TEXCOORD5);
+        instancingEnabled = true;
+    }
+
+    glVertexAttribPointer(ATTR_TEXCOORD3, 4, GL_FLOAT, GL_FALSE, (GLsizei)stride, (const void*)byteOffset);
+    glVertexAttribPointer(ATTR_TEXCOORD4, 4, GL_FLOAT, GL_FALSE, (GLsizei)stride, (const void*)(byteOffset + sizeof(Vector4)));
+    glVertexAttribPointer(ATTR_TEXCOORD5, 4, GL_FLOAT, GL_FALSE, (GLsizei)stride, (const void*)(byteOffset + 2 * sizeof(Vector4)));
+}
+
+void Graphics::DrawInstancedInternal(bool indexed, PrimitiveType type, size_t drawStart, size_t drawCount, unsigned instanceBuffer, size_t instanceOffset, size_t instanceStride, size_t instanceCount)
+{
+    unsigned indexSize = CurrentIndexSize();
+    if (indexed && !indexSize)
+        return;
+
+    // Cached vertex array objects source the instance attributes from the start of the buffer. If the offset can not be given as the base instance, point the attributes to it for this draw only
+    bool vertexArrayBound = VertexBuffer::BoundVertexArray() != 0;
+    bool useBaseInstance = vertexArrayBound && hasBaseInstance && !(instanceOffset % instanceStride);
+    GLuint baseInstance = useBaseInstance ? (GLuint)(instanceOffset / instanceStride) : 0;
+
+    if (!useBaseInstance)
+    {
+        VertexBuffer::BindExternal(instanceBuffer);
+        SetInstanceAttributes(instanceOffset, instanceStride);
+    }
+
+    if (indexed)
+    {
+        GLenum indexType = indexSize == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        const void* indexOffset = (const void*)(drawStart * indexSize);
+
+        if (baseInstance)
+            glDrawElementsInstancedBaseInstance(glPrimitiveTypes[type], (GLsizei)drawCount, indexType, indexOffset, (GLsizei)instanceCount, baseInstance);
+        else
+            glDrawElementsInstanced(glPrimitiveTypes[type], (GLsizei)drawCount, indexType, indexOffset, (GLsizei)instanceCount);
+    }
+    else
+    {
+        if (baseInstance)
+            glDrawArraysInstancedBaseInstance(glPrimitiveTypes[type], (GLint)drawStart, (GLsizei)drawCount, (GLsizei)instanceCount, baseInstance);
+        else
+            glDrawArraysInstanced(glPrimitiveTypes[type], (GLint)drawStart, (GLsizei)drawCount, (GLsizei)instanceCount);
+    }
+
+    if (!useBaseInstance && vertexArrayBound && hasBaseInstance)
+        SetInstanceAttributes(0, instanceStride);
+}
+
+unsigned Graphics::CurrentIndexSize() const
+{
+    return VertexBuffer::BoundVertexArray() ? vertexArrayIndexSize : (unsigned)IndexBuffer::BoundIndexSize();
+}
+
 void RegisterGraphicsLibrary()
 {
     static bool registered = false;
@@ -10,7 +10,10 @@
 #include "../Time/Timer.h"
 #include "GraphicsDefs.h"
 
+#include <map>
+
 class FrameBuffer;
+class GpuRingBuffer;
 class IndexBuffer;
 class ShaderProgram;
 class Texture;
@@ -27,6 +30,35 @@ enum FullScreenMode
     MAX_FULLSCREEN_MODES
 };
 
+/// Key of a cached vertex array object. Buffers are identified by their OpenGL object identifiers.
+struct VertexArrayKey
+{
+    /// Test for equality with another key.
+    bool operator == (const VertexArrayKey& rhs) const { return vertexBuffer == rhs.vertexBuffer && indexBuffer == rhs.indexBuffer && instanceBuffer == rhs.instanceBuffer && attributeMask == rhs.attributeMask; }
+    /// Test for inequality with another key.
+    bool operator != (const VertexArrayKey& rhs) const { return !(*this == rhs); }
+    /// Test for less than with another key, for ordering in a map.
+    bool operator < (const VertexArrayKey& rhs) const
+    {
+        if (vertexBuffer != rhs.vertexBuffer)
+            return vertexBuffer < rhs.vertexBuffer;
+        if (indexBuffer != rhs.indexBuffer)
+            return indexBuffer < rhs.indexBuffer;
+        if (instanceBuffer != rhs.instanceBuffer)
+            return instanceBuffer < rhs.instanceBuffer;
+        return attributeMask < rhs.attributeMask;
+    }
+
+    /// Vertex buffer.
+    unsigned vertexBuffer;
+    /// Index buffer, or zero if none.
+    unsigned indexBuffer;
+    /// Instance transform buffer, or zero if none.
+    unsigned instanceBuffer;
+    /// Vertex attribute mask.
+    unsigned attributeMask;
+};
+
 /// Occlusion query result.
 struct OcclusionQueryResult
 {
@@ -55,6 +87,8 @@ public:
     void Resize(const IntVector2& size);
     /// Change fullscreen mode only.
     void SetFullScreen(FullScreenMode mode);
+    /// Set directory for caching linked shader program binaries to speed up later program creation, or empty to disable. The directory is created if does not exist. No effect if program binaries are not supported.
+    void SetShaderCacheDir(const std::string& pathName);
     /// Set vertical sync on/off.
     void SetVSync(bool enable);
     /// Present the contents of the backbuffer.
@@ -100,6 +134,14 @@ public:
     void SetVertexBuffer(VertexBuffer* buffer, ShaderProgram* program);
     /// Bind an index buffer for use. Provided for convenience.
     void SetIndexBuffer(IndexBuffer* buffer);
+    /// Bind a cached vertex array object for a vertex buffer's attributes, an optional index buffer, and optional instance transforms from an OpenGL buffer object. The vertex array object is created on first use. Binding vertex or index buffers individually returns to the default vertex array object.
+    void BindVertexArray(VertexBuffer* vertexBuffer, IndexBuffer* indexBuffer, unsigned attributeMask, unsigned instanceBuffer = 0);
+    /// Bind a vertex array object returned by VertexArray(), along with the index size of its index buffer, or zero if not indexed.
+    void BindVertexArray(unsigned vertexArray, unsigned indexSize);
+    /// Return a cached vertex array object, creating it on first use, or zero if the vertex buffer is not defined. Creation leaves the new object bound. The identifier stays valid until VertexArrayGeneration() changes.
+    unsigned VertexArray(VertexBuffer* vertexBuffer, IndexBuffer* indexBuffer, unsigned attributeMask, unsigned instanceBuffer = 0);
+    /// Release cached vertex array objects that refer to an OpenGL buffer object. Called by buffers when they are released.
+    void ReleaseVertexArrays(unsigned glBuffer);
     /// Set basic renderstates.
     void SetRenderState(BlendMode blendMode, CullMode cullMode = CULL_BACK, CompareMode depthTest = CMP_LESS, bool colorWrite = true, bool depthWrite = true);
     /// Set depth bias.
@@ -116,6 +158,10 @@ public:
     void DrawInstanced(PrimitiveType type, size_t drawStart, size_t drawCount, VertexBuffer* instanceVertexBuffer, size_t instanceStart, size_t instanceCount);
     /// Draw instanced indexed geometry with the currently bound vertex and index buffer, and the specified instance data vertex buffer.
     void DrawIndexedInstanced(PrimitiveType type, size_t drawStart, size_t drawCount, VertexBuffer* instanceVertexBuffer, size_t instanceStart, size_t instanceCount);
+    /// Draw instanced non-indexed geometry with the currently bound vertex buffer, and instance transforms from a ring buffer byte offset.
+    void DrawInstanced(PrimitiveType type, size_t drawStart, size_t drawCount, GpuRingBuffer* instanceBuffer, size_t instanceOffset, size_t instanceCount);
+    /// Draw instanced indexed geometry with the currently bound vertex and index buffer, and instance transforms from a ring buffer byte offset.
+    void DrawIndexedInstanced(PrimitiveType type, size_t drawStart, size_t drawCount, GpuRingBuffer* instanceBuffer, size_t instanceOffset, size_t instanceCount);
     /// Draw a quad with current renderstate. The quad vertex buffer is left bound.
     void DrawQuad();
 
@@ -134,6 +180,18 @@ public:
     bool IsInitialized() const { return context != nullptr; }
     /// Return whether has instancing support.
     bool HasInstancing() const { return hasInstancing; }
+    /// Return whether linked shader program binaries can be retrieved and loaded.
+    bool HasProgramBinary() const { return hasProgramBinary; }
+    /// Return whether shader compile status can be polled without blocking.
+    bool HasParallelShaderCompile() const { return hasParallelShaderCompile; }
+    /// Return the shader program binary cache directory, or empty if disabled.
+    const std::string& ShaderCacheDir() const { return shaderCacheDir; }
+    /// Return the OpenGL vendor, renderer and version string. Used to validate cached shader program binaries.
+    const std::string& DriverId() const { return driverId; }
+    /// Return the vertex array object generation. Changes when cached vertex array objects are released, invalidating identifiers stored elsewhere.
+    unsigned VertexArrayGeneration() const { return vertexArrayGeneration; }
+    /// Return the ring buffer for streaming per-frame data, or null if failed to create. Advanced to the next frame on Present().
+    GpuRingBuffer* FrameDataBuffer() const { return frameDataBuffer.Get(); }
     /// Return current window size.
     IntVector2 Size() const;
     /// Return current window width.
@@ -158,6 +216,12 @@ public:
 private:
     /// Set up the vertex buffer for quad rendering.
     void DefineQuadVertexBuffer();
+    /// Set up the instancing vertex attributes from the currently bound array buffer.
+    void SetInstanceAttributes(size_t byteOffset, size_t stride);
+    /// Draw instanced geometry with instance transforms from an OpenGL buffer object at a byte offset. Uses the offset as the base instance if a cached vertex array object is bound and base instance is supported.
+    void DrawInstancedInternal(bool indexed, PrimitiveType type, size_t drawStart, size_t drawCount, unsigned instanceBuffer, size_t instanceOffset, size_t instanceStride, size_t instanceCount);
+    /// Return the index size of the bound index buffer or cached vertex array object, or 0 if none.
+    unsigned CurrentIndexSize() const;
 
     /// OS-level rendering window.
     SDL_Window* window;
@@ -165,6 +229,8 @@ private:
     void* context;
     /// Quad vertex buffer.
     AutoPtr<VertexBuffer> quadVertexBuffer;
+    /// Per-frame data ring buffer.
+    AutoPtr<GpuRingBuffer> frameDataBuffer;
     /// Last blend mode.
     BlendMode lastBlendMode;
     /// Last cull mode.
@@ -181,12 +247,32 @@ private:
     bool vsync;
     /// Instancing support flag.
     bool hasInstancing;
-    /// Whether instance vertex elements are enabled.
+    /// Base instance support flag.
+    bool hasBaseInstance;
+    /// Shader program binary support flag.
+    bool hasProgramBinary;
+    /// Parallel shader compile support flag.
+    bool hasParallelShaderCompile;
+    /// Whether instance vertex elements are enabled on the default vertex array object.
     bool instancingEnabled;
+    /// Cached vertex array objects.
+    std::map<VertexArrayKey, unsigned> vertexArrays;
+    /// Key of the last bound cached vertex array object.
+    VertexArrayKey lastVertexArrayKey;
+    /// Last bound cached vertex array object.
+    unsigned lastVertexArray;
+    /// Index size of the last bound cached vertex array object.
+    unsigned vertexArrayIndexSize;
+    /// Vertex array object generation. Incremented whenever cached objects are released.
+    unsigned vertexArrayGeneration;
     /// Pending occlusion queries.
     std::vector<std::pair<unsigned, void*> > pendingQueries;
     /// Free occlusion queries.
     std::vector<unsigned> freeQueries;
+    /// Shader program binary cache directory.
+    std::string shaderCacheDir;
+    /// OpenGL vendor, renderer and version string.
+    std::string driverId;
     /// Frame timer.
     HiresTimer frameTimer;
     /// Last frame interval in seconds.
@@ -128,6 +128,7 @@ enum TextureType
     TEX_2D = 0,
     TEX_3D,
     TEX_CUBE,
+    TEX_BUFFER
 };
 
 /// Resource usage modes for buffers.
@@ -182,7 +183,8 @@ enum GeometryType
     GEOM_STATIC = 0,
     GEOM_SKINNED,
     GEOM_INSTANCED,
-    GEOM_CUSTOM
+    GEOM_CUSTOM,
+    GEOM_SKINNED_INSTANCED
 };
 
 /// Description of an element in a vertex declaration.
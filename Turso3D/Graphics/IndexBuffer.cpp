@@ -3,6 +3,7 @@
 #include "../IO/Log.h"
 #include "Graphics.h"
 #include "IndexBuffer.h"
+#include "VertexBuffer.h"
 
 #include <glew.h>
 #include <cstring>
@@ -84,7 +85,14 @@ bool IndexBuffer::SetData(size_t firstIndex, size_t numIndices_, const void* dat
 
 void IndexBuffer::Bind()
 {
-    if (!buffer || boundIndexBuffer == this)
+    if (!buffer)
+        return;
+
+    // The index buffer binding is tracked for the default vertex array object only
+    if (VertexBuffer::BoundVertexArray())
+        VertexBuffer::BindVertexArray(0);
+
+    if (boundIndexBuffer == this)
         return;
 
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
@@ -119,6 +127,7 @@ void IndexBuffer::Release()
 {
     if (buffer)
     {
+        Object::Subsystem<Graphics>()->ReleaseVertexArrays(buffer);
         glDeleteBuffers(1, &buffer);
         buffer = 0;
 
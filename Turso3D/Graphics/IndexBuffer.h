@@ -19,7 +19,7 @@ public:
     bool Define(ResourceUsage usage, size_t numIndices, size_t indexSize, const void* data = nullptr);
     /// Redefine buffer data either completely or partially. Return true on success.
     bool SetData(size_t firstIndex, size_t numIndices, const void* data, bool discard = false);
-    /// Bind to use. No-op if already bound. Used also when defining or setting data.
+    /// Bind to use. No-op if already bound. Used also when defining or setting data. Returns to the default vertex array object if a cached one is bound.
     void Bind();
 
     /// Return number of indices.
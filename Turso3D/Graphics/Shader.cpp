@@ -41,7 +41,7 @@ void Shader::Define(const std::string& code)
     EndLoad();
 }
 
-ShaderProgram* Shader::CreateProgram(const std::string& vsDefinesIn, const std::string& fsDefinesIn)
+ShaderProgram* Shader::CreateProgram(const std::string& vsDefinesIn, const std::string& fsDefinesIn, bool deferred)
 {
     auto hashPair = std::make_pair(StringHash(vsDefinesIn), StringHash(fsDefinesIn));
 
@@ -57,7 +57,7 @@ ShaderProgram* Shader::CreateProgram(const std::string& vsDefinesIn, const std::
     if (it != programs.end())
         return it->second;
 
-    ShaderProgram* newVariation = new ShaderProgram(sourceCode, Name(), vsDefines, fsDefines);
+    ShaderProgram* newVariation = new ShaderProgram(sourceCode, Name(), vsDefines, fsDefines, deferred);
     programs[hashPair] = newVariation;
     programs[normalizedHashPair] = newVariation;
     return newVariation;
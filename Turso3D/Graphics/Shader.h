@@ -28,8 +28,8 @@ public:
 
     /// Define shader from source code. All existing variations are destroyed.
     void Define(const std::string& code);
-    /// Create and return a shader program with defines. Existing program is returned if possible. Variations should be cached to avoid repeated query.
-    ShaderProgram* CreateProgram(const std::string& vsDefines = JSONValue::emptyString, const std::string& fsDefines = JSONValue::emptyString);
+    /// Create and return a shader program with defines. Existing program is returned if possible. Variations should be cached to avoid repeated query. If deferred, a new program is only started compiling.
+    ShaderProgram* CreateProgram(const std::string& vsDefines = JSONValue::emptyString, const std::string& fsDefines = JSONValue::emptyString, bool deferred = false);
     
     /// Return shader source code.
     const std::string& SourceCode() const { return sourceCode; }
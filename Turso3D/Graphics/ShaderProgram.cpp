@@ -1,5 +1,7 @@
 ﻿// For conditions of distribution and use, see copyright notice in License.txt
 
+#include "../IO/File.h"
+#include "../IO/FileSystem.h"
 #include "../IO/Log.h"
 #include "Graphics.h"
 #include "ShaderProgram.h"
@@ -10,8 +12,11 @@
 #include <cctype>
 
 static ShaderProgram* boundProgram = nullptr;
+static unsigned nextSortId = 0;
 
 const size_t MAX_NAME_LENGTH = 256;
+const unsigned long long FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+const unsigned long long FNV_PRIME = 0x100000001b3ULL;
 
 const char* attribNames[] =
 {
@@ -55,6 +60,18 @@ void CommentOutFunction(std::string& code, const std::string& signature)
     }
 }
 
+unsigned long long HashSourceCode(const std::string& code, unsigned long long hash = FNV_OFFSET_BASIS)
+{
+    // 64-bit FNV-1a, as the 32-bit string hash is too collision-prone for identifying cached binaries by file name
+    for (size_t i = 0; i < code.length(); ++i)
+    {
+        hash ^= (unsigned char)code[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
 int NumberPostfix(const std::string& string)
 {
     for (size_t i = 0; i < string.length(); ++i)
@@ -66,14 +83,20 @@ int NumberPostfix(const std::string& string)
     return -1;
 }
 
-ShaderProgram::ShaderProgram(const std::string& sourceCode, const std::string& shaderName_, const std::string& vsDefines, const std::string& fsDefines) :
-    program(0)
+ShaderProgram::ShaderProgram(const std::string& sourceCode, const std::string& shaderName_, const std::string& vsDefines, const std::string& fsDefines, bool deferred) :
+    program(0),
+    vertexShader(0),
+    fragmentShader(0),
+    sourceHash(0),
+    pending(false)
 {
     assert(Object::Subsystem<Graphics>()->IsInitialized());
 
     shaderName = vsDefines.length() ? (shaderName_ + " " + vsDefines + " " + fsDefines) : (shaderName_ + " " + fsDefines);
+    // Programs are only created in the main thread. If the ids wrap around, the only consequence is less optimal batch sorting
+    sortId = (unsigned short)(nextSortId++ % 0xffff + 1);
 
-    Create(sourceCode, Split(vsDefines), Split(fsDefines));
+    Create(sourceCode, Split(vsDefines), Split(fsDefines), deferred);
 }
 
 ShaderProgram::~ShaderProgram()
@@ -101,6 +124,9 @@ int ShaderProgram::Uniform(StringHash name) const
 
 bool ShaderProgram::Bind()
 {
+    if (pending)
+        Finish();
+
     if (!program)
         return false;
 
@@ -112,7 +138,36 @@ bool ShaderProgram::Bind()
     return true;
 }
 
-void ShaderProgram::Create(const std::string& sourceCode, const std::vector<std::string>& vsDefines, const std::vector<std::string>& fsDefines)
+void ShaderProgram::Finish()
+{
+    if (!pending)
+        return;
+
+    ZoneScoped;
+
+    pending = false;
+
+    if (!FinishCompile())
+        return;
+
+    if (!cacheFileName.empty())
+        SaveBinary(cacheFileName, sourceHash);
+
+    Reflect();
+}
+
+bool ShaderProgram::IsCompleted() const
+{
+    if (!pending || !Object::Subsystem<Graphics>()->HasParallelShaderCompile())
+        return true;
+
+    // The KHR and ARB parallel shader compile extensions share the completion status enum
+    int completed = 0;
+    glGetProgramiv(program, GL_COMPLETION_STATUS_ARB, &completed);
+    return completed != 0;
+}
+
+void ShaderProgram::Create(const std::string& sourceCode, const std::vector<std::string>& vsDefines, const std::vector<std::string>& fsDefines, bool deferred)
 {
     ZoneScoped;
 
@@ -128,29 +183,6 @@ void ShaderProgram::Create(const std::string& sourceCode, const std::vector<std:
     vsSourceCode += sourceCode;
     CommentOutFunction(vsSourceCode, "void frag(");
     ReplaceInPlace(vsSourceCode, "void vert(", "void main(");
-    const char* vsShaderStr = vsSourceCode.c_str();
-
-    int vsCompiled;
-    unsigned vs = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vs, 1, &vsShaderStr, nullptr);
-    glCompileShader(vs);
-    glGetShaderiv(vs, GL_COMPILE_STATUS, &vsCompiled);
-
-    {
-        int length, outLength;
-        std::string errorString;
-
-        glGetShaderiv(vs, GL_INFO_LOG_LENGTH, &length);
-        errorString.resize(length);
-        glGetShaderInfoLog(vs, 1024, &outLength, &errorString[0]);
-
-        if (!vsCompiled)
-            LOGERRORF("VS %s compile error: %s", shaderName.c_str(), errorString.c_str());
-#ifdef _DEBUG
-        else if (length > 1)
-            LOGDEBUGF("VS %s compile output: %s", shaderName.c_str(), errorString.c_str());
-#endif
-    }
 
     std::string fsSourceCode;
     fsSourceCode += "#version 150\n";
@@ -164,71 +196,32 @@ void ShaderProgram::Create(const std::string& sourceCode, const std::vector<std:
     fsSourceCode += sourceCode;
     CommentOutFunction(fsSourceCode, "void vert(");
     ReplaceInPlace(fsSourceCode, "void frag(", "void main(");
-    const char* fsShaderStr = fsSourceCode.c_str();
 
-    int fsCompiled;
-    unsigned fs = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fs, 1, &fsShaderStr, nullptr);
-    glCompileShader(fs);
-    glGetShaderiv(fs, GL_COMPILE_STATUS, &fsCompiled);
+    // The final source code includes the normalized defines, so it identifies the program variation
+    Graphics* graphics = Object::Subsystem<Graphics>();
 
+    if (!graphics->ShaderCacheDir().empty())
     {
-        int length, outLength;
-        std::string errorString;
-
-        glGetShaderiv(fs, GL_INFO_LOG_LENGTH, &length);
-        errorString.resize(length);
-        glGetShaderInfoLog(fs, 1024, &outLength, &errorString[0]);
-
-        if (!fsCompiled)
-            LOGERRORF("FS %s compile error: %s", shaderName.c_str(), errorString.c_str());
-#ifdef _DEBUG
-        else if (length > 1)
-            LOGDEBUGF("FS %s compile output: %s", shaderName.c_str(), errorString.c_str());
-#endif
+        sourceHash = HashSourceCode(fsSourceCode, HashSourceCode(vsSourceCode));
+        cacheFileName = graphics->ShaderCacheDir() + FormatString("%016llx", sourceHash) + ".bin";
     }
 
-    if (!vsCompiled || !fsCompiled)
+    if (!cacheFileName.empty() && LoadBinary(cacheFileName, sourceHash))
     {
-        glDeleteShader(vs);
-        glDeleteShader(fs);
+        Reflect();
         return;
     }
 
-    program = glCreateProgram();
-    glAttachShader(program, vs);
-    glAttachShader(program, fs);
-    for (unsigned i = 0; i < MAX_VERTEX_ATTRIBUTES; ++i)
-        glBindAttribLocation(program, i, attribNames[i]);
-
-    glLinkProgram(program);
-    glDeleteShader(vs);
-    glDeleteShader(fs);
-
-    int linked;
-    glGetProgramiv(program, GL_LINK_STATUS, &linked);
-
-    {
-        int length, outLength;
-        std::string errorString;
-
-        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
-        errorString.resize(length);
-        glGetProgramInfoLog(program, length, &outLength, &errorString[0]);
+    // Status queries would wait for the driver, so they are left to Finish()
+    StartCompile(vsSourceCode, fsSourceCode, !cacheFileName.empty());
+    pending = true;
 
-        if (!linked)
-        {
-            LOGERRORF("Could not link shader %s: %s", shaderName.c_str(), errorString.c_str());
-            glDeleteProgram(program);
-            program = 0;
-            return;
-        }
-#ifdef _DEBUG
-        else if (length > 1)
-            LOGDEBUGF("Shader %s link messages: %s", shaderName.c_str(), errorString.c_str());
-#endif
-    }
+    if (!deferred)
+        Finish();
+}
 
+void ShaderProgram::Reflect()
+{
     char nameBuffer[MAX_NAME_LENGTH];
     int numAttributes, numUniforms, nameLength, numElements, numUniformBlocks;
     GLenum type;
@@ -307,8 +300,195 @@ void ShaderProgram::Create(const std::string& sourceCode, const std::vector<std:
     LOGDEBUGF("Linked shader program %s", shaderName.c_str());
 }
 
+void ShaderProgram::StartCompile(const std::string& vsSourceCode, const std::string& fsSourceCode, bool retrievable)
+{
+    ZoneScoped;
+
+    const char* vsShaderStr = vsSourceCode.c_str();
+    vertexShader = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vertexShader, 1, &vsShaderStr, nullptr);
+    glCompileShader(vertexShader);
+
+    const char* fsShaderStr = fsSourceCode.c_str();
+    fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fragmentShader, 1, &fsShaderStr, nullptr);
+    glCompileShader(fragmentShader);
+
+    // Link without checking the compile results. If either shader failed, linking fails too and the errors are reported when finishing
+    program = glCreateProgram();
+    glAttachShader(program, vertexShader);
+    glAttachShader(program, fragmentShader);
+    for (unsigned i = 0; i < MAX_VERTEX_ATTRIBUTES; ++i)
+        glBindAttribLocation(program, i, attribNames[i]);
+    if (retrievable)
+        glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+    glLinkProgram(program);
+}
+
+bool ShaderProgram::FinishCompile()
+{
+    ZoneScoped;
+
+    int vsCompiled;
+    glGetShaderiv(vertexShader, GL_COMPILE_STATUS, &vsCompiled);
+
+    {
+        int length, outLength;
+        std::string errorString;
+
+        glGetShaderiv(vertexShader, GL_INFO_LOG_LENGTH, &length);
+        errorString.resize(length);
+        glGetShaderInfoLog(vertexShader, 1024, &outLength, &errorString[0]);
+
+        if (!vsCompiled)
+            LOGERRORF("VS %s compile error: %s", shaderName.c_str(), errorString.c_str());
+#ifdef _DEBUG
+        else if (length > 1)
+            LOGDEBUGF("VS %s compile output: %s", shaderName.c_str(), errorString.c_str());
+#endif
+    }
+
+    int fsCompiled;
+    glGetShaderiv(fragmentShader, GL_COMPILE_STATUS, &fsCompiled);
+
+    {
+        int length, outLength;
+        std::string errorString;
+
+        glGetShaderiv(fragmentShader, GL_INFO_LOG_LENGTH, &length);
+        errorString.resize(length);
+        glGetShaderInfoLog(fragmentShader, 1024, &outLength, &errorString[0]);
+
+        if (!fsCompiled)
+            LOGERRORF("FS %s compile error: %s", shaderName.c_str(), errorString.c_str());
+#ifdef _DEBUG
+        else if (length > 1)
+            LOGDEBUGF("FS %s compile output: %s", shaderName.c_str(), errorString.c_str());
+#endif
+    }
+
+    // The shaders stay alive while attached, and are freed along with the program
+    glDeleteShader(vertexShader);
+    glDeleteShader(fragmentShader);
+    vertexShader = 0;
+    fragmentShader = 0;
+
+    if (!vsCompiled || !fsCompiled)
+    {
+        glDeleteProgram(program);
+        program = 0;
+        return false;
+    }
+
+    int linked;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+
+    {
+        int length, outLength;
+        std::string errorString;
+
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &length);
+        errorString.resize(length);
+        glGetProgramInfoLog(program, length, &outLength, &errorString[0]);
+
+        if (!linked)
+        {
+            LOGERRORF("Could not link shader %s: %s", shaderName.c_str(), errorString.c_str());
+            glDeleteProgram(program);
+            program = 0;
+            return false;
+        }
+#ifdef _DEBUG
+        else if (length > 1)
+            LOGDEBUGF("Shader %s link messages: %s", shaderName.c_str(), errorString.c_str());
+#endif
+    }
+
+    return true;
+}
+
+bool ShaderProgram::LoadBinary(const std::string& fileName, unsigned long long sourceHash)
+{
+    if (!FileExists(fileName))
+        return false;
+
+    ZoneScoped;
+
+    File file(fileName);
+    if (!file.IsOpen() || file.ReadFileID() != "TSPB")
+        return false;
+
+    // The binary is only valid for the same driver version
+    if (file.Read<std::string>() != Object::Subsystem<Graphics>()->DriverId() || file.Read<unsigned long long>() != sourceHash)
+        return false;
+
+    unsigned binaryFormat = file.Read<unsigned>();
+    std::vector<unsigned char> binary = file.ReadBuffer();
+    if (binary.empty())
+        return false;
+
+    program = glCreateProgram();
+    glProgramBinary(program, binaryFormat, &binary[0], (GLsizei)binary.size());
+
+    int linked;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked)
+    {
+        LOGDEBUGF("Cached binary of shader program %s was rejected, compiling from source", shaderName.c_str());
+        glDeleteProgram(program);
+        program = 0;
+        return false;
+    }
+
+    LOGDEBUGF("Loaded cached binary of shader program %s", shaderName.c_str());
+    return true;
+}
+
+void ShaderProgram::SaveBinary(const std::string& fileName, unsigned long long sourceHash)
+{
+    ZoneScoped;
+
+    int length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    std::vector<unsigned char> binary(length);
+    GLenum binaryFormat;
+    GLsizei outLength = 0;
+    glGetProgramBinary(program, length, &outLength, &binaryFormat, &binary[0]);
+    if (outLength <= 0)
+        return;
+
+    binary.resize(outLength);
+
+    File file(fileName, FILE_WRITE);
+    if (!file.IsOpen())
+        return;
+
+    file.WriteFileID("TSPB");
+    file.Write(Object::Subsystem<Graphics>()->DriverId());
+    file.Write(sourceHash);
+    file.Write((unsigned)binaryFormat);
+    file.WriteBuffer(binary);
+}
+
 void ShaderProgram::Release()
 {
+    if (vertexShader)
+    {
+        glDeleteShader(vertexShader);
+        vertexShader = 0;
+    }
+    if (fragmentShader)
+    {
+        glDeleteShader(fragmentShader);
+        fragmentShader = 0;
+    }
+
+    pending = false;
+
     if (program)
     {
         glDeleteProgram(program);
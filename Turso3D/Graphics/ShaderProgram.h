@@ -11,13 +11,20 @@
 class ShaderProgram : public RefCounted
 {
 public:
-    /// Construct from shader source code and defines. Graphics subsystem must have been initialized.
-    ShaderProgram(const std::string& sourceCode, const std::string& shaderName = JSONValue::emptyString, const std::string& vsDefines = JSONValue::emptyString, const std::string& fsDefines = JSONValue::emptyString);
+    /// Construct from shader source code and defines. Graphics subsystem must have been initialized. If deferred, compiling and linking is only started, and is finished by Finish() or on first bind.
+    ShaderProgram(const std::string& sourceCode, const std::string& shaderName = JSONValue::emptyString, const std::string& vsDefines = JSONValue::emptyString, const std::string& fsDefines = JSONValue::emptyString, bool deferred = false);
     /// Destruct.
     ~ShaderProgram();
 
-    /// Bind for using. No-op if already bound. Return false if program is not successfully linked.
+    /// Bind for using. No-op if already bound. Finishes a deferred compile first. Return false if program is not successfully linked.
     bool Bind();
+    /// Finish a deferred compile: check for errors, save to the binary cache and query attributes and uniforms. Blocks until the driver has finished compiling. No-op if not pending.
+    void Finish();
+
+    /// Return whether a deferred compile has not been finished yet.
+    bool IsPending() const { return pending; }
+    /// Return whether the driver has finished a deferred compile, so that Finish() will not block. Does not block if parallel shader compile is supported, otherwise always true. Also true if not pending.
+    bool IsCompleted() const;
 
     /// Return shader name concatenated from parent shader name and defines.
     const std::string& ShaderName() const { return shaderName; }
@@ -36,15 +43,31 @@ public:
 
     /// Return the OpenGL shader program identifier. Zero if not successfully compiled and linked.
     unsigned GLProgram() const { return program; }
+    /// Return the nonzero id used for sorting batches by shader program.
+    unsigned short SortId() const { return sortId; }
 
 private:
-    /// Compile & link.
-    void Create(const std::string& sourceCode, const std::vector<std::string>& vsDefines, const std::vector<std::string>& fsDefines);
+    /// Load from the shader program binary cache if possible, otherwise start compiling & linking. Finish unless deferred.
+    void Create(const std::string& sourceCode, const std::vector<std::string>& vsDefines, const std::vector<std::string>& fsDefines, bool deferred);
+    /// Start compiling & linking from final source code without querying the results. Optionally allow retrieving the program binary.
+    void StartCompile(const std::string& vsSourceCode, const std::string& fsSourceCode, bool retrievable);
+    /// Check the compile & link results and log errors. Return true on success.
+    bool FinishCompile();
+    /// Query attributes and uniforms, and assign texture units and uniform block bindings.
+    void Reflect();
+    /// Load the program from a cached binary file. Fails if the file was written by a different driver or for different source code. Return true on success.
+    bool LoadBinary(const std::string& fileName, unsigned long long sourceHash);
+    /// Save the linked program's binary to the cache.
+    void SaveBinary(const std::string& fileName, unsigned long long sourceHash);
     /// Release the program.
     void Release();
 
     /// OpenGL shader program identifier.
     unsigned program;
+    /// OpenGL vertex shader identifier while compiling.
+    unsigned vertexShader;
+    /// OpenGL fragment shader identifier while compiling.
+    unsigned fragmentShader;
     /// Used vertex attribute bitmask.
     unsigned attributes;
     /// All uniform locations.
@@ -53,4 +76,12 @@ private:
     int presetUniforms[MAX_PRESET_UNIFORMS];
     /// Shader name.
     std::string shaderName;
+    /// Binary cache file name, or empty if not caching.
+    std::string cacheFileName;
+    /// Hash of the final source code for validating the cached binary.
+    unsigned long long sourceHash;
+    /// Batch sorting id.
+    unsigned short sortId;
+    /// Deferred compile pending flag.
+    bool pending;
 };
@@ -9,13 +9,15 @@
 
 static size_t activeTextureUnit = 0xffffffff;
 static unsigned activeTargets[MAX_TEXTURE_UNITS];
-static Texture* boundTextures[MAX_TEXTURE_UNITS];
+static unsigned boundTextures[MAX_TEXTURE_UNITS];
+static unsigned textureGeneration = 0;
 
 static const GLenum glTargets[] = 
 {
     GL_TEXTURE_2D,
     GL_TEXTURE_3D,
-    GL_TEXTURE_CUBE_MAP
+    GL_TEXTURE_CUBE_MAP,
+    GL_TEXTURE_BUFFER
 };
 
 const unsigned Texture::glInternalFormats[] =
@@ -250,6 +252,7 @@ bool Texture::Define(TextureType type_, const IntVector3& size_, ImageFormat for
     type = type_;
 
     glGenTextures(1, &texture);
+    ++textureGeneration;
     if (!texture)
     {
         size = IntVector3::ZERO;
@@ -336,6 +339,45 @@ bool Texture::Define(TextureType type_, const IntVector3& size_, ImageFormat for
     return true;
 }
 
+bool Texture::DefineBuffer(unsigned glBuffer, ImageFormat format_)
+{
+    ZoneScoped;
+
+    Release();
+
+    if (!glBuffer)
+    {
+        LOGERROR("Can not define buffer texture without a buffer");
+        return false;
+    }
+    if (format_ == FMT_NONE || format_ >= FMT_D16)
+    {
+        LOGERROR("Unsupported buffer texture format");
+        return false;
+    }
+
+    glGenTextures(1, &texture);
+    ++textureGeneration;
+    if (!texture)
+    {
+        LOGERROR("Failed to create texture");
+        return false;
+    }
+
+    type = TEX_BUFFER;
+    target = GL_TEXTURE_BUFFER;
+    size = IntVector3::ZERO;
+    format = format_;
+    numLevels = 1;
+    multisample = 1;
+
+    ForceBind();
+    glTexBuffer(GL_TEXTURE_BUFFER, glInternalFormats[format], glBuffer);
+    LOGDEBUGF("Created buffer texture format %d", (int)format);
+
+    return true;
+}
+
 bool Texture::DefineSampler(TextureFilterMode filter_, TextureAddressMode u, TextureAddressMode v, TextureAddressMode w, unsigned maxAnisotropy_, float minLod_, float maxLod_, const Color& borderColor_)
 {
     ZoneScoped;
@@ -488,7 +530,12 @@ bool Texture::SetData(size_t level, const IntBox& box, const ImageLevel& data)
 
 void Texture::Bind(size_t unit)
 {
-    if (unit >= MAX_TEXTURE_UNITS || !texture || boundTextures[unit] == this)
+    Bind(unit, target, texture);
+}
+
+void Texture::Bind(size_t unit, unsigned glTarget, unsigned glTexture)
+{
+    if (unit >= MAX_TEXTURE_UNITS || !glTexture || boundTextures[unit] == glTexture)
         return;
 
     if (activeTextureUnit != unit)
@@ -497,12 +544,12 @@ void Texture::Bind(size_t unit)
         activeTextureUnit = unit;
     }
 
-    if (activeTargets[unit] && activeTargets[unit] != target)
+    if (activeTargets[unit] && activeTargets[unit] != glTarget)
         glBindTexture(activeTargets[unit], 0);
 
-    glBindTexture(target, texture);
-    activeTargets[unit] = target;
-    boundTextures[unit] = this;
+    glBindTexture(glTarget, glTexture);
+    activeTargets[unit] = glTarget;
+    boundTextures[unit] = glTexture;
 }
 
 void Texture::Unbind(size_t unit)
@@ -516,7 +563,7 @@ void Texture::Unbind(size_t unit)
         }
         glBindTexture(activeTargets[unit], 0);
         activeTargets[unit] = 0;
-        boundTextures[unit] = nullptr;
+        boundTextures[unit] = 0;
     }
 }
 
@@ -525,9 +572,21 @@ unsigned Texture::GLTarget() const
     return target;
 }
 
+unsigned Texture::Generation()
+{
+    return textureGeneration;
+}
+
+size_t Texture::MaxBufferTexels()
+{
+    GLint maxTexels = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+    return (size_t)maxTexels;
+}
+
 void Texture::ForceBind()
 {
-    boundTextures[0] = nullptr;
+    boundTextures[0] = 0;
     Bind(0);
 }
 
@@ -535,13 +594,14 @@ void Texture::Release()
 {
     if (texture)
     {
-        glDeleteTextures(1, &texture);
-        texture = 0;
-
         for (size_t i = 0; i < MAX_TEXTURE_UNITS; ++i)
         {
-            if (boundTextures[i] == this)
-                boundTextures[i] = nullptr;
+            if (boundTextures[i] == texture)
+                boundTextures[i] = 0;
         }
+
+        glDeleteTextures(1, &texture);
+        texture = 0;
+        ++textureGeneration;
     }
 }
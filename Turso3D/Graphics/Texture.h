@@ -33,6 +33,8 @@ public:
     bool Define(TextureType type, const IntVector2& size, ImageFormat format, int multisample = 1, size_t numLevels = 1, const ImageLevel* initialData = 0);
     /// Define texture type and dimensions and set initial data. Return true on success.
     bool Define(TextureType type, const IntVector3& size, ImageFormat format, int multisample = 1, size_t numLevels = 1, const ImageLevel* initialData = 0);
+    /// Define as a buffer texture that views the data of an OpenGL buffer object in the specified format. Return true on success.
+    bool DefineBuffer(unsigned glBuffer, ImageFormat format);
     /// Define sampling parameters. Return true on success.
     bool DefineSampler(TextureFilterMode filter = FILTER_ANISOTROPIC, TextureAddressMode u = ADDRESS_WRAP, TextureAddressMode v = ADDRESS_WRAP, TextureAddressMode w = ADDRESS_WRAP, unsigned maxAnisotropy = 16, float minLod = -M_MAX_FLOAT, float maxLod = M_MAX_FLOAT, const Color& borderColor = Color::BLACK);
     /// Set data for a mipmap level. Return true on success.
@@ -80,8 +82,14 @@ public:
     /// Return the OpenGL binding target of the texture.
     unsigned GLTarget() const;
 
+    /// Bind an OpenGL texture object by identifier and binding target to texture unit. No-op if already bound.
+    static void Bind(size_t unit, unsigned glTarget, unsigned glTexture);
     /// Unbind a texture unit.
     static void Unbind(size_t unit);
+    /// Return the texture object generation. Changes whenever an OpenGL texture object is created or released.
+    static unsigned Generation();
+    /// Return the maximum number of texels in a buffer texture.
+    static size_t MaxBufferTexels();
 
     /// OpenGL texture internal formats by image format.
     static const unsigned glInternalFormats[];
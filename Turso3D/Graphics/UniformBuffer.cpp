@@ -8,7 +8,7 @@
 #include <cstring>
 #include <tracy/Tracy.hpp>
 
-static UniformBuffer* boundUniformBuffers[MAX_CONSTANT_BUFFER_SLOTS];
+static unsigned boundUniformBuffers[MAX_CONSTANT_BUFFER_SLOTS];
 
 UniformBuffer::UniformBuffer() :
     buffer(0),
@@ -78,11 +78,16 @@ bool UniformBuffer::SetData(size_t offset, size_t numBytes, const void* data, bo
 
 void UniformBuffer::Bind(size_t index)
 {
-    if (!buffer || boundUniformBuffers[index] == this)
+    Bind(index, buffer, size);
+}
+
+void UniformBuffer::Bind(size_t index, unsigned glBuffer, size_t numBytes)
+{
+    if (!glBuffer || boundUniformBuffers[index] == glBuffer)
         return;
 
-    glBindBufferRange(GL_UNIFORM_BUFFER, (GLuint)index, buffer, 0, size);
-    boundUniformBuffers[index] = this;
+    glBindBufferRange(GL_UNIFORM_BUFFER, (GLuint)index, glBuffer, 0, numBytes);
+    boundUniformBuffers[index] = glBuffer;
 }
 
 void UniformBuffer::Unbind(size_t index)
@@ -90,10 +95,16 @@ void UniformBuffer::Unbind(size_t index)
     if (boundUniformBuffers[index])
     {
         glBindBufferRange(GL_UNIFORM_BUFFER, (GLuint)index, 0, 0, 0);
-        boundUniformBuffers[index] = nullptr;
+        boundUniformBuffers[index] = 0;
     }
 }
 
+void UniformBuffer::BindRange(size_t index, unsigned glBuffer, size_t offset, size_t numBytes)
+{
+    glBindBufferRange(GL_UNIFORM_BUFFER, (GLuint)index, glBuffer, offset, numBytes);
+    boundUniformBuffers[index] = 0;
+}
+
 bool UniformBuffer::Create(const void* data)
 {
     glGenBuffers(1, &buffer);
@@ -114,13 +125,13 @@ void UniformBuffer::Release()
 {
     if (buffer)
     {
-        glDeleteBuffers(1, &buffer);
-        buffer = 0;
-
         for (size_t i = 0; i < MAX_CONSTANT_BUFFER_SLOTS; ++i)
         {
-            if (boundUniformBuffers[i] == this)
-                boundUniformBuffers[i] = nullptr;
+            if (boundUniformBuffers[i] == buffer)
+                boundUniformBuffers[i] = 0;
         }
+
+        glDeleteBuffers(1, &buffer);
+        buffer = 0;
     }
 }
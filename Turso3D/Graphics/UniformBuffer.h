@@ -6,7 +6,7 @@
 #include "../Object/Ptr.h"
 #include "GraphicsDefs.h"
 
-/// GPU buffer for shader program uniform data. Currently used for per-view camera parameters, Forward+ light data, skinning matrices and materials. Not recommended to be used for small rapidly changing data like object's world matrix; bare uniforms will perform better.
+/// GPU buffer for shader program uniform data. Currently used for per-view camera parameters, skinning matrices and materials, and as storage for the Forward+ light data and light index buffer textures. Not recommended to be used for small rapidly changing data like object's world matrix; bare uniforms will perform better.
 class UniformBuffer : public RefCounted
 {
 public:
@@ -32,8 +32,12 @@ public:
     /// Return the OpenGL object identifier.
     unsigned GLBuffer() const { return buffer; }
 
+    /// Bind a whole OpenGL buffer object by identifier and size to a slot. No-op if already bound.
+    static void Bind(size_t index, unsigned glBuffer, size_t numBytes);
     /// Unbind a slot.
     static void Unbind(size_t index);
+    /// Bind a range of an external OpenGL buffer object, such as a ring buffer, to a slot.
+    static void BindRange(size_t index, unsigned glBuffer, size_t offset, size_t numBytes);
 
 private:
     /// Create the GPU-side index buffer. Return true on success.
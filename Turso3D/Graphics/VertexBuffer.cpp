@@ -11,6 +11,8 @@
 static unsigned boundAttributes = 0;
 static VertexBuffer* boundVertexBuffer = nullptr;
 static VertexBuffer* boundVertexAttribSource = nullptr;
+static unsigned defaultVertexArray = 0;
+static unsigned boundVertexArray = 0;
 
 static const unsigned baseAttributeIndex[] = 
 {
@@ -137,6 +139,10 @@ void VertexBuffer::Bind(unsigned attributeMask)
         return;
     }
 
+    // The attribute state is tracked for the default vertex array object only
+    if (boundVertexArray)
+        BindVertexArray(0);
+
     // Do not attempt to bind elements the current vertex buffer doesn't have
     attributeMask &= attributes;
 
@@ -186,6 +192,54 @@ void VertexBuffer::Bind(unsigned attributeMask)
     boundVertexAttribSource = this;
 }
 
+void VertexBuffer::SetupVertexArray(unsigned attributeMask)
+{
+    if (!buffer || !boundVertexArray)
+        return;
+
+    Bind(0);
+
+    for (size_t i = 0; i < elements.size(); ++i)
+    {
+        const VertexElement& element = elements[i];
+
+        unsigned attributeIdx = baseAttributeIndex[element.semantic] + element.index;
+        if (!(attributeMask & (1 << attributeIdx)))
+            continue;
+
+        glEnableVertexAttribArray(attributeIdx);
+        glVertexAttribPointer(attributeIdx, elementGLSizes[element.type], elementGLTypes[element.type], element.semantic == SEM_COLOR ? GL_TRUE : GL_FALSE,
+            (GLsizei)vertexSize, reinterpret_cast<void*>(element.offset));
+    }
+}
+
+void VertexBuffer::BindVertexArray(unsigned vertexArray)
+{
+    if (vertexArray == boundVertexArray)
+        return;
+
+    glBindVertexArray(vertexArray ? vertexArray : defaultVertexArray);
+    boundVertexArray = vertexArray;
+}
+
+void VertexBuffer::SetDefaultVertexArray(unsigned vertexArray)
+{
+    defaultVertexArray = vertexArray;
+    boundVertexArray = 0;
+}
+
+unsigned VertexBuffer::BoundVertexArray()
+{
+    return boundVertexArray;
+}
+
+void VertexBuffer::BindExternal(unsigned glBuffer)
+{
+    // External buffers may be recreated with the same identifier, so always bind
+    glBindBuffer(GL_ARRAY_BUFFER, glBuffer);
+    boundVertexBuffer = nullptr;
+}
+
 unsigned VertexBuffer::CalculateAttributeMask(const std::vector<VertexElement>& elements)
 {
     unsigned attributes = 0;
@@ -229,6 +283,7 @@ void VertexBuffer::Release()
 {
     if (buffer)
     {
+        Object::Subsystem<Graphics>()->ReleaseVertexArrays(buffer);
         glDeleteBuffers(1, &buffer);
         buffer = 0;
 
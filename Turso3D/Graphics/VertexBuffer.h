@@ -21,8 +21,10 @@ public:
     bool Define(ResourceUsage usage, size_t numVertices, const std::vector<VertexElement>& elements, const void* data = nullptr);
     /// Redefine buffer data either completely or partially. Return true on success.
     bool SetData(size_t firstVertex, size_t numVertices, const void* data, bool discard = false);
-    /// Bind to use with the specified vertex attributes. No-op if already bound. Used also when defining or setting data.
+    /// Bind to use with the specified vertex attributes. No-op if already bound. Used also when defining or setting data. Returns to the default vertex array object if a cached one is bound.
     void Bind(unsigned attributeMask);
+    /// Set up the specified vertex attributes on the currently bound cached vertex array object.
+    void SetupVertexArray(unsigned attributeMask);
 
     /// Return number of vertices.
     size_t NumVertices() const { return numVertices; }
@@ -42,6 +44,14 @@ public:
     /// Return the OpenGL object identifier.
     unsigned GLBuffer() const { return buffer; }
 
+    /// Bind an external OpenGL buffer object, such as a ring buffer, as the array buffer for setting up vertex attributes manually.
+    static void BindExternal(unsigned glBuffer);
+    /// Bind a cached vertex array object, or zero to return to the default vertex array object on which vertex and index buffers are bound individually.
+    static void BindVertexArray(unsigned vertexArray);
+    /// Set the default vertex array object. Called by Graphics on initialization.
+    static void SetDefaultVertexArray(unsigned vertexArray);
+    /// Return the bound cached vertex array object, or zero if the default vertex array object is in use.
+    static unsigned BoundVertexArray();
     /// Calculate a vertex attribute mask from elements.
     static unsigned CalculateAttributeMask(const std::vector<VertexElement>& elements);
     /// Return size of vertex element.
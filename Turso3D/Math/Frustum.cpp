@@ -2,6 +2,11 @@
 
 #include "Frustum.h"
 
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_SSE
+#endif
+
 inline Vector3 ClipEdgeZ(const Vector3& v0, const Vector3& v1, float clipZ)
 {
     return Vector3(
@@ -184,6 +189,101 @@ Frustum Frustum::Transformed(const Matrix3x4& transform) const
     return transformed;
 }
 
+void Frustum::IsInsideMaskedFast(const float* minX, const float* minY, const float* minZ, const float* maxX, const float* maxY, const float* maxZ, size_t numGroups, unsigned char* groupMasks, unsigned char planeMask) const
+{
+    // Gather the planes to test, so that the inner loop does not need to check the mask
+    const Plane* testPlanes[NUM_FRUSTUM_PLANES];
+    size_t numTestPlanes = 0;
+
+    for (size_t i = 0; i < NUM_FRUSTUM_PLANES; ++i)
+    {
+        if (planeMask & (1 << i))
+            testPlanes[numTestPlanes++] = &planes[i];
+    }
+
+#ifdef USE_SSE
+    __m128 normalX[NUM_FRUSTUM_PLANES], normalY[NUM_FRUSTUM_PLANES], normalZ[NUM_FRUSTUM_PLANES];
+    __m128 absNormalX[NUM_FRUSTUM_PLANES], absNormalY[NUM_FRUSTUM_PLANES], absNormalZ[NUM_FRUSTUM_PLANES];
+    __m128 planeD[NUM_FRUSTUM_PLANES];
+
+    for (size_t i = 0; i < numTestPlanes; ++i)
+    {
+        const Plane& plane = *testPlanes[i];
+        normalX[i] = _mm_set1_ps(plane.normal.x);
+        normalY[i] = _mm_set1_ps(plane.normal.y);
+        normalZ[i] = _mm_set1_ps(plane.normal.z);
+        absNormalX[i] = _mm_set1_ps(plane.absNormal.x);
+        absNormalY[i] = _mm_set1_ps(plane.absNormal.y);
+        absNormalZ[i] = _mm_set1_ps(plane.absNormal.z);
+        planeD[i] = _mm_set1_ps(plane.d);
+    }
+
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 zero = _mm_setzero_ps();
+
+    for (size_t g = 0; g < numGroups; ++g)
+    {
+        size_t offset = g * 4;
+        __m128 bMinX = _mm_loadu_ps(minX + offset);
+        __m128 bMinY = _mm_loadu_ps(minY + offset);
+        __m128 bMinZ = _mm_loadu_ps(minZ + offset);
+        __m128 bMaxX = _mm_loadu_ps(maxX + offset);
+        __m128 bMaxY = _mm_loadu_ps(maxY + offset);
+        __m128 bMaxZ = _mm_loadu_ps(maxZ + offset);
+
+        __m128 centerX = _mm_mul_ps(_mm_add_ps(bMinX, bMaxX), half);
+        __m128 centerY = _mm_mul_ps(_mm_add_ps(bMinY, bMaxY), half);
+        __m128 centerZ = _mm_mul_ps(_mm_add_ps(bMinZ, bMaxZ), half);
+        __m128 edgeX = _mm_sub_ps(bMaxX, centerX);
+        __m128 edgeY = _mm_sub_ps(bMaxY, centerY);
+        __m128 edgeZ = _mm_sub_ps(bMaxZ, centerZ);
+
+        __m128 outside = zero;
+
+        for (size_t i = 0; i < numTestPlanes; ++i)
+        {
+            // Box is outside the plane if center distance + projected half extent is negative
+            __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(normalX[i], centerX), _mm_mul_ps(normalY[i], centerY)), _mm_add_ps(_mm_mul_ps(normalZ[i], centerZ), planeD[i]));
+            __m128 absDist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absNormalX[i], edgeX), _mm_mul_ps(absNormalY[i], edgeY)), _mm_mul_ps(absNormalZ[i], edgeZ));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(dist, absDist), zero));
+
+            if (_mm_movemask_ps(outside) == 0xf)
+                break;
+        }
+
+        groupMasks[g] = (unsigned char)(~_mm_movemask_ps(outside) & 0xf);
+    }
+#else
+    for (size_t g = 0; g < numGroups; ++g)
+    {
+        unsigned char mask = 0;
+
+        for (size_t j = 0; j < 4; ++j)
+        {
+            size_t index = g * 4 + j;
+            Vector3 center((minX[index] + maxX[index]) * 0.5f, (minY[index] + maxY[index]) * 0.5f, (minZ[index] + maxZ[index]) * 0.5f);
+            Vector3 edge(maxX[index] - center.x, maxY[index] - center.y, maxZ[index] - center.z);
+            bool inside = true;
+
+            for (size_t i = 0; i < numTestPlanes; ++i)
+            {
+                const Plane& plane = *testPlanes[i];
+                if (plane.normal.DotProduct(center) + plane.d < -plane.absNormal.DotProduct(edge))
+                {
+                    inside = false;
+                    break;
+                }
+            }
+
+            if (inside)
+                mask |= 1 << j;
+        }
+
+        groupMasks[g] = mask;
+    }
+#endif
+}
+
 Rect Frustum::Projected(const Matrix4& projection) const
 {
     Rect rect;
@@ -177,6 +177,9 @@ public:
         return INSIDE;
     }
     
+    /// Test bounding boxes stored as structure-of-arrays against the planes in the mask, 4 at a time. Write for each group of 4 a bitmask of the boxes that are (partially) inside. The arrays must be readable up to numGroups * 4 elements.
+    void IsInsideMaskedFast(const float* minX, const float* minY, const float* minZ, const float* maxX, const float* maxY, const float* maxZ, size_t numGroups, unsigned char* groupMasks, unsigned char planeMask = 0x3f) const;
+
     /// Test if a bounding box is (partially) inside or outside.
     Intersection IsInsideFast(const BoundingBox& box) const
     {
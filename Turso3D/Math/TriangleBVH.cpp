@@ -0,0 +1,395 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "Ray.h"
+#include "TriangleBVH.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <tracy/Tracy.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_SSE
+#endif
+
+static const unsigned BVH_LEAF_BIT = 0x80000000;
+static const unsigned BVH_LEAF_COUNT_SHIFT = 24;
+static const unsigned BVH_LEAF_START_MASK = 0xffffff;
+static const size_t BVH_MAX_LEAF_TRIANGLES = 4;
+static const size_t BVH_NUM_BINS = 12;
+static const size_t BVH_MAX_DEPTH = 64;
+// Depth from which nodes are split at the median. Halving the triangle count on each level keeps the tree within the maximum depth for up to 2^24 triangles, the limit of the leaf start index.
+static const size_t BVH_MEDIAN_SPLIT_DEPTH = BVH_MAX_DEPTH - 24;
+static const size_t BVH_STACK_SIZE = BVH_MAX_DEPTH * 2;
+static const float BVH_QUANTIZE_MAX = 65535.0f;
+static const float BVH_MAX_INV_DIRECTION = 1.0e30f;
+
+/// Per-triangle data used during %TriangleBVH build.
+struct TriangleBVHBuildData
+{
+    /// Triangle bounding box.
+    BoundingBox box;
+    /// Triangle bounding box center.
+    Vector3 center;
+    /// Triangle index.
+    unsigned index;
+};
+
+/// Return surface area heuristic cost factor of a bounding box.
+static inline float SurfaceArea(const BoundingBox& box)
+{
+    Vector3 size = box.Size();
+    return size.x * size.y + size.y * size.z + size.z * size.x;
+}
+
+/// Return a component of a vector by axis index.
+static inline float Component(const Vector3& vec, size_t axis)
+{
+    return axis == 0 ? vec.x : (axis == 1 ? vec.y : vec.z);
+}
+
+/// Return reciprocal of a ray direction component, clamped so that slab tests never produce NaNs.
+static inline float InverseDirection(float value)
+{
+    if (value == 0.0f)
+        return BVH_MAX_INV_DIRECTION;
+    float inv = 1.0f / value;
+    return Clamp(inv, -BVH_MAX_INV_DIRECTION, BVH_MAX_INV_DIRECTION);
+}
+
+TriangleBVH::TriangleBVH() :
+    scale(Vector3::ZERO),
+    root(BVH_LEAF_BIT),
+    positions(nullptr),
+    indexData(nullptr),
+    indexSize(0),
+    drawStart(0)
+{
+}
+
+TriangleBVH::~TriangleBVH()
+{
+}
+
+bool TriangleBVH::Define(const Vector3* positions_, const void* indexData_, size_t indexSize_, size_t drawStart_, size_t drawCount)
+{
+    ZoneScoped;
+
+    nodes.clear();
+    triangles.clear();
+    boundingBox.Undefine();
+    root = BVH_LEAF_BIT;
+
+    size_t numTriangles = drawCount / 3;
+    if (!positions_ || !numTriangles || numTriangles > BVH_LEAF_START_MASK)
+        return false;
+
+    positions = positions_;
+    indexData = indexData_;
+    indexSize = indexSize_;
+    drawStart = drawStart_;
+
+    std::vector<TriangleBVHBuildData> buildData(numTriangles);
+    for (size_t i = 0; i < numTriangles; ++i)
+    {
+        Vector3 v0, v1, v2;
+        GetTriangle((unsigned)i, v0, v1, v2);
+
+        TriangleBVHBuildData& data = buildData[i];
+        data.box.Define(v0);
+        data.box.Merge(v1);
+        data.box.Merge(v2);
+        data.center = data.box.Center();
+        data.index = (unsigned)i;
+        boundingBox.Merge(data.box);
+    }
+
+    Vector3 size = boundingBox.Size();
+    scale = size / BVH_QUANTIZE_MAX;
+
+    nodes.reserve(numTriangles * 2 / BVH_MAX_LEAF_TRIANGLES + 1);
+    triangles.reserve(numTriangles);
+    root = BuildNode(buildData, 0, numTriangles, 0);
+
+    return true;
+}
+
+float TriangleBVH::HitDistance(const Ray& ray, Vector3* outNormal) const
+{
+    if (triangles.empty() || ray.HitDistance(boundingBox) == M_INFINITY)
+        return M_INFINITY;
+
+    // Slab distances are evaluated as quantized value * a + b
+    Vector3 invDir(InverseDirection(ray.direction.x), InverseDirection(ray.direction.y), InverseDirection(ray.direction.z));
+    Vector3 a(scale.x * invDir.x, scale.y * invDir.y, scale.z * invDir.z);
+    Vector3 b((boundingBox.min.x - ray.origin.x) * invDir.x, (boundingBox.min.y - ray.origin.y) * invDir.y, (boundingBox.min.z - ray.origin.z) * invDir.z);
+
+    float closest = M_INFINITY;
+    Vector3 closestNormal = Vector3::ZERO;
+
+    unsigned stack[BVH_STACK_SIZE];
+    size_t stackSize = 0;
+    stack[stackSize++] = root;
+
+#ifdef USE_SSE
+    __m128i zeroInt = _mm_setzero_si128();
+    __m128 zero = _mm_setzero_ps();
+    __m128 ax = _mm_set1_ps(a.x);
+    __m128 ay = _mm_set1_ps(a.y);
+    __m128 az = _mm_set1_ps(a.z);
+    __m128 bx = _mm_set1_ps(b.x);
+    __m128 by = _mm_set1_ps(b.y);
+    __m128 bz = _mm_set1_ps(b.z);
+#endif
+
+    while (stackSize)
+    {
+        unsigned ref = stack[--stackSize];
+
+        if (ref & BVH_LEAF_BIT)
+        {
+            unsigned start = ref & BVH_LEAF_START_MASK;
+            unsigned count = ((ref & ~BVH_LEAF_BIT) >> BVH_LEAF_COUNT_SHIFT) + 1;
+
+            for (unsigned i = start; i < start + count; ++i)
+            {
+                Vector3 v0, v1, v2;
+                Vector3 normal = Vector3::ZERO;
+                GetTriangle(triangles[i], v0, v1, v2);
+                float distance = ray.HitDistance(v0, v1, v2, outNormal ? &normal : nullptr);
+                if (distance < closest)
+                {
+                    closest = distance;
+                    closestNormal = normal;
+                }
+            }
+            continue;
+        }
+
+        const TriangleBVHNode& node = nodes[ref];
+        float nearDistances[4];
+        unsigned mask;
+
+#ifdef USE_SSE
+        int packed[6];
+        memcpy(packed, &node, sizeof packed);
+
+        __m128 t1 = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_cvtsi32_si128(packed[0]), zeroInt)), ax), bx);
+        __m128 t2 = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_cvtsi32_si128(packed[3]), zeroInt)), ax), bx);
+        __m128 tNear = _mm_min_ps(t1, t2);
+        __m128 tFar = _mm_max_ps(t1, t2);
+
+        t1 = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_cvtsi32_si128(packed[1]), zeroInt)), ay), by);
+        t2 = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_cvtsi32_si128(packed[4]), zeroInt)), ay), by);
+        tNear = _mm_max_ps(tNear, _mm_min_ps(t1, t2));
+        tFar = _mm_min_ps(tFar, _mm_max_ps(t1, t2));
+
+        t1 = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_cvtsi32_si128(packed[2]), zeroInt)), az), bz);
+        t2 = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_cvtsi32_si128(packed[5]), zeroInt)), az), bz);
+        tNear = _mm_max_ps(tNear, _mm_min_ps(t1, t2));
+        tFar = _mm_min_ps(tFar, _mm_max_ps(t1, t2));
+
+        tNear = _mm_max_ps(tNear, zero);
+        __m128 hit = _mm_and_ps(_mm_cmple_ps(tNear, tFar), _mm_cmplt_ps(tNear, _mm_set1_ps(closest)));
+        mask = (unsigned)_mm_movemask_ps(hit) & 3;
+        _mm_storeu_ps(nearDistances, tNear);
+#else
+        mask = 0;
+
+        for (size_t i = 0; i < 2; ++i)
+        {
+            float t1 = node.minX[i] * a.x + b.x;
+            float t2 = node.maxX[i] * a.x + b.x;
+            float tNear = Min(t1, t2);
+            float tFar = Max(t1, t2);
+
+            t1 = node.minY[i] * a.y + b.y;
+            t2 = node.maxY[i] * a.y + b.y;
+            tNear = Max(tNear, Min(t1, t2));
+            tFar = Min(tFar, Max(t1, t2));
+
+            t1 = node.minZ[i] * a.z + b.z;
+            t2 = node.maxZ[i] * a.z + b.z;
+            tNear = Max(tNear, Min(t1, t2));
+            tFar = Min(tFar, Max(t1, t2));
+
+            tNear = Max(tNear, 0.0f);
+            nearDistances[i] = tNear;
+            if (tNear <= tFar && tNear < closest)
+                mask |= 1 << i;
+        }
+#endif
+
+        // Push the farther child first so that the nearer is visited first
+        assert(stackSize + 2 <= BVH_STACK_SIZE);
+        if (mask == 3)
+        {
+            bool firstNearer = nearDistances[0] <= nearDistances[1];
+            stack[stackSize++] = node.children[firstNearer ? 1 : 0];
+            stack[stackSize++] = node.children[firstNearer ? 0 : 1];
+        }
+        else if (mask)
+            stack[stackSize++] = node.children[mask == 1 ? 0 : 1];
+    }
+
+    if (outNormal && closest < M_INFINITY)
+        *outNormal = closestNormal;
+    return closest;
+}
+
+void TriangleBVH::GetTriangle(unsigned index, Vector3& v0, Vector3& v1, Vector3& v2) const
+{
+    size_t start = drawStart + index * 3;
+
+    if (!indexData)
+    {
+        v0 = positions[start];
+        v1 = positions[start + 1];
+        v2 = positions[start + 2];
+    }
+    else if (indexSize == sizeof(unsigned short))
+    {
+        const unsigned short* indices = static_cast<const unsigned short*>(indexData) + start;
+        v0 = positions[indices[0]];
+        v1 = positions[indices[1]];
+        v2 = positions[indices[2]];
+    }
+    else
+    {
+        const unsigned* indices = static_cast<const unsigned*>(indexData) + start;
+        v0 = positions[indices[0]];
+        v1 = positions[indices[1]];
+        v2 = positions[indices[2]];
+    }
+}
+
+unsigned TriangleBVH::BuildNode(std::vector<TriangleBVHBuildData>& buildData, size_t begin, size_t end, size_t depth)
+{
+    size_t count = end - begin;
+    assert(depth < BVH_MAX_DEPTH);
+
+    if (count <= BVH_MAX_LEAF_TRIANGLES)
+    {
+        unsigned start = (unsigned)triangles.size();
+        for (size_t i = begin; i < end; ++i)
+            triangles.push_back(buildData[i].index);
+        return BVH_LEAF_BIT | ((unsigned)(count - 1) << BVH_LEAF_COUNT_SHIFT) | start;
+    }
+
+    // Split along the longest axis of the triangle centers using binned surface area heuristic
+    BoundingBox centerBox;
+    for (size_t i = begin; i < end; ++i)
+        centerBox.Merge(buildData[i].center);
+
+    Vector3 centerSize = centerBox.Size();
+    size_t axis = 0;
+    if (centerSize.y > centerSize.x)
+        axis = 1;
+    if (centerSize.z > Component(centerSize, axis))
+        axis = 2;
+
+    float axisMin = Component(centerBox.min, axis);
+    float axisSize = Component(centerSize, axis);
+    size_t mid = begin + count / 2;
+
+    if (axisSize > 0.0f)
+    {
+        float binScale = (float)BVH_NUM_BINS / axisSize;
+        size_t bestSplit = 0;
+
+        // Near the depth limit skip the surface area heuristic and fall back to the median split below
+        if (depth < BVH_MEDIAN_SPLIT_DEPTH)
+        {
+            BoundingBox binBoxes[BVH_NUM_BINS];
+            size_t binCounts[BVH_NUM_BINS] = { 0 };
+
+            for (size_t i = begin; i < end; ++i)
+            {
+                size_t bin = Min((size_t)((Component(buildData[i].center, axis) - axisMin) * binScale), BVH_NUM_BINS - 1);
+                binBoxes[bin].Merge(buildData[i].box);
+                ++binCounts[bin];
+            }
+
+            // Evaluate the split planes between bins by sweeping from both sides
+            float rightCosts[BVH_NUM_BINS];
+            BoundingBox rightBox;
+            size_t rightCount = 0;
+            for (size_t i = BVH_NUM_BINS - 1; i > 0; --i)
+            {
+                rightBox.Merge(binBoxes[i]);
+                rightCount += binCounts[i];
+                rightCosts[i] = rightCount ? SurfaceArea(rightBox) * rightCount : 0.0f;
+            }
+
+            BoundingBox leftBox;
+            size_t leftCount = 0;
+            float bestCost = M_INFINITY;
+            for (size_t i = 0; i < BVH_NUM_BINS - 1; ++i)
+            {
+                leftBox.Merge(binBoxes[i]);
+                leftCount += binCounts[i];
+                if (!leftCount || leftCount == count)
+                    continue;
+
+                float cost = SurfaceArea(leftBox) * leftCount + rightCosts[i + 1];
+                if (cost < bestCost)
+                {
+                    bestCost = cost;
+                    bestSplit = i + 1;
+                }
+            }
+        }
+
+        if (bestSplit)
+        {
+            TriangleBVHBuildData* splitPtr = std::partition(&buildData[begin], &buildData[0] + end, [=](const TriangleBVHBuildData& data)
+            {
+                return Min((size_t)((Component(data.center, axis) - axisMin) * binScale), BVH_NUM_BINS - 1) < bestSplit;
+            });
+            mid = splitPtr - &buildData[0];
+        }
+        else
+        {
+            std::nth_element(&buildData[begin], &buildData[mid], &buildData[0] + end, [=](const TriangleBVHBuildData& lhs, const TriangleBVHBuildData& rhs)
+            {
+                return Component(lhs.center, axis) < Component(rhs.center, axis);
+            });
+        }
+    }
+
+    BoundingBox childBoxes[2];
+    for (size_t i = begin; i < mid; ++i)
+        childBoxes[0].Merge(buildData[i].box);
+    for (size_t i = mid; i < end; ++i)
+        childBoxes[1].Merge(buildData[i].box);
+
+    // Reserve the node before recursing, and refer to it by index as the vector may reallocate
+    unsigned nodeIndex = (unsigned)nodes.size();
+    nodes.push_back(TriangleBVHNode());
+    unsigned leftRef = BuildNode(buildData, begin, mid, depth + 1);
+    unsigned rightRef = BuildNode(buildData, mid, end, depth + 1);
+
+    TriangleBVHNode& node = nodes[nodeIndex];
+    SetChildBounds(node, 0, childBoxes[0]);
+    SetChildBounds(node, 1, childBoxes[1]);
+    node.children[0] = leftRef;
+    node.children[1] = rightRef;
+
+    return nodeIndex;
+}
+
+void TriangleBVH::SetChildBounds(TriangleBVHNode& node, size_t childIndex, const BoundingBox& box) const
+{
+    // Round outward so that the quantized bounds are conservative
+    Vector3 invScale(scale.x > 0.0f ? 1.0f / scale.x : 0.0f, scale.y > 0.0f ? 1.0f / scale.y : 0.0f, scale.z > 0.0f ? 1.0f / scale.z : 0.0f);
+    Vector3 minOffset = box.min - boundingBox.min;
+    Vector3 maxOffset = box.max - boundingBox.min;
+
+    node.minX[childIndex] = (unsigned short)Clamp(floorf(minOffset.x * invScale.x), 0.0f, BVH_QUANTIZE_MAX);
+    node.minY[childIndex] = (unsigned short)Clamp(floorf(minOffset.y * invScale.y), 0.0f, BVH_QUANTIZE_MAX);
+    node.minZ[childIndex] = (unsigned short)Clamp(floorf(minOffset.z * invScale.z), 0.0f, BVH_QUANTIZE_MAX);
+    node.maxX[childIndex] = (unsigned short)Clamp(ceilf(maxOffset.x * invScale.x), 0.0f, BVH_QUANTIZE_MAX);
+    node.maxY[childIndex] = (unsigned short)Clamp(ceilf(maxOffset.y * invScale.y), 0.0f, BVH_QUANTIZE_MAX);
+    node.maxZ[childIndex] = (unsigned short)Clamp(ceilf(maxOffset.z * invScale.z), 0.0f, BVH_QUANTIZE_MAX);
+}
@@ -0,0 +1,83 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "BoundingBox.h"
+
+#include <vector>
+
+class Ray;
+struct TriangleBVHBuildData;
+
+/// %TriangleBVH node, which stores the bounds of its two children quantized to 16 bits within the whole hierarchy's bounding box. Takes 32 bytes.
+struct TriangleBVHNode
+{
+    /// Children's bounding box minimum X coordinates.
+    unsigned short minX[2];
+    /// Children's bounding box minimum Y coordinates.
+    unsigned short minY[2];
+    /// Children's bounding box minimum Z coordinates.
+    unsigned short minZ[2];
+    /// Children's bounding box maximum X coordinates.
+    unsigned short maxX[2];
+    /// Children's bounding box maximum Y coordinates.
+    unsigned short maxY[2];
+    /// Children's bounding box maximum Z coordinates.
+    unsigned short maxZ[2];
+    /// Child references. Either a node index, or a leaf triangle range when the high bit is set.
+    unsigned children[2];
+};
+
+/// Bounding volume hierarchy of a triangle mesh for accelerated ray hit tests. Refers to the vertex and index data, but does not own it.
+class TriangleBVH
+{
+public:
+    /// Construct undefined.
+    TriangleBVH();
+    /// Destruct.
+    ~TriangleBVH();
+
+    /// Build from triangle data. Index data can be null for non-indexed triangles. The data must remain valid while in use. Return true on success.
+    bool Define(const Vector3* positions, const void* indexData, size_t indexSize, size_t drawStart, size_t drawCount);
+    /// Return ray hit distance to the closest front-facing triangle, or infinity if no hit. Optionally output the unnormalized triangle normal.
+    float HitDistance(const Ray& ray, Vector3* outNormal = nullptr) const;
+
+    /// Return number of nodes.
+    size_t NumNodes() const { return nodes.size(); }
+    /// Return number of triangles.
+    size_t NumTriangles() const { return triangles.size(); }
+    /// Return bounding box of all triangles.
+    const BoundingBox& GetBoundingBox() const { return boundingBox; }
+
+private:
+    /// Prevent copy construction.
+    TriangleBVH(const TriangleBVH& rhs);
+    /// Prevent assignment.
+    TriangleBVH& operator = (const TriangleBVH& rhs);
+
+    /// Return triangle vertices by triangle index.
+    void GetTriangle(unsigned index, Vector3& v0, Vector3& v1, Vector3& v2) const;
+    /// Build a subtree for a range of the triangle build data at the specified depth and return the child reference.
+    unsigned BuildNode(std::vector<TriangleBVHBuildData>& buildData, size_t begin, size_t end, size_t depth);
+    /// Store a child's bounds quantized into a node.
+    void SetChildBounds(TriangleBVHNode& node, size_t childIndex, const BoundingBox& box) const;
+
+    /// Nodes.
+    std::vector<TriangleBVHNode> nodes;
+    /// Triangle indices in leaf order.
+    std::vector<unsigned> triangles;
+    /// Bounding box of all triangles.
+    BoundingBox boundingBox;
+    /// Quantization scale from 16-bit values to the bounding box.
+    Vector3 scale;
+    /// Root reference.
+    unsigned root;
+    /// Vertex positions.
+    const Vector3* positions;
+    /// Index data, or null if not indexed.
+    const void* indexData;
+    /// Index size.
+    size_t indexSize;
+    /// Draw range start.
+    size_t drawStart;
+};
@@ -1,6 +1,7 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
-#include "../Graphics/GraphicsDefs.h"
+#include "../Graphics/GpuRingBuffer.h"
+#include "../Graphics/Graphics.h"
 #include "../Graphics/UniformBuffer.h"
 #include "../IO/Log.h"
 #include "../Math/Ray.h"
@@ -13,6 +14,7 @@
 #include "Octree.h"
 
 #include <algorithm>
+#include <cstring>
 #include <tracy/Tracy.hpp>
 
 static Allocator<AnimatedModelDrawable> drawableAllocator;
@@ -76,7 +78,9 @@ AnimatedModelDrawable::AnimatedModelDrawable() :
     animatedModelFlags(0),
     numBones(0),
     octree(nullptr),
-    rootBone(nullptr)
+    rootBone(nullptr),
+    skinDataOffset(0),
+    skinDataFrame(M_MAX_UNSIGNED)
 {
     SetFlag(DF_SKINNED_GEOMETRY | DF_OCTREE_UPDATE_CALL, true);
 }
@@ -139,12 +143,45 @@ bool AnimatedModelDrawable::OnPrepareRender(unsigned short frameNumber, Camera*
 
 void AnimatedModelDrawable::OnRender(ShaderProgram*, size_t)
 {
-    if (!skinMatrixBuffer || !numBones)
+    if (!numBones)
         return;
 
+    size_t numBytes = numBones * sizeof(Matrix3x4);
+
+    // Copy the skin matrices to the frame data ring buffer once per frame, which avoids a synchronous buffer update per model.
+    // This is done at first render instead of preparation, as shadowcasters outside the view may be prepared from several threads
+    GpuRingBuffer* ringBuffer = Object::Subsystem<Graphics>()->FrameDataBuffer();
+    if (ringBuffer)
+    {
+        if (skinDataFrame != ringBuffer->FrameIndex())
+        {
+            unsigned char* dest = ringBuffer->Allocate(numBytes, skinDataOffset);
+            if (dest)
+            {
+                memcpy(dest, skinMatrices.Get(), numBytes);
+                ringBuffer->Flush();
+                skinDataFrame = ringBuffer->FrameIndex();
+            }
+        }
+
+        if (skinDataFrame == ringBuffer->FrameIndex())
+        {
+            ringBuffer->BindUniformRange(UB_OBJECTDATA, skinDataOffset, numBytes);
+            return;
+        }
+    }
+
+    // Create an own uniform buffer only when the ring buffer is full
+    if (!skinMatrixBuffer)
+    {
+        skinMatrixBuffer = new UniformBuffer();
+        skinMatrixBuffer->Define(USAGE_DYNAMIC, numBytes);
+        animatedModelFlags |= AMF_SKINNING_BUFFER_DIRTY;
+    }
+
     if (animatedModelFlags & AMF_SKINNING_BUFFER_DIRTY)
     {
-        skinMatrixBuffer->SetData(0, numBones * sizeof(Matrix3x4), skinMatrices);
+        skinMatrixBuffer->SetData(0, numBytes, skinMatrices);
         animatedModelFlags &= ~AMF_SKINNING_BUFFER_DIRTY;
     }
 
@@ -212,7 +249,6 @@ void AnimatedModelDrawable::CreateBones()
 
     if (!model)
     {
-        skinMatrixBuffer.Reset();
         RemoveBones();
         return;
     }
@@ -260,9 +296,8 @@ void AnimatedModelDrawable::CreateBones()
     for (size_t i = 0; i < modelBones.size(); ++i)
         bones[i]->CountChildBones();
 
-    if (!skinMatrixBuffer)
-        skinMatrixBuffer = new UniformBuffer();
-    skinMatrixBuffer->Define(USAGE_DYNAMIC, numBones * sizeof(Matrix3x4));
+    // The skinning uniform buffer is normally not needed, as the matrices are written to the frame data ring buffer
+    skinMatrixBuffer.Reset();
 
     // Set initial bone bounding box recalculation and skinning dirty. Also calculate a valid bone bounding box immediately to ensure models can enter the view without updating animation first
     OnBoneTransformChanged();
@@ -137,6 +137,8 @@ public:
     size_t NumBones() const { return numBones; }
     /// Return all bone scene nodes.
     const AutoArrayPtr<Bone*>& Bones() const { return bones; }
+    /// Return skinning matrices.
+    const Matrix3x4* SkinMatrices() const { return skinMatrices.Get(); }
     /// Return all animation states.
     const std::vector<SharedPtr<AnimationState> >& AnimationStates() const { return animationStates; }
     /// Return the internal dirty status flags.
@@ -157,8 +159,12 @@ protected:
     AutoArrayPtr<Bone*> bones;
     /// Skinning matrices.
     AutoArrayPtr<Matrix3x4> skinMatrices;
-    /// Skinning uniform buffer.
+    /// Skinning uniform buffer. Created only if the skin matrices can not be written to the frame data ring buffer.
     AutoPtr<UniformBuffer> skinMatrixBuffer;
+    /// Byte offset of the skin matrices in the frame data ring buffer.
+    size_t skinDataOffset;
+    /// Ring buffer frame index on which the skin matrices were last written.
+    unsigned skinDataFrame;
     /// Animation states.
     std::vector<SharedPtr<AnimationState> > animationStates;
 };
@@ -1,61 +1,250 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
+#include "../Graphics/IndexBuffer.h"
 #include "Batch.h"
 #include "GeometryNode.h"
 #include "Material.h"
 
 #include <algorithm>
+#include <cstring>
 #include <tracy/Tracy.hpp>
 
-inline bool CompareBatchKeys(const Batch& lhs, const Batch& rhs)
+// Below this amount of keys, a comparison sort is faster than the radix sort passes
+static const size_t RADIX_SORT_THRESHOLD = 64;
+static const size_t RADIX_SORT_BITS = 8;
+static const size_t RADIX_SORT_BUCKETS = 1 << RADIX_SORT_BITS;
+static const size_t RADIX_SORT_PASSES = 64 / RADIX_SORT_BITS;
+// Renderer stores the nearest distance of each pass quantized to 15 bits, of which the highest 4 form the depth layer
+static const unsigned SORT_LAYER_SHIFT = 11;
+static const int SORT_MAX_LAYER = 15;
+static const float SORT_MAX_DEPTH = 4095.0f;
+
+inline bool CompareBatchSortKeys(const BatchSortKey& lhs, const BatchSortKey& rhs)
 {
-    return lhs.sortKey < rhs.sortKey;
+    return lhs.key < rhs.key || (lhs.key == rhs.key && lhs.index < rhs.index);
 }
 
-inline bool CompareBatchDistance(const Batch& lhs, const Batch& rhs)
+/// Convert a float to an unsigned integer that sorts in the same order.
+inline unsigned FloatToSortableKey(float value)
 {
-    return lhs.distance > rhs.distance;
+    unsigned bits;
+    memcpy(&bits, &value, sizeof bits);
+    return (bits & 0x80000000) ? ~bits : bits | 0x80000000;
 }
 
-void BatchQueue::Clear()
+/// Combine a state sort key from 4 bits of depth layer, 16 bits each of shader program, material and geometry ids, and 12 bits of depth.
+inline unsigned long long StateSortKey(unsigned layer, unsigned short programId, unsigned short materialId, unsigned short geomId, unsigned depth)
 {
-    batches.clear();
+    return ((unsigned long long)layer << 60) | ((unsigned long long)programId << 44) | ((unsigned long long)materialId << 28) |
+        ((unsigned long long)geomId << 12) | depth;
 }
 
-void BatchQueue::Sort(std::vector<Matrix3x4>& instanceTransforms, BatchSortMode sortMode, bool convertToInstanced)
+void CalculateSortKeys(const Batch* batches, BatchSortKey* keys, size_t count, BatchSortMode sortMode, float maxDistance)
 {
-    ZoneScoped;
-
     switch (sortMode)
     {
     case SORT_STATE:
-        for (auto it = batches.begin(); it < batches.end(); ++it)
+        for (size_t i = 0; i < count; ++i)
         {
-            unsigned short materialId = (unsigned short)((size_t)it->pass / sizeof(Pass));
-            unsigned short geomId = (unsigned short)((size_t)it->geometry / sizeof(Geometry));
-
-            it->sortKey = (((unsigned)materialId) << 16) | geomId;
+            const Batch& batch = batches[i];
+            keys[i].key = StateSortKey(0, batch.pass->ProgramSortId(batch.programBits), batch.pass->Parent()->SortId(), batch.geometry->sortId, 0);
+            keys[i].index = (unsigned)i;
         }
-        std::sort(batches.begin(), batches.end(), CompareBatchKeys);
         break;
 
     case SORT_STATE_AND_DISTANCE:
-        for (auto it = batches.begin(); it < batches.end(); ++it)
         {
-            unsigned short materialId = it->pass->lastSortKey.second;
-            unsigned short geomId = it->geometry->lastSortKey.second;
-            
-            it->sortKey = (((unsigned)materialId) << 16) | geomId;
+            // The depth layer of a pass comes from its nearest batch, so that all batches of the pass share it and state changes are minimized within each layer
+            float depthScale = maxDistance > 0.0f ? SORT_MAX_DEPTH / maxDistance : 0.0f;
+
+            for (size_t i = 0; i < count; ++i)
+            {
+                const Batch& batch = batches[i];
+                unsigned layer = (unsigned)Min(batch.pass->lastSortKey.second >> SORT_LAYER_SHIFT, SORT_MAX_LAYER);
+                unsigned depth = (unsigned)Clamp(batch.distance * depthScale, 0.0f, SORT_MAX_DEPTH);
+
+                keys[i].key = StateSortKey(layer, batch.pass->ProgramSortId(batch.programBits), batch.pass->Parent()->SortId(), batch.geometry->sortId, depth);
+                keys[i].index = (unsigned)i;
+            }
         }
-        std::sort(batches.begin(), batches.end(), CompareBatchKeys);
         break;
 
     case SORT_DISTANCE:
-        std::sort(batches.begin(), batches.end(), CompareBatchDistance);
+        // Invert distance for back-to-front order, and use the shader program and material to break ties
+        for (size_t i = 0; i < count; ++i)
+        {
+            const Batch& batch = batches[i];
+            keys[i].key = ((unsigned long long)~FloatToSortableKey(batch.distance) << 32) | ((unsigned)batch.pass->ProgramSortId(batch.programBits) << 16) |
+                batch.pass->Parent()->SortId();
+            keys[i].index = (unsigned)i;
+        }
         break;
     }
+}
+
+void SortBatchKeys(BatchSortKey* keys, BatchSortKey* tempKeys, size_t count)
+{
+    if (count < RADIX_SORT_THRESHOLD)
+    {
+        std::sort(keys, keys + count, CompareBatchSortKeys);
+        return;
+    }
+
+    // Count the digit occurrences of all passes at once
+    unsigned histograms[RADIX_SORT_PASSES][RADIX_SORT_BUCKETS];
+    memset(histograms, 0, sizeof histograms);
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        unsigned long long key = keys[i].key;
+        for (size_t j = 0; j < RADIX_SORT_PASSES; ++j)
+            ++histograms[j][(key >> (j * RADIX_SORT_BITS)) & (RADIX_SORT_BUCKETS - 1)];
+    }
+
+    BatchSortKey* src = keys;
+    BatchSortKey* dest = tempKeys;
+
+    for (size_t j = 0; j < RADIX_SORT_PASSES; ++j)
+    {
+        unsigned* histogram = histograms[j];
+        size_t shift = j * RADIX_SORT_BITS;
+
+        // Skip the pass if all keys have the same digit, which is common for the upper bits
+        if (histogram[(src[0].key >> shift) & (RADIX_SORT_BUCKETS - 1)] == count)
+            continue;
+
+        unsigned offset = 0;
+        for (size_t k = 0; k < RADIX_SORT_BUCKETS; ++k)
+        {
+            unsigned bucketCount = histogram[k];
+            histogram[k] = offset;
+            offset += bucketCount;
+        }
+
+        for (size_t i = 0; i < count; ++i)
+            dest[histogram[(src[i].key >> shift) & (RADIX_SORT_BUCKETS - 1)]++] = src[i];
+
+        std::swap(src, dest);
+    }
+
+    if (src != keys)
+        memcpy(keys, src, count * sizeof(BatchSortKey));
+}
+
+void MergeBatches(const BatchSortRun* runs, size_t* positions, const size_t* ends, size_t numRuns, Batch* dest)
+{
+    // The amount of runs is the amount of threads, so a linear search for the smallest key is sufficient
+    for (;;)
+    {
+        size_t best = numRuns;
+        unsigned long long bestKey = 0;
+
+        for (size_t i = 0; i < numRuns; ++i)
+        {
+            if (positions[i] < ends[i])
+            {
+                unsigned long long key = runs[i].keys[positions[i]].key;
+                if (best == numRuns || key < bestKey)
+                {
+                    best = i;
+                    bestKey = key;
+                }
+            }
+        }
+
+        if (best == numRuns)
+            break;
+
+        const BatchSortRun& run = runs[best];
+        *dest++ = run.batches[run.keys[positions[best]++].index];
+    }
+}
+
+void RecordRenderCommands(const Batch* batches, RenderCommand* commands, size_t count)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        const Batch& batch = batches[i];
+        RenderCommand& command = commands[i];
+        Pass* pass = batch.pass;
+        Material* material = pass->Parent();
+        Geometry* geometry = batch.geometry;
+
+        command.program = pass->CachedShaderProgram(batch.programBits);
+        command.pass = pass;
+        command.materialState = &material->State();
+        command.geometry = geometry;
+        command.vertexBuffer = geometry->vertexBuffer;
+        command.indexBuffer = geometry->indexBuffer;
+        command.vertexArray = 0;
+        command.vertexArrayGeneration = 0;
+        command.indexSize = geometry->indexBuffer ? (unsigned)geometry->indexBuffer->IndexSize() : 0;
+        command.drawStart = (unsigned)geometry->drawStart;
+        command.drawCount = (unsigned)geometry->drawCount;
+        command.objectDataOffset = batch.objectDataOffset;
+        command.blendMode = pass->GetBlendMode();
+        command.cullMode = material->GetCullMode();
+        command.depthTest = pass->GetDepthTest();
+        command.programBits = batch.programBits;
+        command.geomIndex = batch.geomIndex;
+        command.colorWrite = pass->GetColorWrite();
+        command.depthWrite = pass->GetDepthWrite();
+
+        unsigned char geometryBits = batch.programBits & SP_GEOMETRYBITS;
+        if (geometryBits == GEOM_INSTANCED || geometryBits == GEOM_SKINNED_INSTANCED)
+            command.instanceCount = batch.instanceCount;
+        else if (!geometryBits)
+            command.worldTransform = batch.worldTransform;
+        else
+            command.drawable = batch.drawable;
+    }
+}
+
+void BatchQueue::Clear()
+{
+    batches.clear();
+    commands.clear();
+}
+
+void BatchQueue::Sort(std::vector<Matrix3x4>& instanceTransforms, BatchSortMode sortMode, bool convertToInstanced, float maxDistance)
+{
+    ZoneScoped;
+
+    size_t count = batches.size();
+
+    sortKeys.resize(count);
+    tempSortKeys.resize(count);
+    tempBatches.resize(count);
+
+    if (count)
+    {
+        CalculateSortKeys(&batches[0], &sortKeys[0], count, sortMode, maxDistance);
+        SortBatchKeys(&sortKeys[0], &tempSortKeys[0], count);
+
+        for (size_t i = 0; i < count; ++i)
+            tempBatches[i] = batches[sortKeys[i].index];
 
-    if (!convertToInstanced || batches.size() < 2)
+        batches.swap(tempBatches);
+    }
+
+    if (convertToInstanced)
+        ConvertToInstanced(instanceTransforms);
+}
+
+void BatchQueue::RecordCommands()
+{
+    ZoneScoped;
+
+    commands.resize(batches.size());
+    if (batches.size())
+        RecordRenderCommands(&batches[0], &commands[0], batches.size());
+}
+
+void BatchQueue::ConvertToInstanced(std::vector<Matrix3x4>& instanceTransforms)
+{
+    ZoneScoped;
+
+    if (batches.size() < 2)
         return;
 
     for (auto it = batches.begin(); it < batches.end() - 1; ++it)
@@ -91,3 +280,42 @@ void BatchQueue::Sort(std::vector<Matrix3x4>& instanceTransforms, BatchSortMode
         }
     }
 }
+
+void BatchQueue::ConvertToInstancedSkinned(std::vector<GeometryDrawable*>& instanceDrawables)
+{
+    ZoneScoped;
+
+    if (batches.size() < 2)
+        return;
+
+    for (auto it = batches.begin(); it < batches.end() - 1; ++it)
+    {
+        if (it->programBits != SP_SKINNED)
+            continue;
+
+        size_t start = instanceDrawables.size();
+        auto next = it + 1;
+
+        // Same geometry means same model, so the instances also have the same amount of bones
+        if (next->pass == it->pass && next->geometry == it->geometry && next->programBits == SP_SKINNED)
+        {
+            instanceDrawables.push_back(it->drawable);
+            instanceDrawables.push_back(next->drawable);
+            ++next;
+
+            for (; next < batches.end(); ++next)
+            {
+                if (next->pass == it->pass && next->geometry == it->geometry && next->programBits == SP_SKINNED)
+                    instanceDrawables.push_back(next->drawable);
+                else
+                    break;
+            }
+
+            size_t count = instanceDrawables.size() - start;
+            it->instanceStart = (unsigned)start;
+            it->programBits = SP_SKINNED_INSTANCED;
+            it->instanceCount = (unsigned)count;
+            it += count - 1;
+        }
+    }
+}
@@ -2,6 +2,7 @@
 
 #pragma once
 
+#include "../Graphics/GraphicsDefs.h"
 #include "../Math/AreaAllocator.h"
 #include "../Math/Matrix3x4.h"
 #include "../Object/Ptr.h"
@@ -9,7 +10,12 @@
 #include <vector>
 
 class GeometryDrawable;
+class IndexBuffer;
+class Material;
 class Pass;
+struct MaterialState;
+class ShaderProgram;
+class VertexBuffer;
 struct Geometry;
 
 /// Sorting modes for batches.
@@ -25,12 +31,12 @@ struct Batch
 {
     union
     {
-        /// State sorting key.
-        unsigned sortKey;
-        /// Distance for alpha batches.
+        /// Distance from camera for sorting.
         float distance;
-        /// Start position in the instance vertex buffer if instanced.
+        /// Start position in the instance vertex buffer if instanced, or in the instance drawables if instanced skinned.
         unsigned instanceStart;
+        /// Byte offset of the world transform in the frame data ring buffer if static and not instanced, or the skin palette parameters if instanced skinned. Assigned after sorting.
+        unsigned objectDataOffset;
     };
 
     /// %Material pass.
@@ -53,16 +59,119 @@ struct Batch
     };
 };
 
+/// Draw command recorded from a sorted batch, with the shader program, material, buffers and render state resolved beforehand so that rendering only needs to replay the commands.
+struct RenderCommand
+{
+    /// %Shader program, or null if the variation was not created yet.
+    ShaderProgram* program;
+    /// %Material pass.
+    Pass* pass;
+    /// Resolved OpenGL objects of the material.
+    const MaterialState* materialState;
+    /// %Geometry. Only used for comparison.
+    Geometry* geometry;
+    /// Vertex buffer.
+    VertexBuffer* vertexBuffer;
+    /// Index buffer, or null if not indexed.
+    IndexBuffer* indexBuffer;
+    /// Vertex array object resolved on first replay, or zero if not resolved yet.
+    mutable unsigned vertexArray;
+    /// Vertex array object generation at the time of resolving.
+    mutable unsigned vertexArrayGeneration;
+    /// Index size of the index buffer, or zero if not indexed.
+    unsigned indexSize;
+    /// Draw range start.
+    unsigned drawStart;
+    /// Draw range count.
+    unsigned drawCount;
+
+    union
+    {
+        /// Start position in the instance vertex buffer if instanced.
+        unsigned instanceStart;
+        /// Byte offset of the world transform or skin palette parameters in the frame data ring buffer.
+        unsigned objectDataOffset;
+    };
+
+    union
+    {
+        /// Associated drawable if skinned or custom geometry.
+        GeometryDrawable* drawable;
+        /// Pointer to world transform matrix for static geometry rendering.
+        const Matrix3x4* worldTransform;
+        /// Instance count if instanced.
+        unsigned instanceCount;
+    };
+
+    /// Blend mode.
+    BlendMode blendMode;
+    /// Cull mode, before reversing for the camera.
+    CullMode cullMode;
+    /// Depth test mode.
+    CompareMode depthTest;
+    /// %Shader variation bits.
+    unsigned char programBits;
+    /// Geometry index.
+    unsigned char geomIndex;
+    /// Color write flag.
+    bool colorWrite;
+    /// Depth write flag.
+    bool depthWrite;
+};
+
+/// Batch sorting key with the index of the batch it belongs to.
+struct BatchSortKey
+{
+    /// Key value. Sorted in ascending order.
+    unsigned long long key;
+    /// Batch index.
+    unsigned index;
+};
+
+/// Sorted run of batch keys and the batches they refer to, for merging.
+struct BatchSortRun
+{
+    /// Sorted keys.
+    const BatchSortKey* keys;
+    /// Batches referred to by the keys' indices.
+    const Batch* batches;
+    /// Number of keys.
+    size_t count;
+};
+
 /// Collection of draw calls with sorting and instancing functionality.
 struct BatchQueue
 {
     /// Clear for the next frame.
     void Clear();
-    /// Sort batches and setup instancing groups.
-    void Sort(std::vector<Matrix3x4>& instanceTransforms, BatchSortMode sortMode, bool convertToInstanced);
+    /// Sort batches and setup instancing groups. The max distance is used to quantize depth in combined state and distance sorting.
+    void Sort(std::vector<Matrix3x4>& instanceTransforms, BatchSortMode sortMode, bool convertToInstanced, float maxDistance = 0.0f);
+    /// Setup instancing groups from already sorted batches.
+    void ConvertToInstanced(std::vector<Matrix3x4>& instanceTransforms);
+    /// Setup instancing groups of skinned batches from already sorted batches. The drawables of each group are stored consecutively, and the group's first batch stores their start index and count.
+    void ConvertToInstancedSkinned(std::vector<GeometryDrawable*>& instanceDrawables);
+    /// Record render commands from the batches, which should be final at this point.
+    void RecordCommands();
     /// Return whether has batches added.
     bool HasBatches() const { return batches.size(); }
 
     /// Batches.
     std::vector<Batch> batches;
+    /// Sort keys for sorting.
+    std::vector<BatchSortKey> sortKeys;
+    /// Temporary sort keys for sorting.
+    std::vector<BatchSortKey> tempSortKeys;
+    /// Temporary batches for sorting.
+    std::vector<Batch> tempBatches;
+    /// Render commands recorded from the batches.
+    std::vector<RenderCommand> commands;
 };
+
+/// Calculate batch sort keys according to the sort mode. State keys are ordered by depth layer, shader program, material, geometry and quantized depth from most to least significant, with depth quantized up to the max distance. Distance sorting produces keys for back-to-front order.
+void CalculateSortKeys(const Batch* batches, BatchSortKey* keys, size_t count, BatchSortMode sortMode, float maxDistance = 0.0f);
+/// Sort batch keys in ascending order using a radix sort. Needs temporary storage for the same amount of keys. The sort is stable.
+void SortBatchKeys(BatchSortKey* keys, BatchSortKey* tempKeys, size_t count);
+/// Record render commands from batches. Does not create shader programs, so can be called from worker threads on any subrange of a batch queue.
+void RecordRenderCommands(const Batch* batches, RenderCommand* commands, size_t count);
+/// Merge sorted runs into a destination array, copying the batches in key order. Merges the key ranges from the current to end positions in each run, and advances the positions. Several key ranges can be merged in parallel into different parts of the destination.
+void MergeBatches(const BatchSortRun* runs, size_t* positions, const size_t* ends, size_t numRuns, Batch* dest);
@@ -4,10 +4,16 @@
 #include "../Graphics/Graphics.h"
 #include "../Graphics/IndexBuffer.h"
 #include "../Graphics/VertexBuffer.h"
+#include "../Math/TriangleBVH.h"
 #include "../Resource/ResourceCache.h"
 #include "Camera.h"
 #include "GeometryNode.h"
 #include "Material.h"
+#include "Octree.h"
+
+#include <atomic>
+
+static std::atomic<unsigned> nextSortId(0);
 
 SourceBatches::SourceBatches()
 {
@@ -72,16 +78,38 @@ Geometry::Geometry() :
     cpuDrawStart(0),
     cpuIndexSize(0)
 {
+    // Geometries may be created in resource loading threads. If the ids wrap around, the only consequence is less optimal batch sorting
+    sortId = (unsigned short)(nextSortId.fetch_add(1) % 0xffff + 1);
 }
 
 Geometry::~Geometry()
 {
 }
 
+bool Geometry::BuildBVH()
+{
+    if (!cpuPositionData)
+        return false;
+
+    if (!bvh)
+        bvh = new TriangleBVH();
+
+    if (!bvh->Define(cpuPositionData.Get(), cpuIndexData.Get(), cpuIndexSize, cpuDrawStart, drawCount))
+    {
+        bvh.Reset();
+        return false;
+    }
+
+    return true;
+}
+
 float Geometry::HitDistance(const Ray& ray, Vector3* outNormal) const
 {
     if (!cpuPositionData)
         return M_INFINITY;
+
+    if (bvh)
+        return bvh->HitDistance(ray, outNormal);
     
     if (cpuIndexData)
         return ray.HitDistance(cpuPositionData, sizeof(Vector3), cpuIndexData, cpuIndexSize, cpuDrawStart, drawCount, outNormal);
@@ -121,6 +149,7 @@ void GeometryNode::SetNumGeometries(size_t num)
 {
     GeometryDrawable* geomDrawable = static_cast<GeometryDrawable*>(drawable);
     geomDrawable->batches.SetNumGeometries(num);
+    OnBatchesChanged();
 }
 
 void GeometryNode::SetGeometry(size_t index, Geometry* geometry)
@@ -133,7 +162,10 @@ void GeometryNode::SetGeometry(size_t index, Geometry* geometry)
 
     GeometryDrawable* geomDrawable = static_cast<GeometryDrawable*>(drawable);
     if (index < geomDrawable->batches.NumGeometries())
+    {
         geomDrawable->batches.SetGeometry(index, geometry);
+        OnBatchesChanged();
+    }
 }
 
 void GeometryNode::SetMaterial(Material* material)
@@ -144,6 +176,7 @@ void GeometryNode::SetMaterial(Material* material)
     GeometryDrawable* geomDrawable = static_cast<GeometryDrawable*>(drawable);
     for (size_t i = 0; i < geomDrawable->batches.NumGeometries(); ++i)
         geomDrawable->batches.SetMaterial(i, material);
+    OnBatchesChanged();
 }
 
 void GeometryNode::SetMaterial(size_t index, Material* material)
@@ -153,7 +186,10 @@ void GeometryNode::SetMaterial(size_t index, Material* material)
 
     GeometryDrawable* geomDrawable = static_cast<GeometryDrawable*>(drawable);
     if (index < geomDrawable->batches.NumGeometries())
+    {
         geomDrawable->batches.SetMaterial(index, material);
+        OnBatchesChanged();
+    }
 }
 
 void GeometryNode::SetMaterialsAttr(const ResourceRefList& value)
@@ -173,3 +209,9 @@ ResourceRefList GeometryNode::MaterialsAttr() const
 
     return ret;
 }
+
+void GeometryNode::OnBatchesChanged()
+{
+    if (IsStatic())
+        Octree::MarkStaticContentChanged();
+}
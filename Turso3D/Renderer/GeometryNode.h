@@ -4,6 +4,7 @@
 
 #include "../Graphics/GraphicsDefs.h"
 #include "../IO/ResourceRef.h"
+#include "../Object/AutoPtr.h"
 #include "OctreeNode.h"
 
 class GeometryNode;
@@ -11,6 +12,7 @@ class IndexBuffer;
 class Material;
 class Pass;
 class ShaderProgram;
+class TriangleBVH;
 class VertexBuffer;
 
 /// Description of geometry to be rendered. %Scene nodes that render the same object can share these to reduce memory load and allow instancing.
@@ -21,11 +23,13 @@ struct Geometry : public RefCounted
     /// Destruct.
     ~Geometry();
 
+    /// Build a triangle BVH from the CPU-side data to accelerate ray hit tests. Return true on success.
+    bool BuildBVH();
     /// Return ray hit distance if has CPU-side data, or infinity if no hit or no data.
     float HitDistance(const Ray& ray, Vector3* outNormal = nullptr) const;
 
-    /// Last sort key for combined distance and state sorting. Used by Renderer.
-    std::pair<unsigned short, unsigned short> lastSortKey;
+    /// Nonzero id used for sorting batches by geometry.
+    unsigned short sortId;
 
     /// %Geometry vertex buffer.
     SharedPtr<VertexBuffer> vertexBuffer;
@@ -45,6 +49,8 @@ struct Geometry : public RefCounted
     size_t cpuIndexSize;
     /// Optional draw range start for the CPU data. May be different in case combined vertex and index buffers are in use.
     size_t cpuDrawStart;
+    /// Optional triangle BVH of the CPU-side data.
+    AutoPtr<TriangleBVH> bvh;
 };
 
 /// Draw call source data with optimal memory storage. 
@@ -165,4 +171,6 @@ protected:
     void SetMaterialsAttr(const ResourceRefList& value);
     /// Return materials list. Used in serialization.
     ResourceRefList MaterialsAttr() const;
+    /// Handle geometries or materials changing. Invalidates cached static rendering data if is static.
+    void OnBatchesChanged();
 };
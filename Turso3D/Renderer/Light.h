@@ -61,8 +61,10 @@ struct ShadowView
     size_t staticQueueIdx;
     /// Dynamic object batch queue index in the shadowmap.
     size_t dynamicQueueIdx;
-    /// Shadow caster list index in the shadowmap.
+    /// Shadow caster list index in the shadowmap. The views of a point or directional light share the list.
     size_t casterListIdx;
+    /// Bit of this view in the shadow caster list's frustum masks.
+    unsigned casterMask;
     /// Last viewport used in shadow map render.
     IntRect lastViewport;
     /// Last shadow projection matrix.
@@ -6,7 +6,9 @@
 #include "../Resource/JSONFile.h"
 #include "../Resource/ResourceCache.h"
 #include "Material.h"
+#include "Octree.h"
 
+#include <atomic>
 #include <tracy/Tracy.hpp>
 
 const char* passNames[] = 
@@ -23,14 +25,18 @@ const char* geometryDefines[] =
     "SKINNED ",
     "INSTANCED ",
     "",
+    "SKINNED INSTANCED ",
     nullptr
 };
 
 std::set<Material*> Material::allMaterials;
 SharedPtr<Material> Material::defaultMaterial;
+unsigned Material::stateTextureGeneration = 0;
 std::string Material::globalVSDefines;
 std::string Material::globalFSDefines;
 
+static std::atomic<unsigned> nextSortId(0);
+
 Pass::Pass(Material* parent_) :
     parent(parent_),
     blendMode(BLEND_REPLACE),
@@ -89,8 +95,11 @@ void Pass::ResetShaderPrograms()
 
 Material::Material() :
     cullMode(CULL_BACK),
-    uniformsDirty(false)
+    uniformsDirty(false),
+    stateDirty(true)
 {
+    // Materials may be created in resource loading threads. If the ids wrap around, the only consequence is less optimal batch sorting
+    sortId = (unsigned short)(nextSortId.fetch_add(1) % 0xffff + 1);
     allMaterials.insert(this);
 }
 
@@ -212,26 +221,39 @@ SharedPtr<Material> Material::Clone()
 Pass* Material::CreatePass(PassType type)
 {
     if (!passes[type])
+    {
         passes[type] = new Pass(this);
+        // Pass changes affect which batches drawables produce
+        Octree::MarkStaticContentChanged();
+    }
     
     return passes[type];
 }
 
 void Material::RemovePass(PassType type)
 {
-    passes[type].Reset();
+    if (passes[type])
+    {
+        passes[type].Reset();
+        Octree::MarkStaticContentChanged();
+    }
 }
 
 void Material::SetTexture(size_t index, Texture* texture)
 {
     if (index < MAX_MATERIAL_TEXTURE_UNITS)
+    {
         textures[index] = texture;
+        stateDirty = true;
+    }
 }
 
 void Material::ResetTextures()
 {
     for (size_t i = 0; i < MAX_MATERIAL_TEXTURE_UNITS; ++i)
         textures[i].Reset();
+
+    stateDirty = true;
 }
 
 void Material::SetShaderDefines(const std::string& vsDefines_, const std::string& fsDefines_)
@@ -339,6 +361,23 @@ void Material::SetGlobalShaderDefines(const std::string& vsDefines_, const std::
     }
 }
 
+void Material::UpdateStates()
+{
+    ZoneScoped;
+
+    // Redefining a texture replaces its OpenGL object, so resolve all materials again if any texture object was created or released
+    unsigned textureGeneration = Texture::Generation();
+    bool texturesChanged = textureGeneration != stateTextureGeneration;
+    stateTextureGeneration = textureGeneration;
+
+    for (auto it = allMaterials.begin(); it != allMaterials.end(); ++it)
+    {
+        Material* material = *it;
+        if (texturesChanged || material->stateDirty || material->uniformsDirty)
+            material->UpdateState();
+    }
+}
+
 void Material::SetCullMode(CullMode mode)
 {
     cullMode = mode;
@@ -366,6 +405,22 @@ UniformBuffer* Material::GetUniformBuffer() const
     return uniformBuffer;
 }
 
+void Material::UpdateState()
+{
+    for (size_t i = 0; i < MAX_MATERIAL_TEXTURE_UNITS; ++i)
+    {
+        Texture* texture = textures[i];
+        state.textures[i] = texture ? texture->GLTexture() : 0;
+        state.textureTargets[i] = texture ? texture->GLTarget() : 0;
+    }
+
+    UniformBuffer* buffer = GetUniformBuffer();
+    state.uniformBuffer = buffer ? buffer->GLBuffer() : 0;
+    state.uniformBufferSize = buffer ? (unsigned)buffer->Size() : 0;
+
+    stateDirty = false;
+}
+
 const Vector4& Material::Uniform(const std::string& name_) const
 {
     return Uniform(StringHash(name_));
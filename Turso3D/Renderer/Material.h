@@ -30,9 +30,23 @@ static const unsigned SP_STATIC = 0x0;
 static const unsigned SP_SKINNED = 0x1;
 static const unsigned SP_INSTANCED = 0x2;
 static const unsigned SP_CUSTOMGEOM = 0x3;
-static const unsigned SP_GEOMETRYBITS = 0x3;
+static const unsigned SP_SKINNED_INSTANCED = 0x4;
+static const unsigned SP_GEOMETRYBITS = 0x7;
 
-static const size_t MAX_SHADER_VARIATIONS = 4;
+static const size_t MAX_SHADER_VARIATIONS = 5;
+
+/// OpenGL objects of a material, resolved on the main thread so that render commands can bind them without accessing the textures and uniform buffer.
+struct MaterialState
+{
+    /// Texture object identifiers by texture unit, or zero if none.
+    unsigned textures[MAX_MATERIAL_TEXTURE_UNITS];
+    /// Texture binding targets by texture unit.
+    unsigned textureTargets[MAX_MATERIAL_TEXTURE_UNITS];
+    /// Uniform buffer object identifier, or zero if none.
+    unsigned uniformBuffer;
+    /// Uniform buffer size in bytes.
+    unsigned uniformBufferSize;
+};
 
 /// Render pass, which defines render state and shaders. A material may define several of these.
 class Pass : public RefCounted
@@ -51,8 +65,12 @@ public:
     void ResetShaderPrograms();
     /// Set render state.
     void SetRenderState(BlendMode blendMode, CompareMode depthTest = CMP_LESS, bool colorWrite = true, bool depthWrite = true);
-    /// Get a shader program and cache for later use.
-    ShaderProgram* GetShaderProgram(unsigned char programBits);
+    /// Get a shader program and cache for later use. If deferred, a new program is only started compiling.
+    ShaderProgram* GetShaderProgram(unsigned char programBits, bool deferred = false);
+    /// Return an already cached shader program, or null if not created yet. Does not compile, so is safe to call from worker threads.
+    ShaderProgram* CachedShaderProgram(unsigned char programBits) const { return shaderPrograms[programBits]; }
+    /// Return the sort id of an already cached shader program, or zero if not created yet. Does not compile, so is safe to call from worker threads.
+    unsigned short ProgramSortId(unsigned char programBits) const { return shaderPrograms[programBits] ? shaderPrograms[programBits]->SortId() : 0; }
 
     /// Return parent material.
     Material* Parent() const { return parent; }
@@ -161,6 +179,10 @@ public:
     const Vector4& Uniform(StringHash nameHash) const;
     /// Return culling mode.
     CullMode GetCullMode() const { return cullMode; }
+    /// Return the nonzero id used for sorting batches by material textures and uniforms.
+    unsigned short SortId() const { return sortId; }
+    /// Return the resolved OpenGL objects for rendering. Up to date after UpdateStates().
+    const MaterialState& State() const { return state; }
 
     /// Return vertex shader defines.
     const std::string& VSDefines() const { return vsDefines; }
@@ -171,14 +193,23 @@ public:
     static void SetGlobalShaderDefines(const std::string& vsDefines, const std::string& fsDefines);
     /// Return a default opaque untextured material.
     static Material* DefaultMaterial();
+    /// Resolve the OpenGL objects of materials whose textures or uniforms have changed, and update dirty uniform buffers. To be called only from the main thread before recording render commands.
+    static void UpdateStates();
+    /// Return all existing materials.
+    static const std::set<Material*>& AllMaterials() { return allMaterials; }
     /// Return global vertex shader defines.
     static const std::string& GlobalVSDefines() { return globalVSDefines; }
     /// Return global fragment shader defines.
     static const std::string& GlobalFSDefines() { return globalFSDefines; }
 
 private:
+    /// Resolve the OpenGL objects.
+    void UpdateState();
+
     /// Culling mode.
     CullMode cullMode;
+    /// Batch sorting id.
+    unsigned short sortId;
     /// Passes.
     SharedPtr<Pass> passes[MAX_PASS_TYPES];
     /// Material textures.
@@ -191,6 +222,10 @@ private:
     std::vector<Vector4> uniformValues;
     /// Uniforms dirty flag.
     mutable bool uniformsDirty;
+    /// Resolved OpenGL objects.
+    MaterialState state;
+    /// Resolved OpenGL objects dirty flag.
+    bool stateDirty;
     /// Vertex shader defines for all passes.
     std::string vsDefines;
     /// Fragment shader defines for all passes.
@@ -202,6 +237,8 @@ private:
     static SharedPtr<Material> defaultMaterial;
     /// All materials.
     static std::set<Material*> allMaterials;
+    /// Texture object generation at the last state update. Textures may have been redefined if changed.
+    static unsigned stateTextureGeneration;
     /// Global vertex shader defines.
     static std::string globalVSDefines;
     /// Global fragment shader defines.
@@ -212,7 +249,7 @@ extern const char* geometryDefines[];
 extern const char* lightDefines[];
 extern const char* dirLightDefines[];
 
-inline ShaderProgram* Pass::GetShaderProgram(unsigned char programBits)
+inline ShaderProgram* Pass::GetShaderProgram(unsigned char programBits, bool deferred)
 {
     if (shaderPrograms[programBits])
         return shaderPrograms[programBits];
@@ -225,7 +262,8 @@ inline ShaderProgram* Pass::GetShaderProgram(unsigned char programBits)
 
         ShaderProgram* newShaderProgram = shader->CreateProgram(
             Material::GlobalVSDefines() + parent->VSDefines() + vsDefines + geometryDefines[geomBits],
-            Material::GlobalFSDefines() + parent->FSDefines() + fsDefines
+            Material::GlobalFSDefines() + parent->FSDefines() + fsDefines,
+            deferred
         );
 
         shaderPrograms[programBits] = newShaderProgram;
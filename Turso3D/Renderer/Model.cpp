@@ -17,6 +17,9 @@ static const size_t COMBINEDBUFFER_INDICES = 1024 * 1024;
 // Bone bounding box size required to contribute to bounding box recalculation
 static const float BONE_SIZE_THRESHOLD = 0.05f;
 
+// Triangle count required for building a BVH for CPU-side ray hit tests
+static const size_t BVH_TRIANGLE_THRESHOLD = 64;
+
 std::map<unsigned, std::vector<WeakPtr<CombinedBuffer> > > CombinedBuffer::buffers;
 
 CombinedBuffer::CombinedBuffer(const std::vector<VertexElement>& elements) :
@@ -413,6 +416,10 @@ bool Model::EndLoad()
             geom->cpuIndexSize = ibDescs[geomDesc.ibRef].indexSize;
             geom->cpuDrawStart = geomDesc.drawStart;
 
+            // Skinned geometry deforms, so its bind pose triangles are not useful for hit tests
+            if (!hasWeights && geom->drawCount / 3 >= BVH_TRIANGLE_THRESHOLD)
+                geom->BuildBVH();
+
             geometries[i][j] = geom;
         }
     }
@@ -440,9 +447,14 @@ bool Model::EndLoad()
             }
             else
             {
-                unsigned* indexData = (unsigned*)&ibDesc.indexData[0];
+                // Copy the indices, as the original data is referenced by the geometries as CPU-side data
+                unsigned* oldIndexData = (unsigned*)&ibDesc.indexData[0];
+                SharedArrayPtr<unsigned char> newIndices(new unsigned char[sizeof(unsigned) * ibDesc.numIndices]);
+                unsigned* newIndexData = (unsigned*)newIndices.Get();
                 for (size_t j = 0; j < ibDescs[i].numIndices; ++j)
-                    indexData[j] += vertexStart;
+                    newIndexData[j] = oldIndexData[j] + vertexStart;
+
+                ibDesc.indexData = newIndices;
             }
         }
 
@@ -0,0 +1,300 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "Camera.h"
+#include "GeometryNode.h"
+#include "OcclusionBuffer.h"
+
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_SSE
+#endif
+
+static const float OCCLUSION_MIN_TRIANGLE_AREA = 0.25f;
+static const float OCCLUSION_EDGE_BIAS = 0.0001f;
+
+OcclusionBuffer::OcclusionBuffer() :
+    viewProj(Matrix4::IDENTITY),
+    width(0),
+    height(0),
+    blocksX(0),
+    blocksY(0)
+{
+}
+
+OcclusionBuffer::~OcclusionBuffer()
+{
+}
+
+void OcclusionBuffer::SetSize(int newWidth, int newHeight)
+{
+    int newBlocksX = Max((newWidth + OCCLUSION_BLOCK_SIZE - 1) / OCCLUSION_BLOCK_SIZE, 1);
+    int newBlocksY = Max((newHeight + OCCLUSION_BLOCK_SIZE - 1) / OCCLUSION_BLOCK_SIZE, 1);
+    if (newBlocksX == blocksX && newBlocksY == blocksY)
+        return;
+
+    blocksX = newBlocksX;
+    blocksY = newBlocksY;
+    width = blocksX * OCCLUSION_BLOCK_SIZE;
+    height = blocksY * OCCLUSION_BLOCK_SIZE;
+
+    depthBuffer = new float[width * height];
+    blockDepths = new float[blocksX * blocksY];
+}
+
+void OcclusionBuffer::SetView(Camera* camera)
+{
+    viewProj = camera->ProjectionMatrix(false) * camera->ViewMatrix();
+}
+
+void OcclusionBuffer::AddTriangles(ArenaVector<OcclusionTriangle>& dest, const Matrix3x4& worldTransform, const Geometry* geometry) const
+{
+    if (!geometry->cpuPositionData)
+        return;
+
+    Matrix4 worldViewProj = viewProj * Matrix4(worldTransform);
+    const Vector3* positions = geometry->cpuPositionData.Get();
+    const unsigned char* indexData = geometry->cpuIndexData.Get();
+    size_t indexSize = geometry->cpuIndexSize;
+    float halfWidth = 0.5f * width;
+    float halfHeight = 0.5f * height;
+
+    for (size_t i = 0; i + 2 < geometry->drawCount; i += 3)
+    {
+        OcclusionTriangle triangle;
+        bool clipped = false;
+
+        for (size_t j = 0; j < 3; ++j)
+        {
+            size_t index = geometry->cpuDrawStart + i + j;
+            if (indexData)
+                index = indexSize == sizeof(unsigned short) ? ((const unsigned short*)indexData)[index] : ((const unsigned*)indexData)[index];
+
+            Vector4 clip = worldViewProj * Vector4(positions[index], 1.0f);
+            // Drop triangles that reach behind the near plane instead of clipping them
+            if (clip.z < 0.0f || clip.w <= 0.0f)
+            {
+                clipped = true;
+                break;
+            }
+
+            float invW = 1.0f / clip.w;
+            triangle.vertices[j] = Vector3((clip.x * invW + 1.0f) * halfWidth, (clip.y * invW + 1.0f) * halfHeight, clip.z * invW);
+        }
+
+        if (clipped)
+            continue;
+
+        const Vector3& v0 = triangle.vertices[0];
+        const Vector3& v1 = triangle.vertices[1];
+        const Vector3& v2 = triangle.vertices[2];
+
+        // Reject triangles completely outside the buffer or too small to cover a pixel center
+        if (Max(Max(v0.x, v1.x), v2.x) < 0.0f || Min(Min(v0.x, v1.x), v2.x) > (float)width ||
+            Max(Max(v0.y, v1.y), v2.y) < 0.0f || Min(Min(v0.y, v1.y), v2.y) > (float)height)
+            continue;
+
+        float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+        if (Abs(area) < OCCLUSION_MIN_TRIANGLE_AREA)
+            continue;
+
+        // Occluders are rasterized double-sided, so make the winding consistent
+        if (area < 0.0f)
+            std::swap(triangle.vertices[1], triangle.vertices[2]);
+
+        dest.push_back(triangle);
+    }
+}
+
+void OcclusionBuffer::Rasterize(const ArenaSpan<OcclusionTriangle>* triangleLists, size_t numLists, int blockRowBegin, int blockRowEnd)
+{
+    ZoneScoped;
+
+    int rowBegin = blockRowBegin * OCCLUSION_BLOCK_SIZE;
+    int rowEnd = blockRowEnd * OCCLUSION_BLOCK_SIZE;
+
+    float* rowsStart = depthBuffer.Get() + rowBegin * width;
+    float* rowsEnd = depthBuffer.Get() + rowEnd * width;
+    for (float* ptr = rowsStart; ptr != rowsEnd; ++ptr)
+        *ptr = 1.0f;
+
+    for (size_t i = 0; i < numLists; ++i)
+    {
+        const ArenaSpan<OcclusionTriangle>& triangles = triangleLists[i];
+        for (auto it = triangles.begin(); it != triangles.end(); ++it)
+            RasterizeTriangle(*it, rowBegin, rowEnd);
+    }
+
+    // Update the maximum depth of each block for hierarchical testing
+    for (int by = blockRowBegin; by < blockRowEnd; ++by)
+    {
+        for (int bx = 0; bx < blocksX; ++bx)
+        {
+            float maxDepth = 0.0f;
+
+            for (int y = by * OCCLUSION_BLOCK_SIZE; y < (by + 1) * OCCLUSION_BLOCK_SIZE; ++y)
+            {
+                const float* row = depthBuffer.Get() + y * width + bx * OCCLUSION_BLOCK_SIZE;
+                for (int x = 0; x < OCCLUSION_BLOCK_SIZE; ++x)
+                    maxDepth = Max(maxDepth, row[x]);
+            }
+
+            blockDepths[by * blocksX + bx] = maxDepth;
+        }
+    }
+}
+
+bool OcclusionBuffer::IsVisible(const BoundingBox& box) const
+{
+    if (!depthBuffer)
+        return true;
+
+    float minX = M_MAX_FLOAT, minY = M_MAX_FLOAT, maxX = -M_MAX_FLOAT, maxY = -M_MAX_FLOAT;
+    float minDepth = M_MAX_FLOAT;
+
+    for (size_t i = 0; i < 8; ++i)
+    {
+        Vector3 corner((i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y, (i & 4) ? box.max.z : box.min.z);
+        Vector4 clip = viewProj * Vector4(corner, 1.0f);
+
+        // If the box reaches behind the near plane, assume visible
+        if (clip.z < 0.0f || clip.w <= 0.0f)
+            return true;
+
+        float invW = 1.0f / clip.w;
+        float x = clip.x * invW;
+        float y = clip.y * invW;
+        minX = Min(minX, x);
+        maxX = Max(maxX, x);
+        minY = Min(minY, y);
+        maxY = Max(maxY, y);
+        minDepth = Min(minDepth, clip.z * invW);
+    }
+
+    // Include all pixels the box touches
+    int left = Max((int)floorf((minX + 1.0f) * 0.5f * width), 0);
+    int right = Min((int)ceilf((maxX + 1.0f) * 0.5f * width), width) - 1;
+    int bottom = Max((int)floorf((minY + 1.0f) * 0.5f * height), 0);
+    int top = Min((int)ceilf((maxY + 1.0f) * 0.5f * height), height) - 1;
+
+    // Outside the buffer: leave for the frustum test to decide
+    if (left > right || bottom > top)
+        return true;
+
+    for (int by = bottom / OCCLUSION_BLOCK_SIZE; by <= top / OCCLUSION_BLOCK_SIZE; ++by)
+    {
+        for (int bx = left / OCCLUSION_BLOCK_SIZE; bx <= right / OCCLUSION_BLOCK_SIZE; ++bx)
+        {
+            // If the box is behind the farthest occluder in the block, the whole block is occluded
+            if (minDepth >= blockDepths[by * blocksX + bx])
+                continue;
+
+            // Otherwise check the individual pixels covered by the box
+            int x0 = Max(bx * OCCLUSION_BLOCK_SIZE, left);
+            int x1 = Min((bx + 1) * OCCLUSION_BLOCK_SIZE - 1, right);
+            int y0 = Max(by * OCCLUSION_BLOCK_SIZE, bottom);
+            int y1 = Min((by + 1) * OCCLUSION_BLOCK_SIZE - 1, top);
+
+            for (int y = y0; y <= y1; ++y)
+            {
+                const float* row = depthBuffer.Get() + y * width;
+                for (int x = x0; x <= x1; ++x)
+                {
+                    if (minDepth < row[x])
+                        return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+void OcclusionBuffer::RasterizeTriangle(const OcclusionTriangle& triangle, int rowBegin, int rowEnd)
+{
+    const Vector3& v0 = triangle.vertices[0];
+    const Vector3& v1 = triangle.vertices[1];
+    const Vector3& v2 = triangle.vertices[2];
+
+    // Pixel rows and columns whose centers are within the triangle's bounding rectangle
+    int minY = Max((int)ceilf(Min(Min(v0.y, v1.y), v2.y) - 0.5f), rowBegin);
+    int maxY = Min((int)floorf(Max(Max(v0.y, v1.y), v2.y) - 0.5f), rowEnd - 1);
+    if (minY > maxY)
+        return;
+
+    int minX = Max((int)ceilf(Min(Min(v0.x, v1.x), v2.x) - 0.5f), 0);
+    int maxX = Min((int)floorf(Max(Max(v0.x, v1.x), v2.x) - 0.5f), width - 1);
+    if (minX > maxX)
+        return;
+
+    // Align the start column so that 4 pixels can be processed at a time. The width is a multiple of the block size, so the last group stays within the row
+    minX &= ~3;
+
+    // Edge functions are positive inside the triangle due to the consistent winding
+    float area = (v1.x - v0.x) * (v2.y - v0.y) - (v1.y - v0.y) * (v2.x - v0.x);
+    float invArea = 1.0f / area;
+
+    float e0dx = v1.y - v2.y;
+    float e1dx = v2.y - v0.y;
+    float e2dx = v0.y - v1.y;
+
+    // Depth is linear in screen space
+    float zdx = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) * invArea;
+    float zdy = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) * invArea;
+
+    // Bias the edge functions slightly relative to the area so that pixel centers exactly on an edge shared by two triangles are not left uncovered due to rounding
+    float bias = area * OCCLUSION_EDGE_BIAS;
+    float startX = (float)minX + 0.5f;
+
+    for (int y = minY; y <= maxY; ++y)
+    {
+        float py = (float)y + 0.5f;
+        float e0 = (v2.x - v1.x) * (py - v1.y) - (v2.y - v1.y) * (startX - v1.x) + bias;
+        float e1 = (v0.x - v2.x) * (py - v2.y) - (v0.y - v2.y) * (startX - v2.x) + bias;
+        float e2 = (v1.x - v0.x) * (py - v0.y) - (v1.y - v0.y) * (startX - v0.x) + bias;
+        float z = v0.z + zdx * (startX - v0.x) + zdy * (py - v0.y);
+        float* row = depthBuffer.Get() + y * width;
+
+#ifdef USE_SSE
+        const __m128 offsets = _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f);
+        const __m128 zero = _mm_setzero_ps();
+        __m128 e0v = _mm_add_ps(_mm_set1_ps(e0), _mm_mul_ps(_mm_set1_ps(e0dx), offsets));
+        __m128 e1v = _mm_add_ps(_mm_set1_ps(e1), _mm_mul_ps(_mm_set1_ps(e1dx), offsets));
+        __m128 e2v = _mm_add_ps(_mm_set1_ps(e2), _mm_mul_ps(_mm_set1_ps(e2dx), offsets));
+        __m128 zv = _mm_add_ps(_mm_set1_ps(z), _mm_mul_ps(_mm_set1_ps(zdx), offsets));
+        __m128 e0step = _mm_set1_ps(4.0f * e0dx);
+        __m128 e1step = _mm_set1_ps(4.0f * e1dx);
+        __m128 e2step = _mm_set1_ps(4.0f * e2dx);
+        __m128 zstep = _mm_set1_ps(4.0f * zdx);
+
+        for (int x = minX; x <= maxX; x += 4)
+        {
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0v, zero), _mm_cmpge_ps(e1v, zero)), _mm_cmpge_ps(e2v, zero));
+            if (_mm_movemask_ps(inside))
+            {
+                __m128 old = _mm_loadu_ps(row + x);
+                __m128 nearer = _mm_min_ps(old, zv);
+                _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+            }
+
+            e0v = _mm_add_ps(e0v, e0step);
+            e1v = _mm_add_ps(e1v, e1step);
+            e2v = _mm_add_ps(e2v, e2step);
+            zv = _mm_add_ps(zv, zstep);
+        }
+#else
+        for (int x = minX; x <= maxX; ++x)
+        {
+            if (e0 >= 0.0f && e1 >= 0.0f && e2 >= 0.0f)
+                row[x] = Min(row[x], z);
+
+            e0 += e0dx;
+            e1 += e1dx;
+            e2 += e2dx;
+            z += zdx;
+        }
+#endif
+    }
+}
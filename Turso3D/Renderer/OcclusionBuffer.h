@@ -0,0 +1,75 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "../Math/BoundingBox.h"
+#include "../Math/Matrix4.h"
+#include "../Object/AutoPtr.h"
+#include "../Thread/FrameArena.h"
+
+class Camera;
+struct Geometry;
+
+static const int OCCLUSION_BLOCK_SIZE = 8;
+static const int DEFAULT_OCCLUSION_BUFFER_WIDTH = 256;
+
+/// Occluder triangle transformed to occlusion buffer pixel coordinates, with depth in Z.
+struct OcclusionTriangle
+{
+    /// Vertices.
+    Vector3 vertices[3];
+};
+
+/// Low-resolution CPU depth buffer for software occlusion culling. Occluder triangles are rasterized on worker threads in horizontal bands, after which bounding boxes are tested against a hierarchical max depth.
+class OcclusionBuffer
+{
+public:
+    /// Construct.
+    OcclusionBuffer();
+    /// Destruct.
+    ~OcclusionBuffer();
+
+    /// Set buffer size. The size is rounded up to a multiple of the block size.
+    void SetSize(int width, int height);
+    /// Set the camera view for the current frame.
+    void SetView(Camera* camera);
+    /// Transform a geometry's triangles into buffer coordinates and append them to a triangle list. Triangles crossing the near plane are dropped, as occluders may only be conservative. Can be called from several threads with separate lists.
+    void AddTriangles(ArenaVector<OcclusionTriangle>& dest, const Matrix3x4& worldTransform, const Geometry* geometry) const;
+    /// Clear a range of block rows, rasterize triangle lists into them and update their hierarchical depth. Can be called from several threads with separate row ranges.
+    void Rasterize(const ArenaSpan<OcclusionTriangle>* triangleLists, size_t numLists, int blockRowBegin, int blockRowEnd);
+    /// Test a world space bounding box for visibility. Return true if potentially visible, false if occluded.
+    bool IsVisible(const BoundingBox& box) const;
+
+    /// Return width in pixels.
+    int Width() const { return width; }
+    /// Return height in pixels.
+    int Height() const { return height; }
+    /// Return number of block rows, for dividing the rasterization work.
+    int NumBlockRows() const { return blocksY; }
+    /// Return the depth data.
+    const float* Data() const { return depthBuffer.Get(); }
+
+private:
+    /// Prevent copy construction.
+    OcclusionBuffer(const OcclusionBuffer& rhs);
+    /// Prevent assignment.
+    OcclusionBuffer& operator = (const OcclusionBuffer& rhs);
+
+    /// Rasterize one triangle into a row range.
+    void RasterizeTriangle(const OcclusionTriangle& triangle, int rowBegin, int rowEnd);
+
+    /// Depth values.
+    AutoArrayPtr<float> depthBuffer;
+    /// Maximum depth values of each block.
+    AutoArrayPtr<float> blockDepths;
+    /// Combined view and projection matrix, with depth range 0-1.
+    Matrix4 viewProj;
+    /// Width in pixels.
+    int width;
+    /// Height in pixels.
+    int height;
+    /// Width in blocks.
+    int blocksX;
+    /// Height in blocks.
+    int blocksY;
+};
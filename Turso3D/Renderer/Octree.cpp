@@ -9,14 +9,26 @@
 
 #include <cassert>
 #include <algorithm>
+#include <cstring>
 #include <tracy/Tracy.hpp>
 
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_SSE
+#endif
+
 static const float DEFAULT_OCTREE_SIZE = 1000.0f;
 static const int DEFAULT_OCTREE_LEVELS = 8;
 static const int MAX_OCTREE_LEVELS = 255;
 static const size_t MIN_THREADED_UPDATE = 16;
+static const size_t RAY_PACKET_SIZE = 4;
+static const size_t MIN_THREADED_RAY_PACKETS = 4;
 
 static std::vector<unsigned> freeQueries;
+// Per-thread scratch for drawable raycast hits in batched raycasts, reused to avoid allocating for each work item.
+static thread_local std::vector<RaycastResult> threadRaycastHits;
+
+std::atomic<unsigned> Octree::staticContentVersion(0);
 
 static inline bool CompareRaycastResults(const RaycastResult& lhs, const RaycastResult& rhs)
 {
@@ -28,32 +40,156 @@ static inline bool CompareDrawableDistances(const std::pair<Drawable*, float>& l
     return lhs.second < rhs.second;
 }
 
-static inline bool CompareDrawables(Drawable* lhs, Drawable* rhs)
+/// Packet of rays traversed through the octree together, in structure-of-arrays form.
+struct RayPacket
 {
-    unsigned short lhsFlags = lhs->Flags() & (DF_LIGHT | DF_GEOMETRY);
-    unsigned short rhsFlags = rhs->Flags() & (DF_LIGHT | DF_GEOMETRY);
-    if (lhsFlags != rhsFlags)
-        return lhsFlags < rhsFlags;
-    else
-        return lhs < rhs;
-}
+    /// Initialize from a range of rays. Unused slots never hit.
+    void Initialize(const Ray* rays_, RaycastResult* results_, size_t numRays_, float maxDistance)
+    {
+        rays = rays_;
+        results = results_;
+        numRays = numRays_;
 
-/// %Task for octree drawables reinsertion.
-struct ReinsertDrawablesTask : public MemberFunctionTask<Octree>
-{
-    /// Construct.
-    ReinsertDrawablesTask(Octree* object_, MemberWorkFunctionPtr function_) :
-        MemberFunctionTask<Octree>(object_, function_)
+        for (size_t i = 0; i < RAY_PACKET_SIZE; ++i)
+        {
+            const Ray& ray = rays[i < numRays ? i : 0];
+            originX[i] = ray.origin.x;
+            originY[i] = ray.origin.y;
+            originZ[i] = ray.origin.z;
+            // Avoid infinities, which would produce NaNs when the origin is on a slab plane
+            invDirX[i] = ray.direction.x != 0.0f ? 1.0f / ray.direction.x : M_MAX_FLOAT;
+            invDirY[i] = ray.direction.y != 0.0f ? 1.0f / ray.direction.y : M_MAX_FLOAT;
+            invDirZ[i] = ray.direction.z != 0.0f ? 1.0f / ray.direction.z : M_MAX_FLOAT;
+            closest[i] = i < numRays ? maxDistance : -1.0f;
+
+            if (i < numRays)
+            {
+                RaycastResult& result = results[i];
+                result.position = result.normal = Vector3::ZERO;
+                result.distance = M_INFINITY;
+                result.drawable = nullptr;
+                result.subObject = 0;
+            }
+        }
+    }
+
+    /// Test a box with all rays. Return a bitmask of rays that hit it closer than their current closest hit.
+    unsigned HitMask(float minX, float minY, float minZ, float maxX, float maxY, float maxZ) const
     {
+#ifdef USE_SSE
+        __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(minX), _mm_loadu_ps(originX)), _mm_loadu_ps(invDirX));
+        __m128 t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(maxX), _mm_loadu_ps(originX)), _mm_loadu_ps(invDirX));
+        __m128 tNear = _mm_min_ps(t1, t2);
+        __m128 tFar = _mm_max_ps(t1, t2);
+
+        t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(minY), _mm_loadu_ps(originY)), _mm_loadu_ps(invDirY));
+        t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(maxY), _mm_loadu_ps(originY)), _mm_loadu_ps(invDirY));
+        tNear = _mm_max_ps(tNear, _mm_min_ps(t1, t2));
+        tFar = _mm_min_ps(tFar, _mm_max_ps(t1, t2));
+
+        t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(minZ), _mm_loadu_ps(originZ)), _mm_loadu_ps(invDirZ));
+        t2 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(maxZ), _mm_loadu_ps(originZ)), _mm_loadu_ps(invDirZ));
+        tNear = _mm_max_ps(tNear, _mm_min_ps(t1, t2));
+        tFar = _mm_min_ps(tFar, _mm_max_ps(t1, t2));
+
+        tNear = _mm_max_ps(tNear, _mm_setzero_ps());
+        __m128 hit = _mm_and_ps(_mm_cmple_ps(tNear, tFar), _mm_cmplt_ps(tNear, _mm_loadu_ps(closest)));
+        return (unsigned)_mm_movemask_ps(hit);
+#else
+        unsigned mask = 0;
+
+        for (size_t i = 0; i < RAY_PACKET_SIZE; ++i)
+        {
+            float t1 = (minX - originX[i]) * invDirX[i];
+            float t2 = (maxX - originX[i]) * invDirX[i];
+            float tNear = Min(t1, t2);
+            float tFar = Max(t1, t2);
+
+            t1 = (minY - originY[i]) * invDirY[i];
+            t2 = (maxY - originY[i]) * invDirY[i];
+            tNear = Max(tNear, Min(t1, t2));
+            tFar = Min(tFar, Max(t1, t2));
+
+            t1 = (minZ - originZ[i]) * invDirZ[i];
+            t2 = (maxZ - originZ[i]) * invDirZ[i];
+            tNear = Max(tNear, Min(t1, t2));
+            tFar = Min(tFar, Max(t1, t2));
+
+            tNear = Max(tNear, 0.0f);
+            if (tNear <= tFar && tNear < closest[i])
+                mask |= 1 << i;
+        }
+
+        return mask;
+#endif
     }
 
-    /// Start pointer.
-    Drawable** start;
-    /// End pointer.
-    Drawable** end;
+    /// Ray origin X coordinates.
+    float originX[RAY_PACKET_SIZE];
+    /// Ray origin Y coordinates.
+    float originY[RAY_PACKET_SIZE];
+    /// Ray origin Z coordinates.
+    float originZ[RAY_PACKET_SIZE];
+    /// Reciprocal ray direction X coordinates.
+    float invDirX[RAY_PACKET_SIZE];
+    /// Reciprocal ray direction Y coordinates.
+    float invDirY[RAY_PACKET_SIZE];
+    /// Reciprocal ray direction Z coordinates.
+    float invDirZ[RAY_PACKET_SIZE];
+    /// Closest hit distances so far.
+    float closest[RAY_PACKET_SIZE];
+    /// Source rays.
+    const Ray* rays;
+    /// Destination results.
+    RaycastResult* results;
+    /// Number of rays in use.
+    size_t numRays;
 };
 
+void OctantCullingData::Resize(size_t count)
+{
+    size_t paddedCount = (count + CULLING_GROUP_SIZE - 1) & ~(CULLING_GROUP_SIZE - 1);
+    if (paddedCount == minX.size())
+        return;
+
+    minX.resize(paddedCount);
+    minY.resize(paddedCount);
+    minZ.resize(paddedCount);
+    maxX.resize(paddedCount);
+    maxY.resize(paddedCount);
+    maxZ.resize(paddedCount);
+    flags.resize(paddedCount);
+    layerMasks.resize(paddedCount);
+}
+
+void OctantCullingData::Set(size_t index, const Drawable* drawable)
+{
+    const BoundingBox& box = drawable->WorldBoundingBox();
+
+    minX[index] = box.min.x;
+    minY[index] = box.min.y;
+    minZ[index] = box.min.z;
+    maxX[index] = box.max.x;
+    maxY[index] = box.max.y;
+    maxZ[index] = box.max.z;
+    flags[index] = drawable->Flags();
+    layerMasks[index] = drawable->LayerMask();
+}
+
+void OctantCullingData::Move(size_t from, size_t to)
+{
+    minX[to] = minX[from];
+    minY[to] = minY[from];
+    minZ[to] = minZ[from];
+    maxX[to] = maxX[from];
+    maxY[to] = maxY[from];
+    maxZ[to] = maxZ[from];
+    flags[to] = flags[from];
+    layerMasks[to] = layerMasks[from];
+}
+
 Octant::Octant() :
+    numLights(0),
     parent(nullptr),
     visibility(VIS_VISIBLE_UNKNOWN),
     occlusionQueryId(0),
@@ -140,36 +276,81 @@ void Octant::OnOcclusionQueryResult(bool visible)
     }
 }
 
-const BoundingBox& Octant::CullingBox() const
+void Octant::RefitCullingBox()
 {
-    if (TestFlag(OF_CULLING_BOX_DIRTY))
+    if (!numChildren && drawables.empty())
+        cullingBox.Define(center);
+    else
     {
-        if (!numChildren && drawables.empty())
-            cullingBox.Define(center);
-        else
+        BoundingBox newBox;
+
+        // Use the culling data instead of accessing the drawables
+        size_t numDrawables = drawables.size();
+        if (numDrawables)
         {
-            // Use a temporary bounding box for calculations in case many threads call this simultaneously
-            BoundingBox tempBox;
+            Vector3 newMin(cullingData.minX[0], cullingData.minY[0], cullingData.minZ[0]);
+            Vector3 newMax(cullingData.maxX[0], cullingData.maxY[0], cullingData.maxZ[0]);
 
-            for (auto it = drawables.begin(); it != drawables.end(); ++it)
-                tempBox.Merge((*it)->WorldBoundingBox());
+            for (size_t i = 1; i < numDrawables; ++i)
+            {
+                newMin.x = Min(newMin.x, cullingData.minX[i]);
+                newMin.y = Min(newMin.y, cullingData.minY[i]);
+                newMin.z = Min(newMin.z, cullingData.minZ[i]);
+                newMax.x = Max(newMax.x, cullingData.maxX[i]);
+                newMax.y = Max(newMax.y, cullingData.maxY[i]);
+                newMax.z = Max(newMax.z, cullingData.maxZ[i]);
+            }
 
-            if (numChildren)
+            newBox.Define(newMin, newMax);
+        }
+
+        if (numChildren)
+        {
+            for (size_t i = 0; i < NUM_OCTANTS; ++i)
             {
-                for (size_t i = 0; i < NUM_OCTANTS; ++i)
+                Octant* child = children[i];
+                if (child)
                 {
-                    if (children[i])
-                        tempBox.Merge(children[i]->CullingBox());
+                    if (child->TestFlag(OF_CULLING_BOX_DIRTY))
+                        child->RefitCullingBox();
+                    newBox.Merge(child->cullingBox);
                 }
             }
-
-            cullingBox = tempBox;
         }
 
-        SetFlag(OF_CULLING_BOX_DIRTY, false);
+        cullingBox = newBox;
     }
 
-    return cullingBox;
+    SetFlag(OF_CULLING_BOX_DIRTY, false);
+}
+
+void Octant::TestDrawables(const Frustum& frustum, unsigned char planeMask, unsigned short drawableFlags, unsigned layerMask, size_t start, size_t numGroups, unsigned char* groupMasks) const
+{
+    if (planeMask)
+        frustum.IsInsideMaskedFast(&cullingData.minX[start], &cullingData.minY[start], &cullingData.minZ[start], &cullingData.maxX[start], &cullingData.maxY[start], &cullingData.maxZ[start], numGroups, groupMasks, planeMask);
+    else
+        memset(groupMasks, 0xf, numGroups);
+
+    size_t numDrawables = drawables.size();
+    const unsigned short* drawableFlagsPtr = &cullingData.flags[start];
+    const unsigned* layerMasksPtr = &cullingData.layerMasks[start];
+
+    for (size_t i = 0; i < numGroups; ++i)
+    {
+        unsigned char mask = groupMasks[i];
+        if (!mask)
+            continue;
+
+        // Exclude the padding at the end, and drawables which do not match the flags or layer
+        for (size_t j = 0; j < CULLING_GROUP_SIZE; ++j)
+        {
+            size_t offset = i * CULLING_GROUP_SIZE + j;
+            if (start + offset >= numDrawables || (drawableFlagsPtr[offset] & drawableFlags) != drawableFlags || !(layerMasksPtr[offset] & layerMask))
+                mask &= ~(1 << j);
+        }
+
+        groupMasks[i] = mask;
+    }
 }
 
 Octree::Octree() :
@@ -180,14 +361,18 @@ Octree::Octree() :
     assert(workQueue);
 
     root.Initialize(nullptr, BoundingBox(-DEFAULT_OCTREE_SIZE, DEFAULT_OCTREE_SIZE), DEFAULT_OCTREE_LEVELS, 0);
+    root.RefitCullingBox();
 
-    // Have at least 1 task for reinsert processing
-    reinsertTasks.push_back(new ReinsertDrawablesTask(this, &Octree::CheckReinsertWork));
     reinsertQueues = new std::vector<Drawable*>[workQueue->NumThreads()];
+    MarkStaticContentChanged();
 }
 
 Octree::~Octree()
 {
+    // Ensure no reinsertion is still going on
+    if (!reinsertJob.IsDone())
+        reinsertJob.Join();
+
     // Clear octree association from nodes that were never inserted
     // Note: the threaded queues cannot have nodes that were never inserted, only nodes that should be moved
     for (auto it = updateQueue.begin(); it != updateQueue.end(); ++it)
@@ -201,6 +386,7 @@ Octree::~Octree()
     }
 
     DeleteChildOctants(&root, true);
+    MarkStaticContentChanged();
 }
 
 void Octree::RegisterObject()
@@ -219,33 +405,16 @@ void Octree::Update(unsigned short frameNumber_)
 
     frameNumber = frameNumber_;
 
-    // Avoid overhead of threaded update if only a small number of objects to update / reinsert
     if (updateQueue.size())
     {
         SetThreadedUpdate(true);
 
-        // Split into smaller tasks to encourage work stealing in case some thread is slower
-        size_t nodesPerTask = Max(MIN_THREADED_UPDATE, updateQueue.size() / workQueue->NumThreads() / 4);
-        size_t taskIdx = 0;
-
-        for (size_t start = 0; start < updateQueue.size(); start += nodesPerTask)
+        // The work queue splits the range further on demand in case some thread is slower
+        workQueue->ParallelFor(reinsertJob, 0, updateQueue.size(), MIN_THREADED_UPDATE, [this](size_t begin, size_t end, unsigned threadIndex)
         {
-            size_t end = start + nodesPerTask;
-            if (end > updateQueue.size())
-                end = updateQueue.size();
-
-            if (reinsertTasks.size() <= taskIdx)
-                reinsertTasks.push_back(new ReinsertDrawablesTask(this, &Octree::CheckReinsertWork));
-            reinsertTasks[taskIdx]->start = &updateQueue[0] + start;
-            reinsertTasks[taskIdx]->end = &updateQueue[0] + end;
-            ++taskIdx;
-        }
-
-        numPendingReinsertionTasks.store((int)taskIdx);
-        workQueue->QueueTasks(taskIdx, reinterpret_cast<Task**>(&reinsertTasks[0]));
+            CheckReinsertWork(begin, end, threadIndex);
+        });
     }
-    else
-        numPendingReinsertionTasks.store(0);
 }
 
 void Octree::FinishUpdate()
@@ -253,8 +422,7 @@ void Octree::FinishUpdate()
     ZoneScoped;
 
     // Complete tasks until reinsertions done. There may other tasks going on at the same time
-    while (numPendingReinsertionTasks.load() > 0)
-        workQueue->TryComplete();
+    reinsertJob.Join();
 
     SetThreadedUpdate(false);
 
@@ -264,30 +432,33 @@ void Octree::FinishUpdate()
 
     updateQueue.clear();
 
-    // Sort octants' drawables by address and put lights first
-    for (auto it = sortDirtyOctants.begin(); it != sortDirtyOctants.end(); ++it)
-    {
-        Octant* octant = *it;
-        std::sort(octant->drawables.begin(), octant->drawables.end(), CompareDrawables);
-        octant->SetFlag(OF_DRAWABLES_SORT_DIRTY, false);
-    }
-
-    sortDirtyOctants.clear();
+    RefitCullingBoxes();
 }
 
 void Octree::Resize(const BoundingBox& boundingBox, int numLevels)
 {
     ZoneScoped;
 
-    // Collect nodes to the root and delete all child octants
+    // Collect nodes to the root and delete all child octants. Any threaded reinsertions are superseded
     updateQueue.clear();
-    std::vector<Drawable*> occluders;
+    for (size_t i = 0; i < workQueue->NumThreads(); ++i)
+        reinsertQueues[i].clear();
     
     CollectDrawables(updateQueue, &root);
     DeleteChildOctants(&root, false);
 
+    for (size_t i = 0; i < updateQueue.size(); ++i)
+    {
+        Drawable* drawable = updateQueue[i];
+        drawable->queueIndex = (unsigned)i;
+        drawable->queue = 0;
+        drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, true);
+    }
+
     allocator.Reset();
     root.Initialize(nullptr, boundingBox, (unsigned char)Clamp(numLevels, 1, MAX_OCTREE_LEVELS), 0);
+    root.RefitCullingBox();
+    MarkStaticContentChanged();
 }
 
 void Octree::OnRenderDebug(DebugRenderer* debug)
@@ -299,6 +470,8 @@ void Octree::Raycast(std::vector<RaycastResult>& result, const Ray& ray, unsigne
 {
     ZoneScoped;
 
+    CheckCullingBoxes();
+
     result.clear();
     CollectDrawables(result, const_cast<Octant*>(&root), ray, nodeFlags, maxDistance, layerMask);
     std::sort(result.begin(), result.end(), CompareRaycastResults);
@@ -308,6 +481,8 @@ RaycastResult Octree::RaycastSingle(const Ray& ray, unsigned short nodeFlags, fl
 {
     ZoneScoped;
 
+    CheckCullingBoxes();
+
     // Get the potential hits first
     initialRayResult.clear();
     CollectDrawables(initialRayResult, const_cast<Octant*>(&root), ray, nodeFlags, maxDistance, layerMask);
@@ -345,23 +520,98 @@ RaycastResult Octree::RaycastSingle(const Ray& ray, unsigned short nodeFlags, fl
     }
 }
 
+void Octree::RaycastBatch(const Ray* rays, size_t count, RaycastResult* results, unsigned short drawableFlags, float maxDistance, unsigned layerMask) const
+{
+    ZoneScoped;
+
+    if (!count)
+        return;
+
+    CheckCullingBoxes();
+
+    // The results are written directly per packet and the culling boxes are only read, so the work functions share no mutable state.
+    // The handle may live on the stack, as it is signaled only after the work queue has released its tasks
+    ParallelForHandle raycastJob;
+    size_t numPackets = (count + RAY_PACKET_SIZE - 1) / RAY_PACKET_SIZE;
+
+    workQueue->ParallelFor(raycastJob, 0, numPackets, MIN_THREADED_RAY_PACKETS, [=](size_t begin, size_t end, unsigned)
+    {
+        std::vector<RaycastResult>& hits = threadRaycastHits;
+        RayPacket packet;
+
+        for (size_t i = begin; i < end; ++i)
+        {
+            size_t start = i * RAY_PACKET_SIZE;
+            packet.Initialize(rays + start, results + start, Min(count - start, RAY_PACKET_SIZE), maxDistance);
+            RaycastPacket(packet, const_cast<Octant*>(&root), drawableFlags, layerMask, hits);
+        }
+    }).Join();
+}
+
 void Octree::FindDrawablesMasked(std::vector<Drawable*>& result, const Frustum& frustum, unsigned short drawableFlags, unsigned layerMask) const
 {
     ZoneScoped;
 
+    CheckCullingBoxes();
     CollectDrawablesMasked(result, const_cast<Octant*>(&root), frustum, drawableFlags, layerMask);
 }
 
+void Octree::FindDrawablesMasked(ArenaVector<Drawable*>& result, const Frustum& frustum, unsigned short drawableFlags, unsigned layerMask) const
+{
+    ZoneScoped;
+
+    CheckCullingBoxes();
+    CollectDrawablesMasked(result, const_cast<Octant*>(&root), frustum, drawableFlags, layerMask);
+}
+
+void Octree::FindDrawablesMasked(std::vector<FrustumQueryResult>& result, const Frustum* frusta, size_t numFrusta, unsigned short drawableFlags, unsigned layerMask) const
+{
+    ZoneScoped;
+
+    assert(numFrusta <= MAX_QUERY_FRUSTA);
+
+    unsigned char planeMasks[MAX_QUERY_FRUSTA];
+    memset(planeMasks, 0x3f, sizeof planeMasks);
+
+    BoundingBox frustaBox;
+    for (size_t i = 0; i < numFrusta; ++i)
+        frustaBox.Merge(frusta[i]);
+
+    CheckCullingBoxes();
+    CollectDrawablesMasked(result, const_cast<Octant*>(&root), frusta, frustaBox, (1 << numFrusta) - 1, planeMasks, drawableFlags, layerMask);
+}
+
+void Octree::FindDrawablesMasked(ArenaVector<FrustumQueryResult>& result, const Frustum* frusta, size_t numFrusta, unsigned short drawableFlags, unsigned layerMask) const
+{
+    ZoneScoped;
+
+    assert(numFrusta <= MAX_QUERY_FRUSTA);
+
+    unsigned char planeMasks[MAX_QUERY_FRUSTA];
+    memset(planeMasks, 0x3f, sizeof planeMasks);
+
+    BoundingBox frustaBox;
+    for (size_t i = 0; i < numFrusta; ++i)
+        frustaBox.Merge(frusta[i]);
+
+    CheckCullingBoxes();
+    CollectDrawablesMasked(result, const_cast<Octant*>(&root), frusta, frustaBox, (1 << numFrusta) - 1, planeMasks, drawableFlags, layerMask);
+}
+
 void Octree::QueueUpdate(Drawable* drawable)
 {
     assert(drawable);
 
-    if (drawable->octant)
-        drawable->octant->MarkCullingBoxDirty();
+    // Already queued drawables will be checked in any case
+    if (drawable->TestFlag(DF_OCTREE_REINSERT_QUEUED))
+        return;
+
+    if (drawable->IsStatic())
+        MarkStaticContentChanged();
 
     if (!threadedUpdate)
     {
-        updateQueue.push_back(drawable);
+        AddDrawableToQueue(drawable, updateQueue, 0);
         drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, true);
     }
     else
@@ -373,9 +623,15 @@ void Octree::QueueUpdate(Drawable* drawable)
         Octant* oldOctant = drawable->GetOctant();
         if (!oldOctant || oldOctant->fittingBox.IsInside(box) != INSIDE)
         {
-            reinsertQueues[WorkQueue::ThreadIndex()].push_back(drawable);
+            unsigned threadIndex = WorkQueue::ThreadIndex();
+            AddDrawableToQueue(drawable, reinsertQueues[threadIndex], threadIndex + 1);
             drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, true);
         }
+        else
+        {
+            oldOctant->cullingData.Set(drawable->octantIndex, drawable);
+            oldOctant->MarkCullingBoxDirty();
+        }
     }
 }
 
@@ -384,15 +640,19 @@ void Octree::RemoveDrawable(Drawable* drawable)
     if (!drawable)
         return;
 
-    RemoveDrawable(drawable, drawable->GetOctant());
-    if (drawable->TestFlag(DF_OCTREE_REINSERT_QUEUED))
+    Octant* octant = drawable->GetOctant();
+    if (octant)
     {
-        RemoveDrawableFromQueue(drawable, updateQueue);
+        assert(octant->drawables[drawable->octantIndex] == drawable);
+        RemoveDrawable(octant, drawable->octantIndex);
+    }
 
-        // Remove also from threaded queues if was left over before next update
-        for (size_t i = 0; i < workQueue->NumThreads(); ++i)
-            RemoveDrawableFromQueue(drawable, reinsertQueues[i]);
+    if (drawable->IsStatic())
+        MarkStaticContentChanged();
 
+    if (drawable->TestFlag(DF_OCTREE_REINSERT_QUEUED))
+    {
+        RemoveDrawableFromQueue(drawable);
         drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, false);
     }
 
@@ -424,7 +684,10 @@ void Octree::ReinsertDrawables(std::vector<Drawable*>& drawables)
 {
     for (auto it = drawables.begin(); it != drawables.end(); ++it)
     {
+        // If drawable was removed before reinsertion could happen, a null pointer will be in its place
         Drawable* drawable = *it;
+        if (!drawable)
+            continue;
 
         const BoundingBox& box = drawable->WorldBoundingBox();
         Octant* oldOctant = drawable->GetOctant();
@@ -443,10 +706,13 @@ void Octree::ReinsertDrawables(std::vector<Drawable*>& drawables)
                 if (newOctant != oldOctant)
                 {
                     // Add first, then remove, because drawable count going to zero deletes the octree branch in question
+                    unsigned oldIndex = drawable->octantIndex;
                     AddDrawable(drawable, newOctant);
                     if (oldOctant)
-                        RemoveDrawable(drawable, oldOctant);
+                        RemoveDrawable(oldOctant, oldIndex);
                 }
+                else
+                    newOctant->cullingData.Set(drawable->octantIndex, drawable);
                 break;
             }
             else
@@ -459,16 +725,28 @@ void Octree::ReinsertDrawables(std::vector<Drawable*>& drawables)
     drawables.clear();
 }
 
-void Octree::RemoveDrawableFromQueue(Drawable* drawable, std::vector<Drawable*>& drawables)
+void Octree::RefitCullingBoxes()
 {
-    for (auto it = drawables.begin(); it != drawables.end(); ++it)
+    ZoneScoped;
+
+    // Dirty flags are always set up to the root, so only the changed branches are visited
+    if (!root.TestFlag(OF_CULLING_BOX_DIRTY))
+        return;
+
+    if (root.numChildren)
     {
-        if ((*it) == drawable)
+        workQueue->ParallelFor(refitJob, 0, NUM_OCTANTS, 1, [this](size_t begin, size_t end, unsigned)
         {
-            *it = nullptr;
-            break;
-        }
+            for (size_t i = begin; i < end; ++i)
+            {
+                Octant* child = root.children[i];
+                if (child && child->TestFlag(OF_CULLING_BOX_DIRTY))
+                    child->RefitCullingBox();
+            }
+        }).Join();
     }
+
+    root.RefitCullingBox();
 }
 
 Octant* Octree::CreateChildOctant(Octant* octant, unsigned char index)
@@ -500,6 +778,8 @@ Octant* Octree::CreateChildOctant(Octant* octant, unsigned char index)
     child->Initialize(octant, BoundingBox(newMin, newMax), octant->level - 1, index);
     octant->children[index] = child;
     ++octant->numChildren;
+    // The new octant starts dirty, so mark the parent hierarchy explicitly
+    octant->MarkCullingBoxDirty();
 
     return child;
 }
@@ -522,6 +802,8 @@ void Octree::DeleteChildOctants(Octant* octant, bool deletingOctree)
             drawable->Owner()->octree = nullptr;
     }
     octant->drawables.clear();
+    octant->cullingData.Resize(0);
+    octant->numLights = 0;
 
     if (octant->numChildren)
     {
@@ -552,15 +834,19 @@ void Octree::CollectDrawables(std::vector<Drawable*>& result, Octant* octant) co
     }
 }
 
-void Octree::CollectDrawables(std::vector<Drawable*>& result, Octant* octant, unsigned short drawableFlags, unsigned layerMask) const
+void Octree::CollectDrawables(std::vector<RaycastResult>& result, Octant* octant, const Ray& ray, unsigned short drawableFlags, float maxDistance, unsigned layerMask) const
 {
+    float octantDist = ray.HitDistance(octant->CullingBox());
+    if (octantDist >= maxDistance)
+        return;
+
     std::vector<Drawable*>& drawables = octant->drawables;
 
     for (auto it = drawables.begin(); it != drawables.end(); ++it)
     {
         Drawable* drawable = *it;
         if ((drawable->Flags() & drawableFlags) == drawableFlags && (drawable->LayerMask() & layerMask))
-            result.push_back(drawable);
+            drawable->OnRaycast(result, ray, maxDistance);
     }
 
     if (octant->numChildren)
@@ -568,12 +854,12 @@ void Octree::CollectDrawables(std::vector<Drawable*>& result, Octant* octant, un
         for (size_t i = 0; i < NUM_OCTANTS; ++i)
         {
             if (octant->children[i])
-                CollectDrawables(result, octant->children[i], drawableFlags, layerMask);
+                CollectDrawables(result, octant->children[i], ray, drawableFlags, maxDistance, layerMask);
         }
     }
 }
 
-void Octree::CollectDrawables(std::vector<RaycastResult>& result, Octant* octant, const Ray& ray, unsigned short drawableFlags, float maxDistance, unsigned layerMask) const
+void Octree::CollectDrawables(std::vector<std::pair<Drawable*, float> >& result, Octant* octant, const Ray& ray, unsigned short drawableFlags, float maxDistance, unsigned layerMask) const
 {
     float octantDist = ray.HitDistance(octant->CullingBox());
     if (octantDist >= maxDistance)
@@ -585,7 +871,11 @@ void Octree::CollectDrawables(std::vector<RaycastResult>& result, Octant* octant
     {
         Drawable* drawable = *it;
         if ((drawable->Flags() & drawableFlags) == drawableFlags && (drawable->LayerMask() & layerMask))
-            drawable->OnRaycast(result, ray, maxDistance);
+        {
+            float distance = ray.HitDistance(drawable->WorldBoundingBox());
+            if (distance < maxDistance)
+                result.push_back(std::make_pair(drawable, distance));
+        }
     }
 
     if (octant->numChildren)
@@ -598,22 +888,37 @@ void Octree::CollectDrawables(std::vector<RaycastResult>& result, Octant* octant
     }
 }
 
-void Octree::CollectDrawables(std::vector<std::pair<Drawable*, float> >& result, Octant* octant, const Ray& ray, unsigned short drawableFlags, float maxDistance, unsigned layerMask) const
+void Octree::RaycastPacket(RayPacket& packet, Octant* octant, unsigned short drawableFlags, unsigned layerMask, std::vector<RaycastResult>& hits) const
 {
-    float octantDist = ray.HitDistance(octant->CullingBox());
-    if (octantDist >= maxDistance)
+    const BoundingBox& octantBox = octant->CullingBox();
+    if (!packet.HitMask(octantBox.min.x, octantBox.min.y, octantBox.min.z, octantBox.max.x, octantBox.max.y, octantBox.max.z))
         return;
 
-    std::vector<Drawable*>& drawables = octant->drawables;
+    const OctantCullingData& data = octant->cullingData;
+    size_t numDrawables = octant->drawables.size();
 
-    for (auto it = drawables.begin(); it != drawables.end(); ++it)
+    for (size_t i = 0; i < numDrawables; ++i)
     {
-        Drawable* drawable = *it;
-        if ((drawable->Flags() & drawableFlags) == drawableFlags && (drawable->LayerMask() & layerMask))
+        if ((data.flags[i] & drawableFlags) != drawableFlags || !(data.layerMasks[i] & layerMask))
+            continue;
+
+        unsigned mask = packet.HitMask(data.minX[i], data.minY[i], data.minZ[i], data.maxX[i], data.maxY[i], data.maxZ[i]);
+        for (size_t j = 0; mask; ++j, mask >>= 1)
         {
-            float distance = ray.HitDistance(drawable->WorldBoundingBox());
-            if (distance < maxDistance)
-                result.push_back(std::make_pair(drawable, distance));
+            if (!(mask & 1))
+                continue;
+
+            // Perform the accurate test, limited by the closest hit so far
+            hits.clear();
+            octant->drawables[i]->OnRaycast(hits, packet.rays[j], packet.closest[j]);
+            for (auto it = hits.begin(); it != hits.end(); ++it)
+            {
+                if (it->distance < packet.closest[j])
+                {
+                    packet.closest[j] = it->distance;
+                    packet.results[j] = *it;
+                }
+            }
         }
     }
 
@@ -622,21 +927,20 @@ void Octree::CollectDrawables(std::vector<std::pair<Drawable*, float> >& result,
         for (size_t i = 0; i < NUM_OCTANTS; ++i)
         {
             if (octant->children[i])
-                CollectDrawables(result, octant->children[i], ray, drawableFlags, maxDistance, layerMask);
+                RaycastPacket(packet, octant->children[i], drawableFlags, layerMask, hits);
         }
     }
 }
 
-void Octree::CheckReinsertWork(Task* task_, unsigned threadIndex_)
+void Octree::CheckReinsertWork(size_t begin, size_t end, unsigned threadIndex_)
 {
     ZoneScoped;
 
-    ReinsertDrawablesTask* task = static_cast<ReinsertDrawablesTask*>(task_);
-    Drawable** start = task->start;
-    Drawable** end = task->end;
+    Drawable** start = &updateQueue[0] + begin;
+    Drawable** last = &updateQueue[0] + end;
     std::vector<Drawable*>& reinsertQueue = reinsertQueues[threadIndex_];
 
-    for (; start != end; ++start)
+    for (; start != last; ++start)
     {
         // If drawable was removed before reinsertion could happen, a null pointer will be in its place
         Drawable* drawable = *start;
@@ -652,10 +956,13 @@ void Octree::CheckReinsertWork(Task* task_, unsigned threadIndex_)
         const BoundingBox& box = drawable->WorldBoundingBox();
         Octant* oldOctant = drawable->GetOctant();
         if (!oldOctant || oldOctant->fittingBox.IsInside(box) != INSIDE)
-            reinsertQueue.push_back(drawable);
+            AddDrawableToQueue(drawable, reinsertQueue, threadIndex_ + 1);
         else
+        {
+            // Stays in the same octant, but bounds or flags may have changed
+            oldOctant->cullingData.Set(drawable->octantIndex, drawable);
+            oldOctant->MarkCullingBoxDirty();
             drawable->SetFlag(DF_OCTREE_REINSERT_QUEUED, false);
+        }
     }
-
-    numPendingReinsertionTasks.fetch_add(-1);
 }
@@ -7,15 +7,19 @@
 #include "OctreeNode.h"
 
 #include <atomic>
+#include <cassert>
+#include <cstring>
 
 static const size_t NUM_OCTANTS = 8;
-static const unsigned char OF_DRAWABLES_SORT_DIRTY = 0x1;
-static const unsigned char OF_CULLING_BOX_DIRTY = 0x2;
+static const unsigned char OF_CULLING_BOX_DIRTY = 0x1;
 static const float OCCLUSION_QUERY_INTERVAL = 0.133333f; // About 8 frame stagger at 60fps
+static const size_t CULLING_GROUP_SIZE = 4;
+static const size_t MAX_CULLING_GROUPS = 64;
+static const size_t MAX_QUERY_FRUSTA = 16;
 
 class Ray;
 class WorkQueue;
-struct ReinsertDrawablesTask;
+struct RayPacket;
 
 /// %Octant occlusion query visibility states.
 enum OctantVisibility
@@ -42,6 +46,43 @@ struct RaycastResult
     size_t subObject;
 };
 
+/// Structure for multi-frustum query results.
+struct FrustumQueryResult
+{
+    /// Drawable.
+    Drawable* drawable;
+    /// Bitmask of the frusta the drawable is (partially) inside.
+    unsigned frustumMask;
+};
+
+/// Structure-of-arrays copy of the culling data of an octant's drawables, so that frustum tests need not access the drawables. The arrays are padded to a multiple of the culling group size.
+struct OctantCullingData
+{
+    /// Resize for a drawable count.
+    void Resize(size_t count);
+    /// Copy culling data from a drawable.
+    void Set(size_t index, const Drawable* drawable);
+    /// Copy data from one index to another.
+    void Move(size_t from, size_t to);
+
+    /// Bounding box minimum X coordinates.
+    std::vector<float> minX;
+    /// Bounding box minimum Y coordinates.
+    std::vector<float> minY;
+    /// Bounding box minimum Z coordinates.
+    std::vector<float> minZ;
+    /// Bounding box maximum X coordinates.
+    std::vector<float> maxX;
+    /// Bounding box maximum Y coordinates.
+    std::vector<float> maxY;
+    /// Bounding box maximum Z coordinates.
+    std::vector<float> maxZ;
+    /// Drawable flags.
+    std::vector<unsigned short> flags;
+    /// Layer bitmasks.
+    std::vector<unsigned> layerMasks;
+};
+
 /// %Octree cell, contains up to 8 child octants.
 class Octant
 {
@@ -62,10 +103,14 @@ public:
     /// React to occlusion query result. Push changed visibility to parents or children as necessary. If outside frustum, no operation.
     void OnOcclusionQueryResult(bool visible);
 
-    /// Return the culling box. Update as necessary.
-    const BoundingBox& CullingBox() const;
-    /// Return drawables in this octant.
+    /// Return the culling box. It is refit by the octree after the update, so it can be read from several threads.
+    const BoundingBox& CullingBox() const { return cullingBox; }
+    /// Test a range of drawables against a frustum using the culling data, a group of 4 drawables at a time. Write for each group a bitmask of drawables that are (partially) inside and match the flags and layer mask. Called internally.
+    void TestDrawables(const Frustum& frustum, unsigned char planeMask, unsigned short drawableFlags, unsigned layerMask, size_t start, size_t numGroups, unsigned char* groupMasks) const;
+    /// Return drawables in this octant. Lights are kept first.
     const std::vector<Drawable*>& Drawables() const { return drawables; }
+    /// Return number of lights in the beginning of the drawables.
+    size_t NumLights() const { return numLights; }
     /// Return whether has child octants.
     bool HasChildren() const { return numChildren > 0; }
     /// Return child octant by index.
@@ -78,6 +123,80 @@ public:
     OctantVisibility Visibility() const { return (OctantVisibility)visibility; }
     /// Return whether is pending an occlusion query result.
     bool OcclusionQueryPending() const { return occlusionQueryId != 0; }
+
+    /// Call a function for each drawable that is (partially) inside a frustum and matches the flags and layer mask. Does not access the drawables for the tests.
+    template <class T> void CullDrawables(const Frustum& frustum, unsigned char planeMask, unsigned short drawableFlags, unsigned layerMask, T callback) const
+    {
+        unsigned char groupMasks[MAX_CULLING_GROUPS];
+        size_t numDrawables = drawables.size();
+
+        for (size_t start = 0; start < numDrawables; start += MAX_CULLING_GROUPS * CULLING_GROUP_SIZE)
+        {
+            size_t numGroups = Min((numDrawables - start + CULLING_GROUP_SIZE - 1) / CULLING_GROUP_SIZE, MAX_CULLING_GROUPS);
+            TestDrawables(frustum, planeMask, drawableFlags, layerMask, start, numGroups, groupMasks);
+
+            for (size_t i = 0; i < numGroups; ++i)
+            {
+                unsigned char mask = groupMasks[i];
+                for (size_t j = 0; mask; ++j, mask >>= 1)
+                {
+                    if (mask & 1)
+                        callback(drawables[start + i * CULLING_GROUP_SIZE + j]);
+                }
+            }
+        }
+    }
+    /// Call a function for each drawable that is (partially) inside any of the frusta selected by a bitmask and matches the flags and layer mask. The function also receives the bitmask of frusta the drawable is inside. Does not access the drawables for the tests.
+    template <class T> void CullDrawables(const Frustum* frusta, const unsigned char* planeMasks, unsigned frustumMask, unsigned short drawableFlags, unsigned layerMask, T callback) const
+    {
+        // Deeper in the hierarchy often only one frustum remains, in which case the masks need not be combined
+        if (!(frustumMask & (frustumMask - 1)))
+        {
+            size_t index = 0;
+            while (!(frustumMask & (1 << index)))
+                ++index;
+
+            CullDrawables(frusta[index], planeMasks[index], drawableFlags, layerMask, [frustumMask, &callback](Drawable* drawable)
+            {
+                callback(drawable, frustumMask);
+            });
+            return;
+        }
+
+        unsigned char groupMasks[MAX_CULLING_GROUPS];
+        unsigned drawableMasks[MAX_CULLING_GROUPS * CULLING_GROUP_SIZE];
+        size_t numDrawables = drawables.size();
+
+        for (size_t start = 0; start < numDrawables; start += MAX_CULLING_GROUPS * CULLING_GROUP_SIZE)
+        {
+            size_t numGroups = Min((numDrawables - start + CULLING_GROUP_SIZE - 1) / CULLING_GROUP_SIZE, MAX_CULLING_GROUPS);
+            memset(drawableMasks, 0, numGroups * CULLING_GROUP_SIZE * sizeof(unsigned));
+
+            for (size_t i = 0; i < MAX_QUERY_FRUSTA && (frustumMask >> i); ++i)
+            {
+                if (!(frustumMask & (1 << i)))
+                    continue;
+
+                TestDrawables(frusta[i], planeMasks[i], drawableFlags, layerMask, start, numGroups, groupMasks);
+
+                for (size_t j = 0; j < numGroups; ++j)
+                {
+                    unsigned char mask = groupMasks[j];
+                    for (size_t k = 0; mask; ++k, mask >>= 1)
+                    {
+                        if (mask & 1)
+                            drawableMasks[j * CULLING_GROUP_SIZE + k] |= 1 << i;
+                    }
+                }
+            }
+
+            for (size_t i = 0; i < numGroups * CULLING_GROUP_SIZE; ++i)
+            {
+                if (drawableMasks[i])
+                    callback(drawables[start + i], drawableMasks[i]);
+            }
+        }
+    }
     /// Set bit flag. Called internally.
     void SetFlag(unsigned char bit, bool set) const { if (set) flags |= bit; else flags &= ~bit; }
     /// Test bit flag. Called internally.
@@ -159,10 +278,17 @@ public:
     }
 
 private:
+    /// Recalculate the culling box from the drawables' culling data and the child octants. Recurse into dirty child octants first.
+    void RefitCullingBox();
+
     /// Combined drawable and child octant bounding box. Used for culling tests.
-    mutable BoundingBox cullingBox;
+    BoundingBox cullingBox;
     /// Drawables contained in the octant.
     std::vector<Drawable*> drawables;
+    /// Culling data of the drawables.
+    OctantCullingData cullingData;
+    /// Number of lights in the beginning of the drawables.
+    size_t numLights;
     /// Expanded (loose) bounding box used for fitting drawables within the octant.
     BoundingBox fittingBox;
     /// Bounding box center.
@@ -211,6 +337,8 @@ public:
     void Resize(const BoundingBox& boundingBox, int numLevels);
     /// Enable or disable threaded update mode. In threaded mode reinsertions go to per-thread queues, which are processed in FinishUpdate().
     void SetThreadedUpdate(bool enable) { threadedUpdate = enable; }
+    /// Refit dirty octant culling boxes bottom-up, using worker threads for the root level branches. Called by FinishUpdate(). Call manually from the main thread before querying if drawables were added or removed outside the update.
+    void RefitCullingBoxes();
     /// Queue octree reinsertion for a drawable.
     void QueueUpdate(Drawable* drawable);
     /// Remove a drawable from the octree.
@@ -222,15 +350,28 @@ public:
     void Raycast(std::vector<RaycastResult>& result, const Ray& ray, unsigned short nodeFlags, float maxDistance = M_INFINITY, unsigned layerMask = LAYERMASK_ALL) const;
     /// Query for drawables with a raycast and return the closest result.
     RaycastResult RaycastSingle(const Ray& ray, unsigned short drawableFlags, float maxDistance = M_INFINITY, unsigned layerMask = LAYERMASK_ALL) const;
-    /// Query for drawables using a volume such as frustum or sphere.
-    template <class T> void FindDrawables(std::vector<Drawable*>& result, const T& volume, unsigned short drawableFlags, unsigned layerMask = LAYERMASK_ALL) const { CollectDrawables(result, const_cast<Octant*>(&root), volume, drawableFlags, layerMask); }
+    /// Query for drawables with many raycasts and write the closest result of each ray to the result array. The rays are traversed in packets of 4 on worker threads, so consecutive rays should be coherent for best performance. Drawables' OnRaycast() is called from the worker threads. Requires up to date culling boxes, see RefitCullingBoxes(). Can be called from the main thread or from within a work function, also concurrently.
+    void RaycastBatch(const Ray* rays, size_t count, RaycastResult* results, unsigned short drawableFlags, float maxDistance = M_INFINITY, unsigned layerMask = LAYERMASK_ALL) const;
+    /// Query for drawables using a volume such as frustum or sphere. The result can be a std::vector or an ArenaVector.
+    template <class V, class T> void FindDrawables(V& result, const T& volume, unsigned short drawableFlags, unsigned layerMask = LAYERMASK_ALL) const { CheckCullingBoxes(); CollectDrawables(result, const_cast<Octant*>(&root), volume, drawableFlags, layerMask); }
     /// Query for drawables using a frustum and masked testing.
     void FindDrawablesMasked(std::vector<Drawable*>& result, const Frustum& frustum, unsigned short drawableFlags, unsigned layerMask = LAYERMASK_ALL) const;
+    /// Query for drawables using a frustum and masked testing into frame arena memory.
+    void FindDrawablesMasked(ArenaVector<Drawable*>& result, const Frustum& frustum, unsigned short drawableFlags, unsigned layerMask = LAYERMASK_ALL) const;
+    /// Query for drawables using several frusta in one traversal and masked testing, for example the faces of a point light shadow. Each result includes a bitmask of the frusta the drawable is inside. Up to 16 frusta are supported.
+    void FindDrawablesMasked(std::vector<FrustumQueryResult>& result, const Frustum* frusta, size_t numFrusta, unsigned short drawableFlags, unsigned layerMask = LAYERMASK_ALL) const;
+    /// Query for drawables using several frusta in one traversal and masked testing into frame arena memory.
+    void FindDrawablesMasked(ArenaVector<FrustumQueryResult>& result, const Frustum* frusta, size_t numFrusta, unsigned short drawableFlags, unsigned layerMask = LAYERMASK_ALL) const;
     /// Return whether threaded update is enabled.
     bool ThreadedUpdate() const { return threadedUpdate; }
     /// Return the root octant.
     Octant* Root() const { return const_cast<Octant*>(&root); }
 
+    /// Mark static drawables changed, which invalidates cached rendering data such as static batches. Called automatically when static drawables are inserted, moved or removed, and by scene nodes when their static drawables' geometries or materials change.
+    static void MarkStaticContentChanged() { staticContentVersion.fetch_add(1); }
+    /// Return a counter that changes whenever static drawables change in any octree.
+    static unsigned StaticContentVersion() { return staticContentVersion.load(); }
+
 private:
     /// Set bounding box. Used in serialization.
     void SetBoundingBoxAttr(const BoundingBox& value);
@@ -242,47 +383,85 @@ private:
     int NumLevelsAttr() const;
     /// Process a list of drawables to be reinserted. Clear the list afterward.
     void ReinsertDrawables(std::vector<Drawable*>& drawables);
-    /// Remove a drawable from a reinsert queue.
-    void RemoveDrawableFromQueue(Drawable* drawable, std::vector<Drawable*>& drawables);
-    
-    /// Add drawable to a specific octant.
+    /// Check that the culling boxes have been refitted since the last change. Queries only read the culling boxes so that they can run concurrently.
+    void CheckCullingBoxes() const { assert(!root.TestFlag(OF_CULLING_BOX_DIRTY)); }
+    /// Add a drawable to a reinsert queue and store its position. The queue index is 0 for the main update queue, or thread index + 1 for the threaded queues.
+    void AddDrawableToQueue(Drawable* drawable, std::vector<Drawable*>& drawables, unsigned queue)
+    {
+        drawable->queueIndex = (unsigned)drawables.size();
+        drawable->queue = (unsigned short)queue;
+        drawables.push_back(drawable);
+    }
+
+    /// Remove a drawable from the reinsert queue it is in. The slot is cleared instead of erasing so that threaded processing ranges stay valid.
+    void RemoveDrawableFromQueue(Drawable* drawable)
+    {
+        std::vector<Drawable*>& drawables = drawable->queue ? reinsertQueues[drawable->queue - 1] : updateQueue;
+        if (drawable->queueIndex < drawables.size() && drawables[drawable->queueIndex] == drawable)
+            drawables[drawable->queueIndex] = nullptr;
+    }
+
+    /// Move a drawable within an octant, overwriting the destination.
+    void MoveDrawable(Octant* octant, size_t from, size_t to)
+    {
+        Drawable* drawable = octant->drawables[from];
+        octant->drawables[to] = drawable;
+        octant->cullingData.Move(from, to);
+        drawable->octantIndex = (unsigned)to;
+    }
+
+    /// Add drawable to a specific octant. Lights are kept in the beginning of the drawables by moving the first non-light to the end.
     void AddDrawable(Drawable* drawable, Octant* octant)
     {
+        size_t index = octant->drawables.size();
         octant->drawables.push_back(drawable);
-        octant->MarkCullingBoxDirty();
-        drawable->octant = octant;
+        octant->cullingData.Resize(octant->drawables.size());
 
-        if (!octant->TestFlag(OF_DRAWABLES_SORT_DIRTY))
+        if (drawable->TestFlag(DF_LIGHT))
         {
-            octant->SetFlag(OF_DRAWABLES_SORT_DIRTY, true);
-            sortDirtyOctants.push_back(octant);
+            if (octant->numLights != index)
+                MoveDrawable(octant, octant->numLights, index);
+            index = octant->numLights++;
         }
+
+        drawable->octant = octant;
+        drawable->octantIndex = (unsigned)index;
+        octant->drawables[index] = drawable;
+        octant->cullingData.Set(index, drawable);
+        octant->MarkCullingBoxDirty();
     }
 
-    /// Remove drawable from an octant.
-    void RemoveDrawable(Drawable* drawable, Octant* octant)
+    /// Remove drawable from an octant by its index. Fill the hole by moving the last light and the last drawable.
+    void RemoveDrawable(Octant* octant, size_t index)
     {
         if (!octant)
             return;
 
+        assert(index < octant->drawables.size());
+
         octant->MarkCullingBoxDirty();
 
         // Do not set the drawable's octant pointer to zero, as the drawable may already be added into another octant. Just remove from octant
-        for (auto it = octant->drawables.begin(); it != octant->drawables.end(); ++it)
+        if (index < octant->numLights)
         {
-            if ((*it) == drawable)
-            {
-                octant->drawables.erase(it);
+            size_t lastLightIndex = --octant->numLights;
+            if (index != lastLightIndex)
+                MoveDrawable(octant, lastLightIndex, index);
+            index = lastLightIndex;
+        }
 
-                // Erase empty octants as necessary, but never the root
-                while (!octant->drawables.size() && !octant->numChildren && octant->parent)
-                {
-                    Octant* parentOctant = octant->parent;
-                    DeleteChildOctant(parentOctant, octant->childIndex);
-                    octant = parentOctant;
-                }
-                return;
-            }
+        size_t lastIndex = octant->drawables.size() - 1;
+        if (index != lastIndex)
+            MoveDrawable(octant, lastIndex, index);
+        octant->drawables.pop_back();
+        octant->cullingData.Resize(lastIndex);
+
+        // Erase empty octants as necessary, but never the root
+        while (!octant->drawables.size() && !octant->numChildren && octant->parent)
+        {
+            Octant* parentOctant = octant->parent;
+            DeleteChildOctant(parentOctant, octant->childIndex);
+            octant = parentOctant;
         }
     }
 
@@ -294,17 +473,39 @@ private:
     void DeleteChildOctants(Octant* octant, bool deletingOctree);
     /// Return all drawables from an octant recursively.
     void CollectDrawables(std::vector<Drawable*>& result, Octant* octant) const;
-    /// Return all drawables matching flags from an octant recursively.
-    void CollectDrawables(std::vector<Drawable*>& result, Octant* octant, unsigned short drawableFlags, unsigned layerMask) const;
     /// Return all drawables matching flags along a ray.
     void CollectDrawables(std::vector<RaycastResult>& result, Octant* octant, const Ray& ray, unsigned short drawableFlags, float maxDistance, unsigned layerMask) const;
     /// Return all visible drawables matching flags that could be potential raycast hits.
     void CollectDrawables(std::vector<std::pair<Drawable*, float> >& result, Octant* octant, const Ray& ray, unsigned short drawableFlags, float maxDistance, unsigned layerMask) const;
-    /// Work function to check reinsertion of nodes.
-    void CheckReinsertWork(Task* task, unsigned threadIndex);
+    /// Traverse octants with a ray packet and update the closest results of its rays.
+    void RaycastPacket(RayPacket& packet, Octant* octant, unsigned short drawableFlags, unsigned layerMask, std::vector<RaycastResult>& hits) const;
+    /// Work function to check reinsertion of nodes within a range of the update queue.
+    void CheckReinsertWork(size_t begin, size_t end, unsigned threadIndex);
+
+    /// Return all drawables matching flags from an octant recursively.
+    template <class V> void CollectDrawables(V& result, Octant* octant, unsigned short drawableFlags, unsigned layerMask) const
+    {
+        std::vector<Drawable*>& drawables = octant->drawables;
+
+        for (auto it = drawables.begin(); it != drawables.end(); ++it)
+        {
+            Drawable* drawable = *it;
+            if ((drawable->Flags() & drawableFlags) == drawableFlags && (drawable->LayerMask() & layerMask))
+                result.push_back(drawable);
+        }
+
+        if (octant->numChildren)
+        {
+            for (size_t i = 0; i < NUM_OCTANTS; ++i)
+            {
+                if (octant->children[i])
+                    CollectDrawables(result, octant->children[i], drawableFlags, layerMask);
+            }
+        }
+    }
 
     /// Collect nodes matching flags using a volume such as frustum or sphere.
-    template <class T> void CollectDrawables(std::vector<Drawable*>& result, Octant* octant, const T& volume, unsigned short drawableFlags, unsigned layerMask) const
+    template <class V, class T> void CollectDrawables(V& result, Octant* octant, const T& volume, unsigned short drawableFlags, unsigned layerMask) const
     {
         Intersection res = volume.IsInside(octant->CullingBox());
         if (res == OUTSIDE)
@@ -336,7 +537,7 @@ private:
     }
 
     /// Collect nodes using a frustum and masked testing.
-    void CollectDrawablesMasked(std::vector<Drawable*>& result, Octant* octant, const Frustum& frustum, unsigned short drawableFlags, unsigned layerMask, unsigned char planeMask = 0x3f) const
+    template <class V> void CollectDrawablesMasked(V& result, Octant* octant, const Frustum& frustum, unsigned short drawableFlags, unsigned layerMask, unsigned char planeMask = 0x3f) const
     {
         if (planeMask)
         {
@@ -346,14 +547,10 @@ private:
                 return;
         }
 
-        std::vector<Drawable*>& drawables = octant->drawables;
-     
-        for (auto it = drawables.begin(); it != drawables.end(); ++it)
+        octant->CullDrawables(frustum, planeMask, drawableFlags, layerMask, [&result](Drawable* drawable)
         {
-            Drawable* drawable = *it;
-            if ((drawable->Flags() & drawableFlags) == drawableFlags && (drawable->LayerMask() & layerMask) && (!planeMask || frustum.IsInsideMaskedFast(drawable->WorldBoundingBox(), planeMask) != OUTSIDE))
-                result.push_back(drawable);
-        }
+            result.push_back(drawable);
+        });
 
         if (octant->numChildren)
         {
@@ -365,14 +562,57 @@ private:
         }
     }
 
+    /// Collect nodes using several frusta and masked testing. The plane masks are tracked separately for each frustum, and frusta that are found to be completely outside are dropped from the traversal.
+    template <class V> void CollectDrawablesMasked(V& result, Octant* octant, const Frustum* frusta, const BoundingBox& frustaBox, unsigned frustumMask, const unsigned char* parentPlaneMasks, unsigned short drawableFlags, unsigned layerMask) const
+    {
+        // Reject octants outside the combined bounds of the frusta with one test
+        if (frustaBox.IsInsideFast(octant->CullingBox()) == OUTSIDE)
+            return;
+
+        unsigned char planeMasks[MAX_QUERY_FRUSTA];
+
+        for (size_t i = 0; i < MAX_QUERY_FRUSTA && (frustumMask >> i); ++i)
+        {
+            if (!(frustumMask & (1 << i)))
+                continue;
+
+            planeMasks[i] = parentPlaneMasks[i];
+            if (planeMasks[i])
+            {
+                planeMasks[i] = frusta[i].IsInsideMasked(octant->CullingBox(), planeMasks[i]);
+                if (planeMasks[i] == 0xff)
+                    frustumMask &= ~(1 << i);
+            }
+        }
+
+        // Terminate if octant completely outside all frusta
+        if (!frustumMask)
+            return;
+
+        octant->CullDrawables(frusta, planeMasks, frustumMask, drawableFlags, layerMask, [&result](Drawable* drawable, unsigned mask)
+        {
+            FrustumQueryResult newResult;
+            newResult.drawable = drawable;
+            newResult.frustumMask = mask;
+            result.push_back(newResult);
+        });
+
+        if (octant->numChildren)
+        {
+            for (size_t i = 0; i < NUM_OCTANTS; ++i)
+            {
+                if (octant->children[i])
+                    CollectDrawablesMasked(result, octant->children[i], frusta, frustaBox, frustumMask, planeMasks, drawableFlags, layerMask);
+            }
+        }
+    }
+
     /// Threaded update flag. During threaded update moved drawables should go directly to thread-specific reinsert queues.
     volatile bool threadedUpdate;
     /// Current framenumber.
     unsigned short frameNumber;
     /// Queue of nodes to be reinserted.
     std::vector<Drawable*> updateQueue;
-    /// Octants which need to have their drawables sorted.
-    std::vector<Octant*> sortDirtyOctants;
     /// Extents of the octree root level box.
     BoundingBox worldBoundingBox;
     /// Root octant.
@@ -381,14 +621,17 @@ private:
     Allocator<Octant> allocator;
     /// Cached %WorkQueue subsystem.
     WorkQueue* workQueue;
-    /// Tasks for threaded reinsert execution.
-    std::vector<AutoPtr<ReinsertDrawablesTask> > reinsertTasks;
+    /// Parallel range operation for threaded reinsert execution.
+    ParallelForHandle reinsertJob;
+    /// Parallel range operation for threaded culling box refit.
+    ParallelForHandle refitJob;
     /// Intermediate reinsert queues for threaded execution.
     AutoArrayPtr<std::vector<Drawable*> > reinsertQueues;
     /// RaycastSingle initial coarse result.
     mutable std::vector<std::pair<Drawable*, float> > initialRayResult;
     /// RaycastSingle final result.
     mutable std::vector<RaycastResult> finalRayResult;
-    /// Remaining drawable reinsertion tasks.
-    std::atomic<int> numPendingReinsertionTasks;
+
+    /// Static drawable change counter shared by all octrees, so that a new octree can not be mistaken for an old one.
+    static std::atomic<unsigned> staticContentVersion;
 };
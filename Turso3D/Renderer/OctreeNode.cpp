@@ -15,12 +15,20 @@ OctreeNodeBase::OctreeNodeBase() :
 void OctreeNodeBase::OnLayerChanged(unsigned char newLayer)
 {
     if (drawable)
+    {
         drawable->SetLayer(newLayer);
+        // Queue reinsertion so that the octree's copy of the culling data is updated
+        if (octree && drawable->GetOctant() && !drawable->TestFlag(DF_OCTREE_REINSERT_QUEUED))
+            octree->QueueUpdate(drawable);
+    }
 }
 
 Drawable::Drawable() :
     owner(nullptr),
     octant(nullptr),
+    octantIndex(0),
+    queueIndex(0),
+    queue(0),
     flags(0),
     layer(LAYER_DEFAULT),
     lastFrameNumber(0),
@@ -95,12 +103,14 @@ void OctreeNode::RegisterObject()
     RegisterAttribute("castShadows", &OctreeNode::CastShadows, &OctreeNode::SetCastShadows, false);
     RegisterAttribute("updateInvisible", &OctreeNode::UpdateInvisible, &OctreeNode::SetUpdateInvisible, false);
     RegisterAttribute("maxDistance", &OctreeNode::MaxDistance, &OctreeNode::SetMaxDistance, 0.0f);
+    RegisterAttribute("occluder", &OctreeNode::IsOccluder, &OctreeNode::SetOccluder, false);
 }
 
 void OctreeNode::SetStatic(bool enable)
 {
     if (enable != IsStatic())
     {
+        Octree::MarkStaticContentChanged();
         drawable->SetFlag(DF_STATIC, enable);
         // Reinsert into octree so that cached shadow map invalidation is handled
         OnBoundingBoxChanged();
@@ -127,6 +137,16 @@ void OctreeNode::SetMaxDistance(float distance_)
     drawable->maxDistance = Max(distance_, 0.0f);
 }
 
+void OctreeNode::SetOccluder(bool enable)
+{
+    if (drawable->TestFlag(DF_OCCLUDER) != enable)
+    {
+        drawable->SetFlag(DF_OCCLUDER, enable);
+        // Reinsert into octree so that the octree's copy of the flags is updated
+        OnBoundingBoxChanged();
+    }
+}
+
 void OctreeNode::OnSceneSet(Scene* newScene, Scene*)
 {
     /// Remove from current octree if any
@@ -28,6 +28,7 @@ static const unsigned short DF_OCTREE_UPDATE_CALL = 0x100;
 static const unsigned short DF_WORLD_TRANSFORM_DIRTY = 0x200;
 static const unsigned short DF_BOUNDING_BOX_DIRTY = 0x400;
 static const unsigned short DF_OCTREE_REINSERT_QUEUED = 0x800;
+static const unsigned short DF_OCCLUDER = 0x1000;
 
 /// Common base class for renderable scene objects and occluders.
 class OctreeNodeBase : public SpatialNode
@@ -150,6 +151,12 @@ protected:
     Matrix3x4* worldTransform;
     /// Current octree octant.
     Octant* octant;
+    /// Index in the octant's drawable list.
+    unsigned octantIndex;
+    /// Index in the octree reinsert queue.
+    unsigned queueIndex;
+    /// Octree reinsert queue: 0 for the main update queue, or thread index + 1 for the threaded queues.
+    unsigned short queue;
     /// %Drawable flags. Used to hold several boolean values to reduce memory use.
     mutable unsigned short flags;
     /// Layer number. Copy of the node layer.
@@ -183,6 +190,8 @@ public:
     void SetUpdateInvisible(bool enable);
     /// Set max distance for rendering. 0 is unlimited.
     void SetMaxDistance(float distance);
+    /// Set whether to render into the software occlusion buffer. Only static geometries with CPU-side data can occlude. Default false.
+    void SetOccluder(bool enable);
     
     /// Return drawable's world space bounding box. Update if necessary. 
     const BoundingBox& WorldBoundingBox() const { return drawable->WorldBoundingBox(); }
@@ -192,6 +201,8 @@ public:
     bool CastShadows() const { return drawable->TestFlag(DF_CAST_SHADOWS); }
     /// Return whether updates animation when invisible. Not relevant for non-animating geometry.
     bool UpdateInvisible() const { return drawable->TestFlag(DF_UPDATE_INVISIBLE); }
+    /// Return whether is an occluder.
+    bool IsOccluder() const { return drawable->TestFlag(DF_OCCLUDER); }
     /// Return current octree this node resides in.
     Octree* GetOctree() const { return octree; }
     /// Return the drawable for internal use.
@@ -1,6 +1,7 @@
 // For conditions of distribution and use, seecopyright notice in License.txt
 
 #include "../Graphics/FrameBuffer.h"
+#include "../Graphics/GpuRingBuffer.h"
 #include "../Graphics/Graphics.h"
 #include "../Graphics/IndexBuffer.h"
 #include "../Graphics/RenderBuffer.h"
@@ -30,42 +31,57 @@
 #include <cstring>
 #include <tracy/Tracy.hpp>
 
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define USE_SSE
+#endif
+
 static const size_t DRAWABLES_PER_BATCH_TASK = 128;
 static const size_t NUM_BOX_INDICES = 36;
 static const float OCCLUSION_MARGIN = 0.1f;
+static const size_t MIN_MERGE_RANGE_BATCHES = 1024;
+static const size_t RECORD_COMMANDS_GRAIN_SIZE = 256;
+static const size_t INITIAL_LIGHT_BUFFER_SIZE = 16384;
+static const size_t LIGHT_DATA_TEXELS = sizeof(LightData) / sizeof(Vector4);
 
 static inline bool CompareDrawableDistances(Drawable* lhs, Drawable* rhs)
 {
     return lhs->Distance() < rhs->Distance();
 }
 
-/// %Task for collecting octants.
-struct CollectOctantsTask : public MemberFunctionTask<Renderer>
+static inline bool CompareSortKeyValues(const BatchSortKey& lhs, const BatchSortKey& rhs)
 {
-    /// Construct.
-    CollectOctantsTask(Renderer* object_, MemberWorkFunctionPtr function_) :
-        MemberFunctionTask<Renderer>(object_, function_)
+    return lhs.key < rhs.key;
+}
+
+/// Return the view distance of a light cluster Z-slice boundary, given as a fraction of the slice count.
+static inline float ClusterSliceDistance(ClusterSlicing slicing, float fraction, float nearClip, float farClip)
+{
+    switch (slicing)
     {
-    }
+    case CLUSTER_SLICE_LINEAR:
+        return fraction * farClip;
 
-    /// Starting point octant.
-    Octant* startOctant;
-    /// Result structure index.
-    size_t resultIdx;
-};
+    case CLUSTER_SLICE_EXPONENTIAL:
+        return nearClip * powf(farClip / nearClip, fraction);
+
+    default:
+        return fraction * fraction * farClip;
+    }
+}
 
-/// %Task for collecting geometry batches from octants.
-struct CollectBatchesTask : public MemberFunctionTask<Renderer>
+/// Upload data to a buffer texture's storage. Grow the storage and redefine the texture if the data does not fit.
+static void SetBufferTextureData(UniformBuffer* buffer, Texture* texture, ImageFormat format, size_t numBytes, const void* data)
 {
-    /// Construct.
-    CollectBatchesTask(Renderer* object_, MemberWorkFunctionPtr function_) :
-        MemberFunctionTask<Renderer>(object_, function_)
+    if (numBytes > buffer->Size())
     {
+        buffer->Define(USAGE_DYNAMIC, NextPowerOfTwo((unsigned)numBytes));
+        texture->DefineBuffer(buffer->GLBuffer(), format);
     }
 
-    /// %Octant list with plane masks.
-    std::vector<std::pair<Octant*, unsigned char > > octants;
-};
+    // Discard, so that the driver does not need to wait for the previous frame's draws to stop reading the buffer
+    buffer->SetData(0, numBytes, data, true);
+}
 
 /// %Task for collecting shadowcasters of a specific light.
 struct CollectShadowCastersTask : public MemberFunctionTask<Renderer>
@@ -95,24 +111,9 @@ struct CollectShadowBatchesTask : public MemberFunctionTask<Renderer>
     size_t viewIdx;
 };
 
-/// %Task for culling lights to a specific Z-slice of the frustum grid.
-struct CullLightsTask : public MemberFunctionTask<Renderer>
-{
-    /// Construct.
-    CullLightsTask(Renderer* object_, MemberWorkFunctionPtr function_) :
-        MemberFunctionTask<Renderer>(object_, function_)
-    {
-    }
-
-    /// Z-slice.
-    size_t z;
-};
-
 void ThreadOctantResult::Clear()
 {
     drawableAcc = 0;
-    taskOctantIdx = 0;
-    batchTaskIdx = 0;
     lights.clear();
     octants.clear();
     occlusionQueries.clear();
@@ -125,9 +126,14 @@ void ThreadBatchResult::Clear()
     geometryBounds.Undefine();
     opaqueBatches.clear();
     alphaBatches.clear();
+    staticBatches.clear();
+    opaqueKeys = ArenaSpan<BatchSortKey>();
+    alphaKeys = ArenaSpan<BatchSortKey>();
 }
 
-ShadowMap::ShadowMap()
+ShadowMap::ShadowMap() :
+    instanceDataOffset(0),
+    instanceDataInRing(false)
 {
     // Construct texture but do not define its size yet
     texture = Object::Create<Texture>();
@@ -145,6 +151,8 @@ void ShadowMap::Clear()
     allocator.Reset(texture->Width(), texture->Height(), 0, 0, false);
     shadowViews.clear();
     instanceTransforms.clear();
+    instanceDrawables.clear();
+    instanceDataInRing = false;
 
     for (auto it = shadowBatches.begin(); it != shadowBatches.end(); ++it)
         it->Clear();
@@ -152,13 +160,108 @@ void ShadowMap::Clear()
         it->clear();
 }
 
+StaticBatchCache::StaticBatchCache() :
+    valid(false),
+    camera(nullptr),
+    viewMask(0),
+    staticContentVersion(0),
+    useOcclusion(false),
+    softwareOcclusion(false)
+{
+}
+
+StaticBatchCache::~StaticBatchCache()
+{
+}
+
+RenderStats::RenderStats()
+{
+    Reset();
+}
+
+void RenderStats::Reset()
+{
+    batches = 0;
+    drawCalls = 0;
+    programChanges = 0;
+    materialChanges = 0;
+    renderStateChanges = 0;
+    geometryChanges = 0;
+}
+
+void BoundingBoxArray::Resize(size_t count)
+{
+    // Empty boxes fail the intersection test, as the distance to them is infinite
+    count = (count + 3) & ~(size_t)3;
+    minX.assign(count, M_INFINITY);
+    minY.assign(count, M_INFINITY);
+    minZ.assign(count, M_INFINITY);
+    maxX.assign(count, -M_INFINITY);
+    maxY.assign(count, -M_INFINITY);
+    maxZ.assign(count, -M_INFINITY);
+}
+
+void BoundingBoxArray::Set(size_t index, const BoundingBox& box)
+{
+    minX[index] = box.min.x;
+    minY[index] = box.min.y;
+    minZ[index] = box.min.z;
+    maxX[index] = box.max.x;
+    maxY[index] = box.max.y;
+    maxZ[index] = box.max.z;
+}
+
+unsigned BoundingBoxArray::IsInsideFast4(const Sphere& sphere, size_t index) const
+{
+    // Distance from the sphere center to each box along each axis, zero if inside the box's extent
+#ifdef USE_SSE
+    __m128 zero = _mm_setzero_ps();
+    __m128 cx = _mm_set1_ps(sphere.center.x);
+    __m128 cy = _mm_set1_ps(sphere.center.y);
+    __m128 cz = _mm_set1_ps(sphere.center.z);
+    __m128 dx = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minX[index]), cx), _mm_sub_ps(cx, _mm_loadu_ps(&maxX[index]))), zero);
+    __m128 dy = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minY[index]), cy), _mm_sub_ps(cy, _mm_loadu_ps(&maxY[index]))), zero);
+    __m128 dz = _mm_max_ps(_mm_max_ps(_mm_sub_ps(_mm_loadu_ps(&minZ[index]), cz), _mm_sub_ps(cz, _mm_loadu_ps(&maxZ[index]))), zero);
+    __m128 distSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+    return (unsigned)_mm_movemask_ps(_mm_cmplt_ps(distSquared, _mm_set1_ps(sphere.radius * sphere.radius)));
+#else
+    unsigned mask = 0;
+    float radiusSquared = sphere.radius * sphere.radius;
+
+    for (size_t i = 0; i < 4; ++i)
+    {
+        float dx = Max(Max(minX[index + i] - sphere.center.x, sphere.center.x - maxX[index + i]), 0.0f);
+        float dy = Max(Max(minY[index + i] - sphere.center.y, sphere.center.y - maxY[index + i]), 0.0f);
+        float dz = Max(Max(minZ[index + i] - sphere.center.z, sphere.center.z - maxZ[index + i]), 0.0f);
+        if (dx * dx + dy * dy + dz * dz < radiusSquared)
+            mask |= 1 << i;
+    }
+
+    return mask;
+#endif
+}
+
 Renderer::Renderer() :
     graphics(Subsystem<Graphics>()),
     workQueue(Subsystem<WorkQueue>()),
     frameNumber(0),
+    softwareOcclusion(false),
+    occlusionBufferValid(false),
+    separateStaticBatches(false),
+    reuseStaticBatches(false),
     clusterFrustumsDirty(true),
+    instanceDataInRing(false),
+    perViewDataInRing(false),
     depthBiasMul(1.0f),
-    slopeScaleBiasMul(1.0f)
+    slopeScaleBiasMul(1.0f),
+    clusterGridSize(IntVector3::ZERO),
+    clusterSlicing(CLUSTER_SLICE_QUADRATIC),
+    lightDataDirty(false),
+    perViewDataOffset(0),
+    instanceDataOffset(0),
+    occlusionBufferWidth(DEFAULT_OCCLUSION_BUFFER_WIDTH),
+    numPrecompileVariations(0),
+    numPrecompileCompiled(0)
 {
     assert(graphics && graphics->IsInitialized());
     assert(workQueue);
@@ -166,6 +269,8 @@ Renderer::Renderer() :
     RegisterSubsystem(this);
     RegisterRendererLibrary();
 
+    numMergeRanges[0] = numMergeRanges[1] = 1;
+
     hasInstancing = graphics->HasInstancing();
     if (hasInstancing)
     {
@@ -176,38 +281,62 @@ Renderer::Renderer() :
     }
 
     clusterTexture = new Texture();
-    clusterTexture->Define(TEX_3D, IntVector3(NUM_CLUSTER_X, NUM_CLUSTER_Y, NUM_CLUSTER_Z), FMT_RGBA32U, 1);
-    clusterTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
-
-    clusterCullData = new ClusterCullData[NUM_CLUSTER_X * NUM_CLUSTER_Y * NUM_CLUSTER_Z];
-    clusterData = new unsigned char[MAX_LIGHTS_CLUSTER * NUM_CLUSTER_X * NUM_CLUSTER_Y * NUM_CLUSTER_Z];
-    lightData = new LightData[MAX_LIGHTS + 1];
-    memset(lightData, 0, (MAX_LIGHTS + 1) * sizeof(LightData));
+    SetClusterGrid(IntVector3(DEFAULT_CLUSTER_X, DEFAULT_CLUSTER_Y, DEFAULT_CLUSTER_Z));
 
     perViewDataBuffer = new UniformBuffer();
     perViewDataBuffer->Define(USAGE_DYNAMIC, sizeof(PerViewUniforms));
 
+    objectDataBuffer = new UniformBuffer();
+    objectDataBuffer->Define(USAGE_DYNAMIC, sizeof(Matrix3x4));
+
+    // Light data and the cluster light index list are read from buffer textures, which grow as needed, so the amount of lights is only limited by the buffer texture size
+    maxBufferTexels = Texture::MaxBufferTexels();
+
     lightDataBuffer = new UniformBuffer();
-    lightDataBuffer->Define(USAGE_DYNAMIC, MAX_LIGHTS * sizeof(LightData));
+    lightDataBuffer->Define(USAGE_DYNAMIC, INITIAL_LIGHT_BUFFER_SIZE);
+    lightDataTexture = new Texture();
+    lightDataTexture->DefineBuffer(lightDataBuffer->GLBuffer(), FMT_RGBA32F);
+
+    lightIndexBuffer = new UniformBuffer();
+    lightIndexBuffer->Define(USAGE_DYNAMIC, INITIAL_LIGHT_BUFFER_SIZE);
+    lightIndexTexture = new Texture();
+    lightIndexTexture->DefineBuffer(lightIndexBuffer->GLBuffer(), FMT_R32U);
 
     octantResults = new ThreadOctantResult[NUM_OCTANT_TASKS];
     batchResults = new ThreadBatchResult[workQueue->NumThreads()];
-
-    for (size_t i = 0; i < NUM_OCTANTS + 1; ++i)
+    for (unsigned i = 0; i < workQueue->NumThreads(); ++i)
     {
-        collectOctantsTasks[i] = new CollectOctantsTask(this, &Renderer::CollectOctantsWork);
-        collectOctantsTasks[i]->resultIdx = i;
+        batchResults[i].opaqueBatches.SetArena(workQueue->ThreadArena(i));
+        batchResults[i].alphaBatches.SetArena(workQueue->ThreadArena(i));
+        batchResults[i].staticBatches.SetArena(workQueue->ThreadArena(i));
     }
 
-    for (size_t z = 0; z < NUM_CLUSTER_Z; ++z)
-    {
-        cullLightsTasks[z] = new CullLightsTask(this, &Renderer::CullLightsToFrustumWork);
-        cullLightsTasks[z]->z = z;
-    }
+    occluderTriangles = new ArenaVector<OcclusionTriangle>[workQueue->NumThreads()];
+    occluderTriangleSpans = new ArenaSpan<OcclusionTriangle>[workQueue->NumThreads()];
+    for (unsigned i = 0; i < workQueue->NumThreads(); ++i)
+        occluderTriangles[i].SetArena(workQueue->ThreadArena(i));
+    occluders.SetArena(workQueue->ThreadArena(0));
+
+    // Octant and main view batch collection are on the critical path to sorting the main batches, so execute them before shadow and light cluster work
+    collectOctantsJob.SetPriority(TP_HIGH);
+    for (size_t i = 0; i < NUM_OCTANT_TASKS; ++i)
+        octantResults[i].collectBatchesJob.SetPriority(TP_HIGH);
 
     processLightsTask = new MemberFunctionTask<Renderer>(this, &Renderer::ProcessLightsWork);
     batchesReadyTask = new MemberFunctionTask<Renderer>(this, &Renderer::BatchesReadyWork);
     processShadowCastersTask = new MemberFunctionTask<Renderer>(this, &Renderer::ProcessShadowCastersWork);
+    processClustersTask = new MemberFunctionTask<Renderer>(this, &Renderer::ProcessClustersWork);
+
+    // Record the fixed part of the view preparation task graph. Light processing and the batches ready signal are queued manually when their inputs are ready
+    // Shadowcaster and light cluster processing need the lights, and accurate scene min / max Z and geometry bounds
+    frameGraph.AddTask(processLightsTask, false);
+    frameGraph.AddTask(batchesReadyTask, false);
+    frameGraph.AddTask(processShadowCastersTask);
+    frameGraph.AddTask(processClustersTask);
+    frameGraph.AddDependency(processShadowCastersTask, processLightsTask);
+    frameGraph.AddDependency(processShadowCastersTask, batchesReadyTask);
+    frameGraph.AddDependency(processClustersTask, processLightsTask);
+    frameGraph.AddDependency(processClustersTask, batchesReadyTask);
 
     DefineBoundingBoxGeometry();
 }
@@ -244,6 +373,39 @@ void Renderer::SetupShadowMaps(int dirLightSize, int lightAtlasSize, ImageFormat
     shadowMapsDirty = true;
 }
 
+void Renderer::SetClusterGrid(const IntVector3& size, ClusterSlicing slicing)
+{
+    IntVector3 newSize(Clamp(size.x, 1, MAX_CLUSTER_GRID_SIZE), Clamp(size.y, 1, MAX_CLUSTER_GRID_SIZE), Clamp(size.z, 1, MAX_CLUSTER_GRID_SIZE));
+    if (newSize == clusterGridSize && slicing == clusterSlicing)
+        return;
+
+    clusterSlicing = slicing;
+    clusterFrustumsDirty = true;
+
+    if (newSize != clusterGridSize)
+    {
+        clusterGridSize = newSize;
+        size_t numClusters = clusterGridSize.x * clusterGridSize.y * clusterGridSize.z;
+
+        clusterTexture->Define(TEX_3D, clusterGridSize, FMT_RG32U, 1);
+        clusterTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+
+        clusterCullData = new ClusterCullData[numClusters];
+        clusterData = new unsigned[2 * numClusters];
+        memset(clusterData, 0, 2 * numClusters * sizeof(unsigned));
+
+        clusterSliceBounds.resize(clusterGridSize.z);
+        sliceLights.resize(clusterGridSize.z);
+        sliceLightHits.resize(clusterGridSize.z);
+        sliceLightIndices.resize(clusterGridSize.z);
+        for (size_t z = 0; z < sliceLightIndices.size(); ++z)
+            sliceLightIndices[z].clear();
+
+        // Upload the cleared cluster data in case the grid is changed between preparing and rendering a view
+        lightDataDirty = true;
+    }
+}
+
 void Renderer::SetShadowDepthBiasMul(float depthBiasMul_, float slopeScaleBiasMul_)
 {
     depthBiasMul = depthBiasMul_;
@@ -253,6 +415,102 @@ void Renderer::SetShadowDepthBiasMul(float depthBiasMul_, float slopeScaleBiasMu
     shadowMapsDirty = true;
 }
 
+void Renderer::SetSoftwareOcclusion(bool enable, int bufferWidth)
+{
+    softwareOcclusion = enable;
+    occlusionBufferWidth = Max(bufferWidth, OCCLUSION_BLOCK_SIZE);
+
+    if (softwareOcclusion && !occlusionBuffer)
+        occlusionBuffer = new OcclusionBuffer();
+}
+
+size_t Renderer::BeginPrecompileShaders()
+{
+    ZoneScoped;
+
+    precompileTimer.Reset();
+    precompilePrograms.clear();
+    numPrecompileVariations = 0;
+    numPrecompileCompiled = 0;
+
+    std::set<ShaderProgram*> variations;
+    // Make sure the default material exists, as drawables without a material use it
+    Material::DefaultMaterial();
+    const std::set<Material*>& materials = Material::AllMaterials();
+
+    for (auto it = materials.begin(); it != materials.end(); ++it)
+    {
+        for (size_t i = 0; i < MAX_PASS_TYPES; ++i)
+        {
+            Pass* pass = (*it)->GetPass((PassType)i);
+            if (!pass)
+                continue;
+
+            for (unsigned char j = 0; j < MAX_SHADER_VARIATIONS; ++j)
+            {
+                // Instanced variations are never used without instancing support
+                if ((j == SP_INSTANCED || j == SP_SKINNED_INSTANCED) && !hasInstancing)
+                    continue;
+
+                bool cached = pass->CachedShaderProgram(j) != nullptr;
+                ShaderProgram* program = pass->GetShaderProgram(j, true);
+                if (!program || !variations.insert(program).second)
+                    continue;
+
+                if (program->IsPending())
+                {
+                    precompilePrograms.push_back(SharedPtr<ShaderProgram>(program));
+                    ++numPrecompileCompiled;
+                }
+                else if (!cached)
+                    ++numPrecompileCompiled;
+            }
+        }
+    }
+
+    numPrecompileVariations = variations.size();
+    return numPrecompileVariations;
+}
+
+bool Renderer::UpdatePrecompileShaders()
+{
+    ZoneScoped;
+
+    if (precompilePrograms.empty() && !numPrecompileVariations)
+        return true;
+
+    for (auto it = precompilePrograms.begin(); it != precompilePrograms.end();)
+    {
+        if ((*it)->IsCompleted())
+        {
+            (*it)->Finish();
+            it = precompilePrograms.erase(it);
+        }
+        else
+            ++it;
+    }
+
+    if (!precompilePrograms.empty())
+        return false;
+
+    LOGINFOF("Precompiled %d shader variations, %d new, in %.2f ms", (int)numPrecompileVariations, (int)numPrecompileCompiled, precompileTimer.ElapsedUSec() / 1000.0f);
+    numPrecompileVariations = 0;
+    return true;
+}
+
+size_t Renderer::PrecompileShaders()
+{
+    size_t numVariations = BeginPrecompileShaders();
+
+    // Each finish blocks only until that program is done, while the driver keeps compiling the rest
+    for (auto it = precompilePrograms.begin(); it != precompilePrograms.end(); ++it)
+        (*it)->Finish();
+
+    UpdatePrecompileShaders();
+
+    return numVariations;
+}
+
 void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows_, bool useOcclusion_)
 {
     ZoneScoped;
@@ -285,6 +543,10 @@ void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows_, bo
     alphaBatches.Clear();
     lights.clear();
     instanceTransforms.clear();
+    instanceDrawables.clear();
+    instanceDataInRing = false;
+    occlusionBufferValid = false;
+    renderStats.Reset();
     
     minZ = M_MAX_FLOAT;
     maxZ = 0.0f;
@@ -293,10 +555,20 @@ void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows_, bo
     // Stagger for occlusion queries based on last frametime
     lastFrameTime = graphics->LastFrameTime();
 
+    // Per-frame intermediate results live in the thread frame arenas. No tasks are executing at this point, so they can be reset
+    workQueue->ResetFrameArenas();
+
+    // Render commands refer to the materials' OpenGL objects, which must be resolved before recording
+    Material::UpdateStates();
+
     for (size_t i = 0; i < NUM_OCTANT_TASKS; ++i)
         octantResults[i].Clear();
     for (size_t i = 0; i < workQueue->NumThreads(); ++i)
+    {
         batchResults[i].Clear();
+        occluderTriangles[i].clear();
+    }
+    occluders.clear();
     
     if (shadowMaps)
     {
@@ -308,7 +580,7 @@ void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows_, bo
     octree->Update(frameNumber);
 
     // Precalculate SAT test parameters for accurate frustum test (verify what octants to occlusion query)
-    if (useOcclusion)
+    if (useOcclusion && !softwareOcclusion)
         frustumSATData.Calculate(frustum);
 
     // Check arrived occlusion query results while octree update goes on, then finish octree update
@@ -328,34 +600,39 @@ void Renderer::PrepareView(Scene* scene_, Camera* camera_, bool drawShadows_, bo
 
     // If no root level octants, must early-out the view preparation; there is nothing to render and task dependencies would not complete
     if (rootLevelOctants.empty())
+    {
+        staticBatches.valid = false;
         return;
+    }
+
+    // With software occlusion, rasterize the occluders before traversing the octree so that the same frame's results can be used
+    if (useOcclusion && softwareOcclusion)
+        RenderOccluders();
+
+    PrepareStaticBatches();
 
     // Enable threaded update during geometry / light gathering in case nodes' OnPrepareRender() causes further reinsertion queuing
     octree->SetThreadedUpdate(workQueue->NumThreads() > 1);
 
-    // Keep track of both batch + octant task progress before main batches can be sorted (batch tasks will add to the counter when queued)
-    numPendingBatchTasks.store((int)rootLevelOctants.size());
     numPendingShadowViews[0].store(0);
     numPendingShadowViews[1].store(0);
 
-    // Ensure shadowcaster processing doesn't happen before lights have been found and processed, and geometry bounds are known
-    // Note: this task is also needed without shadows, as it initiates light grid culling
-    workQueue->AddDependency(processShadowCastersTask, processLightsTask);
-    workQueue->AddDependency(processShadowCastersTask, batchesReadyTask);
+    // Reset the recorded task graph for this frame. Shadowcaster processing is skipped without shadows
+    frameGraph.SetEnabled(processShadowCastersTask, drawShadows);
+    frameGraph.Run(workQueue);
 
-    // Find octants in view and their plane masks for node frustum culling. At the same time, find lights and process them
-    // When octant collection tasks complete, they queue tasks for collecting batches from those octants.
-    for (size_t i = 0; i < rootLevelOctants.size(); ++i)
+    // Find octants in view and their plane masks for node frustum culling, and find lights. Each octree branch collects batches from its octants when done
+    workQueue->ParallelFor(collectOctantsJob, 0, rootLevelOctants.size(), 1, [this](size_t begin, size_t end, unsigned threadIndex)
     {
-        collectOctantsTasks[i]->startOctant = rootLevelOctants[i];
-        workQueue->AddDependency(processLightsTask, collectOctantsTasks[i]);
-    }
+        CollectOctantsWork(begin, end, threadIndex);
+    }).Join();
 
-    workQueue->QueueTasks(rootLevelOctants.size(), reinterpret_cast<Task**>(&collectOctantsTasks[0]));
+    // Process lights while batch collection goes on
+    workQueue->QueueTask(processLightsTask);
 
     // Execute tasks until can sort the main batches. Perform that in the main thread to potentially run faster
-    while (numPendingBatchTasks.load() > 0)
-        workQueue->TryComplete();
+    for (size_t i = 0; i < rootLevelOctants.size(); ++i)
+        octantResults[i].collectBatchesJob.Join();
 
     SortMainBatches();
 
@@ -383,7 +660,10 @@ void Renderer::RenderShadowMaps()
         if (shadowMap.shadowViews.empty())
             continue;
 
-        UpdateInstanceTransforms(shadowMap.instanceTransforms);
+        // Instance transforms are normally written to the frame data ring buffer already after sorting
+        VertexBuffer* instanceBuffer = shadowMap.instanceDataInRing ? nullptr : instanceVertexBuffer.Get();
+        if (instanceBuffer)
+            UpdateInstanceTransforms(instanceBuffer, shadowMap.instanceTransforms);
 
         shadowMap.fbo->Bind();
 
@@ -402,7 +682,7 @@ void Renderer::RenderShadowMaps()
                 {
                     graphics->SetViewport(view->viewport);
                     graphics->SetDepthBias(light->DepthBias() * depthBiasMul, light->SlopeScaleBias() * slopeScaleBiasMul);
-                    RenderBatches(view->shadowCamera, batchQueue);
+                    RenderBatches(view->shadowCamera, batchQueue, instanceBuffer, shadowMap.instanceDataOffset);
                 }
             }
         }
@@ -443,7 +723,7 @@ void Renderer::RenderShadowMaps()
                 {
                     graphics->SetViewport(view->viewport);
                     graphics->SetDepthBias(light->DepthBias() * depthBiasMul, light->SlopeScaleBias() * slopeScaleBiasMul);
-                    RenderBatches(view->shadowCamera, batchQueue);
+                    RenderBatches(view->shadowCamera, batchQueue, instanceBuffer, shadowMap.instanceDataOffset);
                 }
             }
         }
@@ -457,7 +737,8 @@ void Renderer::RenderOpaque(bool clear)
     ZoneScoped;
 
     // Update main batches' instance transforms & light data
-    UpdateInstanceTransforms(instanceTransforms);
+    if (!instanceDataInRing)
+        UpdateInstanceTransforms(instanceVertexBuffer, instanceTransforms);
     UpdateLightData();
 
     if (shadowMaps)
@@ -469,15 +750,18 @@ void Renderer::RenderOpaque(bool clear)
     }
 
     clusterTexture->Bind(TU_LIGHTCLUSTERDATA);
-    lightDataBuffer->Bind(UB_LIGHTDATA);
+    lightDataTexture->Bind(TU_LIGHTDATA);
+    lightIndexTexture->Bind(TU_LIGHTINDICES);
 
     if (clear)
         graphics->Clear(true, true, IntRect::ZERO, lightEnvironment ? lightEnvironment->FogColor() : DEFAULT_FOG_COLOR);
 
-    RenderBatches(camera, opaqueBatches);
+    if (staticBatches.valid)
+        RenderBatches(camera, staticBatches.batches, staticBatches.instanceVertexBuffer);
+    RenderBatches(camera, opaqueBatches, instanceDataInRing ? nullptr : instanceVertexBuffer.Get(), instanceDataOffset);
 
     // Render occlusion now after opaques
-    if (useOcclusion)
+    if (useOcclusion && !softwareOcclusion)
         RenderOcclusionQueries();
 }
 
@@ -494,9 +778,10 @@ void Renderer::RenderAlpha()
     }
 
     clusterTexture->Bind(TU_LIGHTCLUSTERDATA);
-    lightDataBuffer->Bind(UB_LIGHTDATA);
+    lightDataTexture->Bind(TU_LIGHTDATA);
+    lightIndexTexture->Bind(TU_LIGHTINDICES);
 
-    RenderBatches(camera, alphaBatches);
+    RenderBatches(camera, alphaBatches, instanceDataInRing ? nullptr : instanceVertexBuffer.Get(), instanceDataOffset);
 }
 
 void Renderer::RenderDebug()
@@ -553,7 +838,14 @@ void Renderer::CollectOctantsAndLights(Octant* octant, ThreadOctantResult& resul
     }
 
     // Process occlusion now before going further
-    if (useOcclusion)
+    if (occlusionBufferValid)
+    {
+        // Software occlusion gives the result immediately, so no hierarchy of visibility states is needed
+        if (!occlusionBuffer->IsVisible(octantBox))
+            return;
+        octant->SetVisibility(VIS_VISIBLE_UNKNOWN, false);
+    }
+    else if (useOcclusion)
     {
         // If was previously outside frustum, reset to visible-unknown
         if (octant->Visibility() == VIS_OUTSIDE_FRUSTUM)
@@ -600,41 +892,22 @@ void Renderer::CollectOctantsAndLights(Octant* octant, ThreadOctantResult& resul
     }
 
     const std::vector<Drawable*>& drawables = octant->Drawables();
+    size_t numLights = octant->NumLights();
 
-    for (auto it = drawables.begin(); it != drawables.end(); ++it)
+    // Lights are kept first in octants
+    for (size_t i = 0; i < numLights; ++i)
     {
-        Drawable* drawable = *it;
-
-        if (drawable->TestFlag(DF_LIGHT))
-        {
-            const BoundingBox& lightBox = drawable->WorldBoundingBox();
-            if ((drawable->LayerMask() & viewMask) && (!planeMask || frustum.IsInsideMaskedFast(lightBox, planeMask)) && drawable->OnPrepareRender(frameNumber, camera))
-                result.lights.push_back(static_cast<LightDrawable*>(drawable));
-        }
-        // Lights are sorted first in octants, so break when first geometry encountered. Store the octant for batch collecting
-        else
-        {
-            result.octants.push_back(std::make_pair(octant, planeMask));
-            result.drawableAcc += drawables.end() - it;
-            break;
-        }
+        Drawable* drawable = drawables[i];
+        const BoundingBox& lightBox = drawable->WorldBoundingBox();
+        if ((drawable->LayerMask() & viewMask) && (!planeMask || frustum.IsInsideMaskedFast(lightBox, planeMask)) && drawable->OnPrepareRender(frameNumber, camera))
+            result.lights.push_back(static_cast<LightDrawable*>(drawable));
     }
 
-    // Setup and queue batches collection task if over the drawable limit now
-    if (result.drawableAcc >= DRAWABLES_PER_BATCH_TASK)
+    // If there are other drawables, store the octant for batch collecting
+    if (drawables.size() > numLights)
     {
-        if (result.collectBatchesTasks.size() <= result.batchTaskIdx)
-            result.collectBatchesTasks.push_back(new CollectBatchesTask(this, &Renderer::CollectBatchesWork));
-
-        CollectBatchesTask* batchTask = result.collectBatchesTasks[result.batchTaskIdx];
-        batchTask->octants.clear();
-        batchTask->octants.insert(batchTask->octants.end(), result.octants.begin() + result.taskOctantIdx, result.octants.end());
-        numPendingBatchTasks.fetch_add(1);
-        workQueue->QueueTask(batchTask);
-
-        result.drawableAcc = 0;
-        result.taskOctantIdx = result.octants.size();
-        ++result.batchTaskIdx;
+        result.octants.push_back(std::make_pair(octant, planeMask));
+        result.drawableAcc += drawables.size() - numLights;
     }
 
     // Root octant is handled separately. Otherwise recurse into child octants
@@ -656,6 +929,35 @@ void Renderer::AddOcclusionQuery(Octant* octant, ThreadOctantResult& result, uns
         result.occlusionQueries.push_back(octant);
 }
 
+void Renderer::RenderOccluders()
+{
+    ZoneScoped;
+
+    occlusionBuffer->SetSize(occlusionBufferWidth, (int)(occlusionBufferWidth / camera->AspectRatio()));
+    occlusionBuffer->SetView(camera);
+
+    octree->FindDrawablesMasked(occluders, frustum, DF_GEOMETRY | DF_OCCLUDER, viewMask);
+
+    // Transform occluder triangles, then rasterize. Each rasterization work item owns a band of block rows and reads all threads' triangles
+    if (occluders.size())
+    {
+        workQueue->ParallelFor(occluderTrianglesJob, 0, occluders.size(), 1, [this](size_t begin, size_t end, unsigned threadIndex)
+        {
+            AddOccluderTrianglesWork(begin, end, threadIndex);
+        }).Join();
+    }
+
+    for (unsigned i = 0; i < workQueue->NumThreads(); ++i)
+        occluderTriangleSpans[i] = occluderTriangles[i].Span();
+
+    workQueue->ParallelFor(rasterizeOccludersJob, 0, occlusionBuffer->NumBlockRows(), 1, [this](size_t begin, size_t end, unsigned threadIndex)
+    {
+        RasterizeOccludersWork(begin, end, threadIndex);
+    }).Join();
+
+    occlusionBufferValid = true;
+}
+
 bool Renderer::AllocateShadowMap(LightDrawable* light)
 {
     size_t index = light->GetLightType() == LIGHT_DIRECTIONAL ? 0 : 1;
@@ -695,10 +997,129 @@ bool Renderer::AllocateShadowMap(LightDrawable* light)
     return false;
 }
 
+void Renderer::PrepareStaticBatches()
+{
+    StaticBatchCache& cache = staticBatches;
+    const Matrix3x4& viewMatrix = camera->ViewMatrix();
+    Matrix4 projectionMatrix = camera->ProjectionMatrix();
+    unsigned staticContentVersion = Octree::StaticContentVersion();
+
+    bool sameView = cache.camera == camera && cache.viewMatrix == viewMatrix && cache.projectionMatrix == projectionMatrix && cache.viewMask == viewMask &&
+        cache.staticContentVersion == staticContentVersion && cache.useOcclusion == useOcclusion && cache.softwareOcclusion == softwareOcclusion;
+
+    // Dynamic occluders would change the software occlusion result for static geometry
+    if (sameView && occlusionBufferValid)
+    {
+        for (auto it = occluders.begin(); it != occluders.end(); ++it)
+        {
+            if (!(*it)->IsStatic())
+            {
+                sameView = false;
+                break;
+            }
+        }
+    }
+
+    // Static batches are separated once the view has stayed the same for a frame, so that a moving camera does not pay for the cache
+    separateStaticBatches = sameView;
+    reuseStaticBatches = sameView && cache.valid;
+
+    if (!sameView)
+    {
+        cache.valid = false;
+        cache.camera = camera;
+        cache.viewMatrix = viewMatrix;
+        cache.projectionMatrix = projectionMatrix;
+        cache.viewMask = viewMask;
+        cache.staticContentVersion = staticContentVersion;
+        cache.useOcclusion = useOcclusion;
+        cache.softwareOcclusion = softwareOcclusion;
+    }
+}
+
+void Renderer::UpdateStaticBatches()
+{
+    if (!separateStaticBatches)
+        return;
+
+    ZoneScoped;
+
+    StaticBatchCache& cache = staticBatches;
+
+    // When reusing, verify that the visible octants are the same as when the batches were collected. Occlusion may change them without the view changing
+    if (reuseStaticBatches)
+    {
+        size_t index = 0;
+        bool sameOctants = true;
+
+        for (size_t i = 0; i < rootLevelOctants.size() && sameOctants; ++i)
+        {
+            const ThreadOctantResult& result = octantResults[i];
+            for (auto it = result.octants.begin(); it != result.octants.end(); ++it, ++index)
+            {
+                if (index >= cache.octants.size() || cache.octants[index] != *it)
+                {
+                    sameOctants = false;
+                    break;
+                }
+            }
+        }
+
+        if (sameOctants && index == cache.octants.size())
+            return;
+    }
+
+    size_t drawableAcc = 0;
+    cache.octants.clear();
+    for (size_t i = 0; i < rootLevelOctants.size(); ++i)
+    {
+        const ThreadOctantResult& result = octantResults[i];
+        cache.octants.insert(cache.octants.end(), result.octants.begin(), result.octants.end());
+        drawableAcc += result.drawableAcc;
+    }
+
+    // If the static batches were expected to be reused, they were not collected yet
+    if (reuseStaticBatches)
+    {
+        reuseStaticBatches = false;
+
+        if (drawableAcc)
+        {
+            size_t grainSize = Max(cache.octants.size() * DRAWABLES_PER_BATCH_TASK / drawableAcc, (size_t)1);
+
+            workQueue->ParallelFor(collectStaticBatchesJob, 0, cache.octants.size(), grainSize, [this](size_t begin, size_t end, unsigned threadIndex)
+            {
+                CollectBatchesWork(ArenaSpan<std::pair<Octant*, unsigned char> >(&staticBatches.octants[0], staticBatches.octants.size()), begin, end, threadIndex, true);
+            }).Join();
+        }
+    }
+
+    cache.batches.Clear();
+    cache.instanceTransforms.clear();
+    for (size_t i = 0; i < workQueue->NumThreads(); ++i)
+    {
+        const ArenaVector<Batch>& threadBatches = batchResults[i].staticBatches;
+        cache.batches.batches.insert(cache.batches.batches.end(), threadBatches.begin(), threadBatches.end());
+    }
+
+    cache.batches.Sort(cache.instanceTransforms, SORT_STATE_AND_DISTANCE, hasInstancing, camera->FarClip());
+
+    if (hasInstancing)
+    {
+        if (!cache.instanceVertexBuffer)
+            cache.instanceVertexBuffer = new VertexBuffer();
+        UpdateInstanceTransforms(cache.instanceVertexBuffer, cache.instanceTransforms);
+    }
+
+    cache.valid = true;
+}
+
 void Renderer::SortMainBatches()
 {
     ZoneScoped;
 
+    UpdateStaticBatches();
+
     // Shadowcaster processing needs accurate scene min / max Z results, combine them from per-thread data
     for (size_t i = 0; i < workQueue->NumThreads(); ++i)
     {
@@ -714,18 +1135,123 @@ void Renderer::SortMainBatches()
     // Signal that shadowcaster processing is OK to happen
     workQueue->QueueTask(batchesReadyTask);
 
-    // Join per-thread collected batches and sort
-    for (size_t i = 0; i < workQueue->NumThreads(); ++i)
+    // Sort each thread's batches, then merge the sorted runs into the final queues. Both are done in parallel
+    size_t numThreads = workQueue->NumThreads();
+    workQueue->ParallelFor(sortBatchesJob, 0, numThreads * 2, 1, [this](size_t begin, size_t end, unsigned threadIndex)
     {
-        ThreadBatchResult& res = batchResults[i];
-        if (res.opaqueBatches.size())
-            opaqueBatches.batches.insert(opaqueBatches.batches.end(), res.opaqueBatches.begin(), res.opaqueBatches.end());
-        if (res.alphaBatches.size())
-            alphaBatches.batches.insert(alphaBatches.batches.end(), res.alphaBatches.begin(), res.alphaBatches.end());
+        SortBatchesWork(begin, end, threadIndex);
+    }).Join();
+
+    size_t numOpaqueBatches = 0;
+    size_t numAlphaBatches = 0;
+    for (size_t i = 0; i < numThreads; ++i)
+    {
+        numOpaqueBatches += batchResults[i].opaqueBatches.size();
+        numAlphaBatches += batchResults[i].alphaBatches.size();
+    }
+
+    opaqueBatches.batches.resize(numOpaqueBatches);
+    alphaBatches.batches.resize(numAlphaBatches);
+
+    // Split each queue into merge ranges by its own batch count, so that a small queue is not split needlessly. The alpha queue's ranges follow the opaque queue's
+    numMergeRanges[0] = Max(Min(numOpaqueBatches / MIN_MERGE_RANGE_BATCHES, numThreads), (size_t)1);
+    numMergeRanges[1] = Max(Min(numAlphaBatches / MIN_MERGE_RANGE_BATCHES, numThreads), (size_t)1);
+    size_t totalMergeRanges = numMergeRanges[0] + numMergeRanges[1];
+    sortRuns.resize(numThreads * 2);
+    mergeBounds.resize(numThreads * (totalMergeRanges + 2));
+    mergeOffsets.resize(totalMergeRanges);
+
+    PrepareBatchMerge(opaqueBatches, 0);
+    PrepareBatchMerge(alphaBatches, 1);
+
+    workQueue->ParallelFor(mergeBatchesJob, 0, totalMergeRanges, 1, [this](size_t begin, size_t end, unsigned threadIndex)
+    {
+        MergeBatchesWork(begin, end, threadIndex);
+    }).Join();
+
+    if (hasInstancing)
+    {
+        opaqueBatches.ConvertToInstanced(instanceTransforms);
+        alphaBatches.ConvertToInstanced(instanceTransforms);
+        instanceDataInRing = WriteInstanceTransforms(instanceTransforms, instanceDataOffset);
+
+        opaqueBatches.ConvertToInstancedSkinned(instanceDrawables);
+        alphaBatches.ConvertToInstancedSkinned(instanceDrawables);
+        WriteSkinPalettes(opaqueBatches, instanceDrawables);
+        WriteSkinPalettes(alphaBatches, instanceDrawables);
+    }
+
+    // The static batch cache is sorted already, but its per-object data must be written again each frame
+    if (staticBatches.valid)
+        WriteObjectData(staticBatches.batches);
+    WriteObjectData(opaqueBatches);
+    WriteObjectData(alphaBatches);
+
+    // Record the render commands on worker threads, so that rendering only needs to replay them
+    staticBatches.batches.commands.resize(staticBatches.valid ? staticBatches.batches.batches.size() : 0);
+    opaqueBatches.commands.resize(opaqueBatches.batches.size());
+    alphaBatches.commands.resize(alphaBatches.batches.size());
+
+    size_t numCommands = staticBatches.batches.commands.size() + opaqueBatches.commands.size() + alphaBatches.commands.size();
+    if (numCommands)
+    {
+        workQueue->ParallelFor(recordCommandsJob, 0, numCommands, RECORD_COMMANDS_GRAIN_SIZE, [this](size_t begin, size_t end, unsigned threadIndex)
+        {
+            RecordCommandsWork(begin, end, threadIndex);
+        }).Join();
+    }
+}
+
+void Renderer::PrepareBatchMerge(BatchQueue& queue, size_t queueIndex)
+{
+    size_t numThreads = workQueue->NumThreads();
+    BatchSortRun* runs = &sortRuns[queueIndex * numThreads];
+    size_t numRanges = numMergeRanges[queueIndex];
+    size_t* bounds = &mergeBounds[queueIndex ? (numMergeRanges[0] + 1) * numThreads : 0];
+    size_t* offsets = &mergeOffsets[queueIndex ? numMergeRanges[0] : 0];
+
+    size_t largestRun = 0;
+    for (size_t i = 0; i < numThreads; ++i)
+    {
+        const ThreadBatchResult& res = batchResults[i];
+        const ArenaSpan<BatchSortKey>& keys = queueIndex ? res.alphaKeys : res.opaqueKeys;
+
+        runs[i].keys = keys.data;
+        runs[i].batches = queueIndex ? res.alphaBatches.begin() : res.opaqueBatches.begin();
+        runs[i].count = keys.size();
+        if (runs[i].count > runs[largestRun].count)
+            largestRun = i;
+
+        bounds[i] = 0;
+        bounds[numRanges * numThreads + i] = runs[i].count;
+    }
+
+    // Split the key space at evenly spaced keys of the largest run, assuming the runs have similar key distributions
+    offsets[0] = 0;
+    for (size_t i = 1; i < numRanges; ++i)
+    {
+        size_t* rangeBounds = &bounds[i * numThreads];
+        offsets[i] = 0;
+
+        if (runs[largestRun].count)
+        {
+            BatchSortKey splitKey = runs[largestRun].keys[i * runs[largestRun].count / numRanges];
+
+            for (size_t j = 0; j < numThreads; ++j)
+            {
+                const BatchSortKey* keys = runs[j].keys;
+                rangeBounds[j] = std::lower_bound(keys, keys + runs[j].count, splitKey, CompareSortKeyValues) - keys;
+                offsets[i] += rangeBounds[j];
+            }
+        }
+        else
+        {
+            for (size_t j = 0; j < numThreads; ++j)
+                rangeBounds[j] = 0;
+        }
     }
 
-    opaqueBatches.Sort(instanceTransforms, SORT_STATE_AND_DISTANCE, hasInstancing);
-    alphaBatches.Sort(instanceTransforms, SORT_DISTANCE, hasInstancing);
+    assert(offsets[numRanges - 1] <= queue.batches.size());
 }
 
 void Renderer::SortShadowBatches(ShadowMap& shadowMap)
@@ -745,41 +1271,221 @@ void Renderer::SortShadowBatches(ShadowMap& shadowMap)
         BatchQueue* destDynamic = &shadowMap.shadowBatches[view.dynamicQueueIdx];
 
         if (destStatic && destStatic->HasBatches())
+        {
             destStatic->Sort(shadowMap.instanceTransforms, SORT_STATE, hasInstancing);
+            if (hasInstancing)
+            {
+                destStatic->ConvertToInstancedSkinned(shadowMap.instanceDrawables);
+                WriteSkinPalettes(*destStatic, shadowMap.instanceDrawables);
+            }
+            WriteObjectData(*destStatic);
+            destStatic->RecordCommands();
+        }
 
         if (destDynamic->HasBatches())
+        {
             destDynamic->Sort(shadowMap.instanceTransforms, SORT_STATE, hasInstancing);
+            if (hasInstancing)
+            {
+                destDynamic->ConvertToInstancedSkinned(shadowMap.instanceDrawables);
+                WriteSkinPalettes(*destDynamic, shadowMap.instanceDrawables);
+            }
+            WriteObjectData(*destDynamic);
+            destDynamic->RecordCommands();
+        }
     }
+
+    if (hasInstancing)
+        shadowMap.instanceDataInRing = WriteInstanceTransforms(shadowMap.instanceTransforms, shadowMap.instanceDataOffset);
 }
 
-void Renderer::UpdateInstanceTransforms(const std::vector<Matrix3x4>& transforms)
+void Renderer::UpdateInstanceTransforms(VertexBuffer* buffer, const std::vector<Matrix3x4>& transforms)
 {
     ZoneScoped;
 
-    if (hasInstancing && transforms.size())
+    if (hasInstancing && transforms.size())
+    {
+        if (buffer->NumVertices() < transforms.size())
+            buffer->Define(USAGE_DYNAMIC, transforms.size(), instanceVertexElements, &transforms[0]);
+        else
+            buffer->SetData(0, transforms.size(), &transforms[0]);
+    }
+}
+
+bool Renderer::WriteInstanceTransforms(const std::vector<Matrix3x4>& transforms, size_t& offset)
+{
+    GpuRingBuffer* ringBuffer = graphics->FrameDataBuffer();
+    if (!ringBuffer)
+        return false;
+
+    // Nothing to write is a success, as then no instanced batches will be rendered
+    if (transforms.empty())
+        return true;
+
+    // Align the offset to whole instances, so that it can be given as the base instance when drawing
+    size_t numBytes = transforms.size() * sizeof(Matrix3x4);
+    unsigned char* dest = ringBuffer->Allocate(numBytes + sizeof(Matrix3x4), offset);
+    if (!dest)
+        return false;
+
+    size_t padding = (sizeof(Matrix3x4) - offset % sizeof(Matrix3x4)) % sizeof(Matrix3x4);
+    offset += padding;
+    memcpy(dest + padding, &transforms[0], numBytes);
+    return true;
+}
+
+void Renderer::WriteObjectData(BatchQueue& queue)
+{
+    ZoneScoped;
+
+    GpuRingBuffer* ringBuffer = graphics->FrameDataBuffer();
+    size_t numObjects = 0;
+
+    for (auto it = queue.batches.begin(); it != queue.batches.end(); ++it)
+    {
+        unsigned char geometryBits = it->programBits & SP_GEOMETRYBITS;
+        if (geometryBits == GEOM_INSTANCED)
+            it += it->instanceCount - 1;
+        else if (!geometryBits)
+            ++numObjects;
+    }
+
+    if (!numObjects)
+        return;
+
+    // Allocate all objects at once, each in its own aligned slot for binding
+    size_t slotSize = 0;
+    size_t offset = 0;
+    unsigned char* dest = nullptr;
+
+    if (ringBuffer)
+    {
+        size_t alignment = ringBuffer->Alignment();
+        slotSize = (sizeof(Matrix3x4) + alignment - 1) / alignment * alignment;
+        dest = ringBuffer->Allocate(numObjects * slotSize, offset);
+    }
+
+    for (auto it = queue.batches.begin(); it != queue.batches.end(); ++it)
+    {
+        unsigned char geometryBits = it->programBits & SP_GEOMETRYBITS;
+        if (geometryBits == GEOM_INSTANCED)
+            it += it->instanceCount - 1;
+        else if (!geometryBits)
+        {
+            if (dest)
+            {
+                memcpy(dest, it->worldTransform, sizeof(Matrix3x4));
+                it->objectDataOffset = (unsigned)offset;
+                dest += slotSize;
+                offset += slotSize;
+            }
+            else
+                it->objectDataOffset = M_MAX_UNSIGNED;
+        }
+    }
+}
+
+void Renderer::WriteSkinPalettes(BatchQueue& queue, const std::vector<GeometryDrawable*>& drawables)
+{
+    ZoneScoped;
+
+    GpuRingBuffer* ringBuffer = graphics->FrameDataBuffer();
+
+    for (auto it = queue.batches.begin(); it != queue.batches.end(); ++it)
+    {
+        if (it->programBits != SP_SKINNED_INSTANCED)
+            continue;
+
+        size_t start = it->instanceStart;
+        size_t count = it->instanceCount;
+        AnimatedModelDrawable* first = static_cast<AnimatedModelDrawable*>(drawables[start]);
+        size_t numBones = first->NumBones();
+
+        // The parameters occupy their own aligned slot for uniform binding, followed by the palettes of all instances
+        size_t paramsBytes = ringBuffer ? ringBuffer->Alignment() : 0;
+        size_t paletteBytes = numBones * sizeof(Matrix3x4);
+        size_t offset = 0;
+        unsigned char* dest = (ringBuffer && numBones) ? ringBuffer->Allocate(paramsBytes + count * paletteBytes, offset) : nullptr;
+
+        if (!dest)
+        {
+            // Revert to a normal skinned batch. The rest of the group are still normal skinned batches
+            it->programBits = SP_SKINNED;
+            it->drawable = first;
+            continue;
+        }
+
+        int params[4] = { (int)((offset + paramsBytes) / sizeof(Vector4)), (int)(numBones * 3), 0, 0 };
+        memcpy(dest, params, sizeof params);
+        dest += paramsBytes;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            memcpy(dest, static_cast<AnimatedModelDrawable*>(drawables[start + i])->SkinMatrices(), paletteBytes);
+            dest += paletteBytes;
+        }
+
+        it->objectDataOffset = (unsigned)offset;
+        it += count - 1;
+    }
+}
+
+void Renderer::UpdateLightData()
+{
+    ZoneScoped;
+
+    if (!lightDataDirty)
+        return;
+
+    // Concatenate the Z-slices' light index lists and make the cluster offsets global
+    lightDataDirty = false;
+    lightIndices.clear();
+
+    size_t clustersPerSlice = clusterGridSize.x * clusterGridSize.y;
+
+    for (size_t z = 0; z < sliceLightIndices.size(); ++z)
     {
-        if (instanceVertexBuffer->NumVertices() < transforms.size())
-            instanceVertexBuffer->Define(USAGE_DYNAMIC, transforms.size(), instanceVertexElements, &transforms[0]);
-        else
-            instanceVertexBuffer->SetData(0, transforms.size(), &transforms[0]);
+        const std::vector<unsigned>& sliceIndices = sliceLightIndices[z];
+        unsigned sliceStart = (unsigned)lightIndices.size();
+        unsigned* cluster = &clusterData[2 * z * clustersPerSlice];
+
+        for (size_t i = 0; i < clustersPerSlice; ++i)
+        {
+            cluster[0] += sliceStart;
+            // Drop indices beyond the buffer texture size, as the shader would read them as zero
+            cluster[1] = (unsigned)Min((size_t)cluster[1], maxBufferTexels - Min((size_t)cluster[0], maxBufferTexels));
+            cluster += 2;
+        }
+
+        lightIndices.insert(lightIndices.end(), sliceIndices.begin(), sliceIndices.end());
     }
-}
 
-void Renderer::UpdateLightData()
-{
-    ZoneScoped;
+    if (lightIndices.size() > maxBufferTexels)
+        lightIndices.resize(maxBufferTexels);
 
-    ImageLevel clusterLevel(IntVector3(NUM_CLUSTER_X, NUM_CLUSTER_Y, NUM_CLUSTER_Z), FMT_RG32U, clusterData);
-    clusterTexture->SetData(0, IntBox(0, 0, 0, NUM_CLUSTER_X, NUM_CLUSTER_Y, NUM_CLUSTER_Z), clusterLevel);
-    lightDataBuffer->SetData(0, (lights.size() + 1) * sizeof(LightData), lightData);
+    ImageLevel clusterLevel(clusterGridSize, FMT_RG32U, clusterData);
+    clusterTexture->SetData(0, IntBox(0, 0, 0, clusterGridSize.x, clusterGridSize.y, clusterGridSize.z), clusterLevel);
+    if (lights.size())
+        SetBufferTextureData(lightDataBuffer, lightDataTexture, FMT_RGBA32F, lights.size() * sizeof(LightData), &lightData[0]);
+    if (lightIndices.size())
+        SetBufferTextureData(lightIndexBuffer, lightIndexTexture, FMT_R32U, lightIndices.size() * sizeof(unsigned), &lightIndices[0]);
 }
 
-void Renderer::RenderBatches(Camera* camera_, const BatchQueue& queue)
+void Renderer::RenderBatches(Camera* camera_, const BatchQueue& queue, VertexBuffer* instanceBuffer, size_t instanceDataOffset_)
 {
     ZoneScoped;
 
-    lastMaterial = nullptr;
+    lastMaterialState = nullptr;
     lastPass = nullptr;
+    ShaderProgram* lastProgram = nullptr;
+    Geometry* lastGeometry = nullptr;
+    GpuRingBuffer* ringBuffer = graphics->FrameDataBuffer();
+    VertexBuffer* lastVertexBuffer = nullptr;
+    IndexBuffer* lastIndexBuffer = nullptr;
+    unsigned lastAttributes = 0;
+    unsigned lastInstanceGLBuffer = 0;
+    unsigned lastVertexArray = 0;
+    unsigned lastVertexArrayGeneration = 0;
 
     if (camera_ != lastCamera)
     {
@@ -804,6 +1510,11 @@ void Renderer::RenderBatches(Camera* camera_, const BatchQueue& queue)
             float fogEnd = lightEnvironment ? lightEnvironment->FogEnd() : DEFAULT_FOG_END;
             float fogRange = Max(fogEnd - fogStart, M_EPSILON);
             perViewData.fogParameters = Vector4(fogEnd / farClip, farClip / fogRange, 0.0f, 0.0f);
+
+            // The shader maps linear depth to the cluster Z coordinate either with a root or a logarithm, inverting the slice distribution
+            float sliceRoot = clusterSlicing == CLUSTER_SLICE_LINEAR ? 1.0f : 0.5f;
+            float logRange = logf(Max(farClip / nearClip, 1.0f + M_EPSILON));
+            perViewData.clusterParameters = Vector4(sliceRoot, 1.0f / logRange, clusterSlicing == CLUSTER_SLICE_EXPONENTIAL ? 1.0f : 0.0f, 0.0f);
         }
 
         // Set directional light data if exists and is the main view
@@ -840,42 +1551,59 @@ void Renderer::RenderBatches(Camera* camera_, const BatchQueue& queue)
             }
         }
 
-        perViewDataBuffer->SetData(0, dataSize, &perViewData);
+        // Write to the frame data ring buffer if possible, to avoid a synchronous buffer update for each shadow view
+        unsigned char* dest = ringBuffer ? ringBuffer->Allocate(sizeof(PerViewUniforms), perViewDataOffset) : nullptr;
+        if (dest)
+            memcpy(dest, &perViewData, dataSize);
+        else
+            perViewDataBuffer->SetData(0, dataSize, &perViewData);
 
+        perViewDataInRing = dest != nullptr;
         lastCamera = camera_;
     }
 
-    perViewDataBuffer->Bind(UB_PERVIEWDATA);
+    if (perViewDataInRing)
+        ringBuffer->BindUniformRange(UB_PERVIEWDATA, perViewDataOffset, sizeof(PerViewUniforms));
+    else
+        perViewDataBuffer->Bind(UB_PERVIEWDATA);
 
-    for (auto it = queue.batches.begin(); it != queue.batches.end(); ++it)
+    // Upload all data written by now, if the ring buffer is not persistently mapped
+    if (ringBuffer)
+        ringBuffer->Flush();
+
+    // Replay the commands recorded after sorting. They refer to the buffers and render state directly, so the passes and geometries do not need to be accessed
+    for (auto it = queue.commands.begin(); it != queue.commands.end(); ++it)
     {
-        const Batch& batch = *it;
-        unsigned char geometryBits = batch.programBits & SP_GEOMETRYBITS;
+        const RenderCommand& command = *it;
+        unsigned char geometryBits = command.programBits & SP_GEOMETRYBITS;
 
-        ShaderProgram* program = batch.pass->GetShaderProgram(batch.programBits);
+        // Shader programs are created on first use, which can not happen during recording
+        ShaderProgram* program = command.program ? command.program : command.pass->GetShaderProgram(command.programBits);
         if (!program->Bind())
             continue;
 
-        Material* material = batch.pass->Parent();
-        if (batch.pass != lastPass)
+        if (program != lastProgram)
+        {
+            ++renderStats.programChanges;
+            lastProgram = program;
+        }
+
+        if (command.pass != lastPass)
         {
-            if (material != lastMaterial)
+            // Bind the material textures and uniforms from the state resolved before recording, without accessing the material
+            const MaterialState* state = command.materialState;
+            if (state != lastMaterialState)
             {
                 for (size_t i = 0; i < MAX_MATERIAL_TEXTURE_UNITS; ++i)
-                {
-                    Texture* texture = material->GetTexture(i);
-                    if (texture)
-                        texture->Bind(i);
-                }
+                    Texture::Bind(i, state->textureTargets[i], state->textures[i]);
 
-                UniformBuffer* materialUniforms = material->GetUniformBuffer();
-                if (materialUniforms)
-                    materialUniforms->Bind(UB_MATERIALDATA);
+                UniformBuffer::Bind(UB_MATERIALDATA, state->uniformBuffer, state->uniformBufferSize);
 
-                lastMaterial = material;
+                lastMaterialState = state;
+                ++renderStats.materialChanges;
             }
 
-            CullMode cullMode = material->GetCullMode();
+            CullMode cullMode = command.cullMode;
             if (camera_->UseReverseCulling())
             {
                 if (cullMode == CULL_BACK)
@@ -884,39 +1612,110 @@ void Renderer::RenderBatches(Camera* camera_, const BatchQueue& queue)
                     cullMode = CULL_BACK;
             }
 
-            graphics->SetRenderState(batch.pass->GetBlendMode(), cullMode, batch.pass->GetDepthTest(), batch.pass->GetColorWrite(), batch.pass->GetDepthWrite());
+            graphics->SetRenderState(command.blendMode, cullMode, command.depthTest, command.colorWrite, command.depthWrite);
+
+            lastPass = command.pass;
+            ++renderStats.renderStateChanges;
+        }
+
+        if (command.geometry != lastGeometry)
+        {
+            ++renderStats.geometryChanges;
+            lastGeometry = command.geometry;
+        }
+
+        // Instanced batches source their instance attributes from the instancing vertex buffer or the frame data ring buffer
+        unsigned instanceGLBuffer = 0;
+        if (geometryBits == GEOM_INSTANCED)
+            instanceGLBuffer = instanceBuffer ? instanceBuffer->GLBuffer() : ringBuffer->GLBuffer();
+        else if (geometryBits == GEOM_SKINNED_INSTANCED)
+            instanceGLBuffer = ringBuffer->GLBuffer();
+
+        // Resolve the vertex array object once per command. Consecutive commands with the same geometry, attributes and instance source share it without a lookup.
+        // Releasing buffers, for example on ring buffer growth, invalidates the resolved objects
+        unsigned vertexArrayGeneration = graphics->VertexArrayGeneration();
+        if (command.vertexArrayGeneration != vertexArrayGeneration)
+        {
+            if (vertexArrayGeneration == lastVertexArrayGeneration && command.vertexBuffer == lastVertexBuffer && command.indexBuffer == lastIndexBuffer && program->Attributes() == lastAttributes && instanceGLBuffer == lastInstanceGLBuffer)
+                command.vertexArray = lastVertexArray;
+            else
+            {
+                command.vertexArray = graphics->VertexArray(command.vertexBuffer, command.indexBuffer, program->Attributes(), instanceGLBuffer);
+                lastVertexBuffer = command.vertexBuffer;
+                lastIndexBuffer = command.indexBuffer;
+                lastAttributes = program->Attributes();
+                lastInstanceGLBuffer = instanceGLBuffer;
+                lastVertexArray = command.vertexArray;
+                lastVertexArrayGeneration = vertexArrayGeneration;
+            }
 
-            lastPass = batch.pass;
+            command.vertexArrayGeneration = vertexArrayGeneration;
         }
 
-        Geometry* geometry = batch.geometry;
-        VertexBuffer* vb = geometry->vertexBuffer;
-        IndexBuffer* ib = geometry->indexBuffer;
-        vb->Bind(program->Attributes());
-        if (ib)
-            ib->Bind();
+        if (command.vertexArray && command.vertexArray != VertexBuffer::BoundVertexArray())
+            graphics->BindVertexArray(command.vertexArray, command.indexSize);
+
+        IndexBuffer* ib = command.indexBuffer;
 
         if (geometryBits == GEOM_INSTANCED)
         {
+            if (instanceBuffer)
+            {
+                if (ib)
+                    graphics->DrawIndexedInstanced(PT_TRIANGLE_LIST, command.drawStart, command.drawCount, instanceBuffer, command.instanceStart, command.instanceCount);
+                else
+                    graphics->DrawInstanced(PT_TRIANGLE_LIST, command.drawStart, command.drawCount, instanceBuffer, command.instanceStart, command.instanceCount);
+            }
+            else
+            {
+                size_t instanceOffset = instanceDataOffset_ + command.instanceStart * sizeof(Matrix3x4);
+                if (ib)
+                    graphics->DrawIndexedInstanced(PT_TRIANGLE_LIST, command.drawStart, command.drawCount, ringBuffer, instanceOffset, command.instanceCount);
+                else
+                    graphics->DrawInstanced(PT_TRIANGLE_LIST, command.drawStart, command.drawCount, ringBuffer, instanceOffset, command.instanceCount);
+            }
+
+            renderStats.batches += command.instanceCount;
+            it += command.instanceCount - 1;
+        }
+        else if (geometryBits == GEOM_SKINNED_INSTANCED)
+        {
+            // The skin matrices are read from the ring buffer through a buffer texture. The instance attributes are not used by the shader, but point to the start of the ring buffer to remain valid
+            ringBuffer->TextureView()->Bind(TU_SKINPALETTES);
+            ringBuffer->BindUniformRange(UB_OBJECTDATA, command.objectDataOffset, 4 * sizeof(int));
+
             if (ib)
-                graphics->DrawIndexedInstanced(PT_TRIANGLE_LIST, geometry->drawStart, geometry->drawCount, instanceVertexBuffer, batch.instanceStart, batch.instanceCount);
+                graphics->DrawIndexedInstanced(PT_TRIANGLE_LIST, command.drawStart, command.drawCount, ringBuffer, 0, command.instanceCount);
             else
-                graphics->DrawInstanced(PT_TRIANGLE_LIST, geometry->drawStart, geometry->drawCount, instanceVertexBuffer, batch.instanceStart, batch.instanceCount);
+                graphics->DrawInstanced(PT_TRIANGLE_LIST, command.drawStart, command.drawCount, ringBuffer, 0, command.instanceCount);
 
-            it += batch.instanceCount - 1;
+            renderStats.batches += command.instanceCount;
+            it += command.instanceCount - 1;
         }
         else
         {
             if (!geometryBits)
-                graphics->SetUniform(program, U_WORLDMATRIX, *batch.worldTransform);
+            {
+                if (command.objectDataOffset != M_MAX_UNSIGNED)
+                    ringBuffer->BindUniformRange(UB_OBJECTDATA, command.objectDataOffset, sizeof(Matrix3x4));
+                else
+                {
+                    objectDataBuffer->SetData(0, sizeof(Matrix3x4), command.worldTransform);
+                    objectDataBuffer->Bind(UB_OBJECTDATA);
+                }
+            }
             else
-                batch.drawable->OnRender(program, batch.geomIndex);
+                command.drawable->OnRender(program, command.geomIndex);
 
             if (ib)
-                graphics->DrawIndexed(PT_TRIANGLE_LIST, geometry->drawStart, geometry->drawCount);
+                graphics->DrawIndexed(PT_TRIANGLE_LIST, command.drawStart, command.drawCount);
             else
-                graphics->Draw(PT_TRIANGLE_LIST, geometry->drawStart, geometry->drawCount);
+                graphics->Draw(PT_TRIANGLE_LIST, command.drawStart, command.drawCount);
+
+            ++renderStats.batches;
         }
+
+        ++renderStats.drawCalls;
     }
 }
 
@@ -1094,22 +1893,36 @@ void Renderer::DefineClusterFrustums()
         Matrix4 cameraProjInverse = cameraProj.Inverse();
         float cameraNearClip = camera->NearClip();
         float cameraFarClip = camera->FarClip();
+        size_t numX = clusterGridSize.x;
+        size_t numY = clusterGridSize.y;
+        size_t numZ = clusterGridSize.z;
+        // Pad the rows of the SIMD culling boxes so that each 4-column tile starts at a divisible index
+        size_t rowStride = (numX + 3) & ~(size_t)3;
+        size_t numTiles = rowStride / 4;
         size_t idx = 0;
 
-        float xStep = 2.0f / NUM_CLUSTER_X;
-        float yStep = 2.0f / NUM_CLUSTER_Y;
-        float zStep = 1.0f / NUM_CLUSTER_Z;
+        float xStep = 2.0f / numX;
+        float yStep = 2.0f / numY;
+        float zStep = 1.0f / numZ;
 
-        for (size_t z = 0; z < NUM_CLUSTER_Z; ++z)
+        for (size_t z = 0; z < numZ; ++z)
         {
-            Vector4 nearVec = cameraProj * Vector4(0.0f, 0.0f, z > 0 ? powf(z * zStep, 2.0f) * cameraFarClip : cameraNearClip, 1.0f);
-            Vector4 farVec = cameraProj * Vector4(0.0f, 0.0f, powf((z + 1) * zStep, 2.0f) * cameraFarClip, 1.0f);
+            Vector4 nearVec = cameraProj * Vector4(0.0f, 0.0f, z > 0 ? ClusterSliceDistance(clusterSlicing, z * zStep, cameraNearClip, cameraFarClip) : cameraNearClip, 1.0f);
+            Vector4 farVec = cameraProj * Vector4(0.0f, 0.0f, ClusterSliceDistance(clusterSlicing, (z + 1) * zStep, cameraNearClip, cameraFarClip), 1.0f);
             float near = nearVec.z / nearVec.w;
             float far = farVec.z / farVec.w;
 
-            for (size_t y = 0; y < NUM_CLUSTER_Y; ++y)
+            ClusterSliceBounds& slice = clusterSliceBounds[z];
+            slice.clusters.Resize(rowStride * numY);
+            slice.tiles.Resize(numTiles);
+            slice.rows.resize(numY);
+            slice.box.Undefine();
+
+            for (size_t y = 0; y < numY; ++y)
             {
-                for (size_t x = 0; x < NUM_CLUSTER_X; ++x)
+                slice.rows[y].Undefine();
+
+                for (size_t x = 0; x < numX; ++x)
                 {
                     Frustum& clusterFrustum = clusterCullData[idx].frustum;
                     BoundingBox& clusterBox = clusterCullData[idx].boundingBox;
@@ -1124,8 +1937,24 @@ void Renderer::DefineClusterFrustums()
                     clusterFrustum.vertices[7] = cameraProjInverse * Vector3(-1.0f + xStep * x, 1.0f - yStep * y, far);
                     clusterFrustum.UpdatePlanes();
                     clusterBox.Define(clusterFrustum);
+
+                    slice.clusters.Set(y * rowStride + x, clusterBox);
+                    slice.rows[y].Merge(clusterBox);
                     ++idx;
                 }
+
+                slice.box.Merge(slice.rows[y]);
+            }
+
+            for (size_t t = 0; t < numTiles; ++t)
+            {
+                BoundingBox tileBox;
+                for (size_t y = 0; y < numY; ++y)
+                {
+                    for (size_t x = t * 4; x < Min(t * 4 + 4, numX); ++x)
+                        tileBox.Merge(clusterCullData[(z * numY + y) * numX + x].boundingBox);
+                }
+                slice.tiles.Set(t, tileBox);
             }
         }
 
@@ -1134,32 +1963,32 @@ void Renderer::DefineClusterFrustums()
     }
 }
 
-void Renderer::CollectOctantsWork(Task* task_, unsigned)
+void Renderer::CollectOctantsWork(size_t begin, size_t end, unsigned threadIndex)
 {
     ZoneScoped;
 
-    CollectOctantsTask* task = static_cast<CollectOctantsTask*>(task_);
-
-    // Go through octants in this task's octree branch
-    Octant* octant = task->startOctant;
-    ThreadOctantResult& result = octantResults[task->resultIdx];
+    FrameArena* arena = workQueue->ThreadArena(threadIndex);
 
-    CollectOctantsAndLights(octant, result);
-
-    // Queue final batch task for leftover nodes if needed
-    if (result.drawableAcc)
+    for (size_t i = begin; i < end; ++i)
     {
-        if (result.collectBatchesTasks.size() <= result.batchTaskIdx)
-            result.collectBatchesTasks.push_back(new CollectBatchesTask(this, &Renderer::CollectBatchesWork));
-            
-        CollectBatchesTask* batchTask = result.collectBatchesTasks[result.batchTaskIdx];
-        batchTask->octants.clear();
-        batchTask->octants.insert(batchTask->octants.end(), result.octants.begin() + result.taskOctantIdx, result.octants.end());
-        numPendingBatchTasks.fetch_add(1);
-        workQueue->QueueTask(batchTask);
-    }
+        // Go through octants in this octree branch. The branch may be processed by any thread, so bind the result lists to this thread's arena
+        ThreadOctantResult& result = octantResults[i];
+        result.octants.SetArena(arena);
+        result.lights.SetArena(arena);
+        result.occlusionQueries.SetArena(arena);
+        CollectOctantsAndLights(rootLevelOctants[i], result);
+
+        // Then collect batches from the found octants. Size the subranges to contain approximately the desired amount of drawables
+        if (result.drawableAcc)
+        {
+            size_t grainSize = Max(result.octants.size() * DRAWABLES_PER_BATCH_TASK / result.drawableAcc, (size_t)1);
 
-    numPendingBatchTasks.fetch_add(-1);
+            workQueue->ParallelFor(result.collectBatchesJob, 0, result.octants.size(), grainSize, [this, &result](size_t begin, size_t end, unsigned threadIndex)
+            {
+                CollectBatchesWork(result.octants.Span(), begin, end, threadIndex);
+            });
+        }
+    }
 }
 
 void Renderer::ProcessLightsWork(Task*, unsigned)
@@ -1187,9 +2016,11 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
     // Sort localized lights by increasing distance
     std::sort(lights.begin(), lights.end(), CompareDrawableDistances);
 
-    // Clamp to maximum supported
-    if (lights.size() > MAX_LIGHTS)
-        lights.resize(MAX_LIGHTS);
+    // Clamp to what the light data buffer texture can hold. The nearest lights are kept
+    if (lights.size() > maxBufferTexels / LIGHT_DATA_TEXELS)
+        lights.resize(maxBufferTexels / LIGHT_DATA_TEXELS);
+
+    lightData.resize(lights.size());
 
     // Pre-step for shadow map caching: reallocate all lights' shadow map rectangles which are non-zero at this point.
     // If shadow maps were dirtied (size or bias change) reset all allocations instead
@@ -1222,12 +2053,11 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
         LightDrawable* light = lights[i];
         float cutoff = light->GetLightType() == LIGHT_SPOT ? cosf(light->Fov() * 0.5f * M_DEGTORAD) : 0.0f;
 
-        // Light indexing starts at 1 as 0 is "no light"
-        lightData[i + 1].position = Vector4(light->WorldPosition(), 1.0f);
-        lightData[i + 1].direction = Vector4(-light->WorldDirection(), 0.0f);
-        lightData[i + 1].attenuation = Vector4(1.0f / Max(light->Range(), M_EPSILON), cutoff, 1.0f / (1.0f - cutoff), 1.0f);
-        lightData[i + 1].color = light->EffectiveColor();
-        lightData[i + 1].shadowParameters = Vector4::ONE; // Assume unshadowed
+        lightData[i].position = Vector4(light->WorldPosition(), 1.0f);
+        lightData[i].direction = Vector4(-light->WorldDirection(), 0.0f);
+        lightData[i].attenuation = Vector4(1.0f / Max(light->Range(), M_EPSILON), cutoff, 1.0f / (1.0f - cutoff), 1.0f);
+        lightData[i].color = light->EffectiveColor();
+        lightData[i].shadowParameters = Vector4::ONE; // Assume unshadowed
 
         // Check if not shadowcasting or beyond shadow range
         if (!drawShadows || light->ShadowStrength() >= 1.0f)
@@ -1288,16 +2118,17 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
         dirLight->InitShadowViews();
         std::vector<ShadowView>& shadowViews = dirLight->ShadowViews();
 
+        // Directional light needs its own frustum query, as the shadow cameras are typically far outside the main view
+        // But the query is only performed later when the shadow map can be focused to visible scene. All splits are queried at once
+        size_t casterListIdx = shadowMap.freeCasterListIdx++;
+        if (shadowMap.shadowCasters.size() < shadowMap.freeCasterListIdx)
+            shadowMap.shadowCasters.resize(shadowMap.freeCasterListIdx);
+
         for (size_t i = 0; i < shadowViews.size(); ++i)
         {
             ShadowView& view = shadowViews[i];
 
-            // Directional light needs a new frustum query for each split, as the shadow cameras are typically far outside the main view
-            // But queries are only performed later when the shadow map can be focused to visible scene
-            view.casterListIdx = shadowMap.freeCasterListIdx++;
-            if (shadowMap.shadowCasters.size() < shadowMap.freeCasterListIdx)
-                shadowMap.shadowCasters.resize(shadowMap.freeCasterListIdx);
-
+            view.casterListIdx = casterListIdx;
             view.dynamicQueueIdx = shadowMap.freeQueueIdx++;
             if (shadowMap.shadowBatches.size() < shadowMap.freeQueueIdx)
                 shadowMap.shadowBatches.resize(shadowMap.freeQueueIdx);
@@ -1311,17 +2142,15 @@ void Renderer::ProcessLightsWork(Task*, unsigned)
         workQueue->QueueTasks(lightTaskIdx, reinterpret_cast<Task**>(&collectShadowCastersTasks[0]));
 }
 
-void Renderer::CollectBatchesWork(Task* task_, unsigned threadIndex)
+void Renderer::CollectBatchesWork(ArenaSpan<std::pair<Octant*, unsigned char> > octants, size_t begin, size_t end, unsigned threadIndex, bool staticOnly)
 {
     ZoneScoped;
 
-    CollectBatchesTask* task = static_cast<CollectBatchesTask*>(task_);
     ThreadBatchResult& result = batchResults[threadIndex];
-    bool threaded = workQueue->NumThreads() > 1;
 
-    std::vector<std::pair<Octant*, unsigned char> >& octants = task->octants;
-    std::vector<Batch>& opaqueQueue = threaded ? result.opaqueBatches : opaqueBatches.batches;
-    std::vector<Batch>& alphaQueue = threaded ? result.alphaBatches : alphaBatches.batches;
+    ArenaVector<Batch>& opaqueQueue = result.opaqueBatches;
+    ArenaVector<Batch>& alphaQueue = result.alphaBatches;
+    ArenaVector<Batch>& staticQueue = result.staticBatches;
 
     const Matrix3x4& viewMatrix = camera->ViewMatrix();
     Vector3 viewZ = Vector3(viewMatrix.m20, viewMatrix.m21, viewMatrix.m22);
@@ -1329,91 +2158,87 @@ void Renderer::CollectBatchesWork(Task* task_, unsigned threadIndex)
     float farClipMul = 32767.0f / camera->FarClip();
 
     // Scan octants for geometries
-    for (auto it = octants.begin(); it != octants.end(); ++it)
+    for (auto it = octants.begin() + begin; it != octants.begin() + end; ++it)
     {
         Octant* octant = it->first;
         unsigned char planeMask = it->second;
-        const std::vector<Drawable*>& drawables = octant->Drawables();
 
-        for (auto dIt = drawables.begin(); dIt != drawables.end(); ++dIt)
+        // Test geometries against the frustum using the octant's culling data. Only the visible drawables are accessed
+        // Note: with hardware occlusion, per-geometry occlusion tests are skipped to strike a balance between performance and accuracy,
+        // as octants are already tested with combined actual drawable bounds. The software occlusion buffer is cheap to test per geometry
+        octant->CullDrawables(frustum, planeMask, DF_GEOMETRY, viewMask, [&](Drawable* drawable)
         {
-            Drawable* drawable = *dIt;
+            // Opaque batches of static, non-skinned drawables without LOD levels can be cached. The drawables are still prepared each frame
+            bool cacheable = separateStaticBatches && (drawable->Flags() & (DF_STATIC | DF_GEOMETRY_TYPE_BITS | DF_HAS_LOD_LEVELS)) == DF_STATIC;
+            if (staticOnly && !cacheable)
+                return;
+            if (occlusionBufferValid && !occlusionBuffer->IsVisible(drawable->WorldBoundingBox()))
+                return;
+            if (!drawable->OnPrepareRender(frameNumber, camera))
+                return;
 
-            if (drawable->TestFlag(DF_GEOMETRY) && (drawable->LayerMask() & viewMask))
-            {
-                const BoundingBox& geometryBox = drawable->WorldBoundingBox();
+            const BoundingBox& geometryBox = drawable->WorldBoundingBox();
+            result.geometryBounds.Merge(geometryBox);
 
-                // Note: to strike a balance between performance and occlusion accuracy, per-geometry occlusion tests are skipped for now,
-                // as octants are already tested with combined actual drawable bounds
-                if ((!planeMask || frustum.IsInsideMaskedFast(geometryBox, planeMask)) && drawable->OnPrepareRender(frameNumber, camera))
-                {
-                    result.geometryBounds.Merge(geometryBox);
-
-                    Vector3 center = geometryBox.Center();
-                    Vector3 edge = geometryBox.Size() * 0.5f;
-
-                    float viewCenterZ = viewZ.DotProduct(center) + viewMatrix.m23;
-                    float viewEdgeZ = absViewZ.DotProduct(edge);
-                    result.minZ = Min(result.minZ, viewCenterZ - viewEdgeZ);
-                    result.maxZ = Max(result.maxZ, viewCenterZ + viewEdgeZ);
- 
-                    Batch newBatch;
-
-                    unsigned short distance = (unsigned short)(drawable->Distance() * farClipMul);
-                    const SourceBatches& batches = static_cast<GeometryDrawable*>(drawable)->Batches();
-                    size_t numGeometries = batches.NumGeometries();
-        
-                    for (size_t j = 0; j < numGeometries; ++j)
-                    {
-                        Material* material = batches.GetMaterial(j);
+            Vector3 center = geometryBox.Center();
+            Vector3 edge = geometryBox.Size() * 0.5f;
 
-                        // Assume opaque first
-                        newBatch.pass = material->GetPass(PASS_OPAQUE);
-                        newBatch.geometry = batches.GetGeometry(j);
-                        newBatch.programBits = (unsigned char)(drawable->Flags() & DF_GEOMETRY_TYPE_BITS);
-                        newBatch.geomIndex = (unsigned char)j;
+            float viewCenterZ = viewZ.DotProduct(center) + viewMatrix.m23;
+            float viewEdgeZ = absViewZ.DotProduct(edge);
+            result.minZ = Min(result.minZ, viewCenterZ - viewEdgeZ);
+            result.maxZ = Max(result.maxZ, viewCenterZ + viewEdgeZ);
 
-                        if (!newBatch.programBits)
-                            newBatch.worldTransform = &drawable->WorldTransform();
-                        else
-                            newBatch.drawable = static_cast<GeometryDrawable*>(drawable);
+            Batch newBatch;
 
-                        if (newBatch.pass)
-                        {
-                            // Perform distance sort in addition to state sort
-                            if (newBatch.pass->lastSortKey.first != frameNumber || newBatch.pass->lastSortKey.second > distance)
-                            {
-                                newBatch.pass->lastSortKey.first = frameNumber;
-                                newBatch.pass->lastSortKey.second = distance;
-                            }
-                            if (newBatch.geometry->lastSortKey.first != frameNumber || newBatch.geometry->lastSortKey.second > distance + (unsigned short)j)
-                            {
-                                newBatch.geometry->lastSortKey.first = frameNumber;
-                                newBatch.geometry->lastSortKey.second = distance + (unsigned short)j;
-                            }
-
-                            opaqueQueue.push_back(newBatch);
-                        }
-                        else
-                        {
-                            // If not opaque, try transparent
-                            newBatch.pass = material->GetPass(PASS_ALPHA);
-                            if (!newBatch.pass)
-                                continue;
+            unsigned short distance = (unsigned short)(drawable->Distance() * farClipMul);
+            const SourceBatches& batches = static_cast<GeometryDrawable*>(drawable)->Batches();
+            size_t numGeometries = batches.NumGeometries();
 
-                            newBatch.distance = drawable->Distance();
-                            alphaQueue.push_back(newBatch);
-                        }
+            for (size_t j = 0; j < numGeometries; ++j)
+            {
+                Material* material = batches.GetMaterial(j);
+
+                // Assume opaque first
+                newBatch.pass = material->GetPass(PASS_OPAQUE);
+                newBatch.geometry = batches.GetGeometry(j);
+                newBatch.programBits = (unsigned char)(drawable->Flags() & DF_GEOMETRY_TYPE_BITS);
+                newBatch.geomIndex = (unsigned char)j;
+                newBatch.distance = drawable->Distance();
+
+                if (!newBatch.programBits)
+                    newBatch.worldTransform = &drawable->WorldTransform();
+                else
+                    newBatch.drawable = static_cast<GeometryDrawable*>(drawable);
+
+                if (newBatch.pass)
+                {
+                    // Track the nearest distance of each pass to sort passes into coarse front-to-back layers
+                    if (newBatch.pass->lastSortKey.first != frameNumber || newBatch.pass->lastSortKey.second > distance)
+                    {
+                        newBatch.pass->lastSortKey.first = frameNumber;
+                        newBatch.pass->lastSortKey.second = distance;
                     }
+
+                    if (!cacheable)
+                        opaqueQueue.push_back(newBatch);
+                    else if (!reuseStaticBatches)
+                        staticQueue.push_back(newBatch);
+                }
+                else
+                {
+                    // If not opaque, try transparent
+                    newBatch.pass = material->GetPass(PASS_ALPHA);
+                    if (!newBatch.pass || staticOnly)
+                        continue;
+
+                    alphaQueue.push_back(newBatch);
                 }
             }
-        }
+        });
     }
-
-    numPendingBatchTasks.fetch_add(-1);
 }
 
-void Renderer::CollectShadowCastersWork(Task* task, unsigned)
+void Renderer::CollectShadowCastersWork(Task* task, unsigned threadIndex)
 {
     ZoneScoped;
 
@@ -1426,7 +2251,10 @@ void Renderer::CollectShadowCastersWork(Task* task, unsigned)
 
     if (lightType == LIGHT_POINT)
     {
-        // Point light: perform only one sphere query, then check which of the point light sides are visible
+        // Point light: query all sides in one traversal, and check which of the point light sides are visible
+        Frustum frusta[MAX_QUERY_FRUSTA];
+        size_t numFrusta = 0;
+
         for (size_t i = 0; i < shadowViews.size(); ++i)
         {
             // Check if each of the sides is in view. Do not process if isn't. Rendering will be no-op this frame, but cached contents are discarded once comes into view again
@@ -1438,20 +2266,30 @@ void Renderer::CollectShadowCastersWork(Task* task, unsigned)
                 view.renderMode = RENDER_STATIC_LIGHT_CACHED;
                 view.viewport = IntRect::ZERO;
                 view.lastViewport = IntRect::ZERO;
+                view.casterMask = 0;
+            }
+            else
+            {
+                view.casterMask = 1 << numFrusta;
+                frusta[numFrusta++] = view.shadowFrustum;
             }
         }
 
-        std::vector<Drawable*>& shadowCasters = shadowMap.shadowCasters[shadowViews[0].casterListIdx];
-        octree->FindDrawables(shadowCasters, light->WorldSphere(), DF_GEOMETRY | DF_CAST_SHADOWS);
+        ArenaVector<FrustumQueryResult>& shadowCasters = shadowMap.shadowCasters[shadowViews[0].casterListIdx];
+        shadowCasters.SetArena(workQueue->ThreadArena(threadIndex));
+        if (numFrusta)
+            octree->FindDrawablesMasked(shadowCasters, frusta, numFrusta, DF_GEOMETRY | DF_CAST_SHADOWS);
     }
     else if (lightType == LIGHT_SPOT)
     {
         // Spot light: perform query for the spot frustum
         light->SetupShadowView(0, camera);
         ShadowView& view = shadowViews[0];
+        view.casterMask = 1;
 
-        std::vector<Drawable*>& shadowCasters = shadowMap.shadowCasters[view.casterListIdx];
-        octree->FindDrawablesMasked(shadowCasters, view.shadowFrustum, DF_GEOMETRY | DF_CAST_SHADOWS);
+        ArenaVector<FrustumQueryResult>& shadowCasters = shadowMap.shadowCasters[view.casterListIdx];
+        shadowCasters.SetArena(workQueue->ThreadArena(threadIndex));
+        octree->FindDrawablesMasked(shadowCasters, &view.shadowFrustum, 1, DF_GEOMETRY | DF_CAST_SHADOWS);
     }
 }
 
@@ -1464,63 +2302,107 @@ void Renderer::ProcessShadowCastersWork(Task*, unsigned)
     ZoneScoped;
 
     // Queue shadow batch collection tasks. These will also perform shadow batch sorting tasks when done
-    if (drawShadows)
-    {
-        size_t shadowTaskIdx = 0;
-        LightDrawable* lastLight = nullptr;
+    size_t shadowTaskIdx = 0;
+    LightDrawable* lastLight = nullptr;
 
-        for (size_t i = 0; i < NUM_SHADOW_MAPS; ++i)
+    for (size_t i = 0; i < NUM_SHADOW_MAPS; ++i)
+    {
+        ShadowMap& shadowMap = shadowMaps[i];
+        for (size_t j = 0; j < shadowMap.shadowViews.size(); ++j)
         {
-            ShadowMap& shadowMap = shadowMaps[i];
-            for (size_t j = 0; j < shadowMap.shadowViews.size(); ++j)
-            {
-                LightDrawable* light = shadowMap.shadowViews[j]->light;
-                // For a point light, make only one task that will handle all of the views and skip rest
-                if (light->GetLightType() == LIGHT_POINT && light == lastLight)
-                    continue;
+            LightDrawable* light = shadowMap.shadowViews[j]->light;
+            // For a point or directional light, make only one task that will handle all of the views and skip rest
+            if (light->GetLightType() != LIGHT_SPOT && light == lastLight)
+                continue;
 
-                lastLight = light;
+            lastLight = light;
 
-                if (collectShadowBatchesTasks.size() <= shadowTaskIdx)
-                    collectShadowBatchesTasks.push_back(new CollectShadowBatchesTask(this, &Renderer::CollectShadowBatchesWork));
-                collectShadowBatchesTasks[shadowTaskIdx]->shadowMapIdx = i;
-                collectShadowBatchesTasks[shadowTaskIdx]->viewIdx = j;
-                numPendingShadowViews[i].fetch_add(1);
-                ++shadowTaskIdx;
-            }
+            if (collectShadowBatchesTasks.size() <= shadowTaskIdx)
+                collectShadowBatchesTasks.push_back(new CollectShadowBatchesTask(this, &Renderer::CollectShadowBatchesWork));
+            collectShadowBatchesTasks[shadowTaskIdx]->shadowMapIdx = i;
+            collectShadowBatchesTasks[shadowTaskIdx]->viewIdx = j;
+            numPendingShadowViews[i].fetch_add(1);
+            ++shadowTaskIdx;
         }
+    }
 
-        if (shadowTaskIdx > 0)
-            workQueue->QueueTasks(shadowTaskIdx, reinterpret_cast<Task**>(&collectShadowBatchesTasks[0]));
+    if (shadowTaskIdx > 0)
+        workQueue->QueueTasks(shadowTaskIdx, reinterpret_cast<Task**>(&collectShadowBatchesTasks[0]));
+
+    // Finally copy correct shadow matrices for the localized light data
+    // Note: directional light shadow matrices may still be pending, but they are not included here
+    for (size_t i = 0; i < lights.size(); ++i)
+    {
+        LightDrawable* light = lights[i];
+
+        if (light->ShadowMap())
+        {
+            lightData[i].shadowParameters = light->ShadowParameters();
+            lightData[i].shadowMatrix = light->ShadowViews()[0].shadowMatrix;
+        }
     }
+}
+
+void Renderer::ProcessClustersWork(Task*, unsigned)
+{
+    ZoneScoped;
 
     // Clear per-cluster light data from previous frame, update cluster frustums and bounding boxes if camera changed, then queue light culling tasks for the needed scene range
     DefineClusterFrustums();
-    memset(clusterData, 0, MAX_LIGHTS_CLUSTER * NUM_CLUSTER_X * NUM_CLUSTER_Y * NUM_CLUSTER_Z);
-    for (size_t z = 0; z < NUM_CLUSTER_Z; ++z)
+    memset(clusterData, 0, 2 * clusterGridSize.x * clusterGridSize.y * clusterGridSize.z * sizeof(unsigned));
+    for (size_t z = 0; z < sliceLightIndices.size(); ++z)
+        sliceLightIndices[z].clear();
+    lightDataDirty = true;
+
+    // Transform the light bounds to view space once, instead of in each Z-slice
+    const Matrix3x4& cameraView = camera->ViewMatrix();
+    clusterLightBounds.resize(lights.size());
+
+    for (size_t i = 0; i < lights.size(); ++i)
+    {
+        LightDrawable* light = lights[i];
+        ClusterLightBounds& bounds = clusterLightBounds[i];
+
+        bounds.spot = light->GetLightType() == LIGHT_SPOT;
+        if (bounds.spot)
+        {
+            bounds.frustum = light->WorldFrustum().Transformed(cameraView);
+            bounds.boundingBox.Define(bounds.frustum);
+            bounds.sphere.Define(bounds.frustum);
+            bounds.minZ = bounds.boundingBox.min.z;
+            bounds.maxZ = bounds.boundingBox.max.z;
+        }
+        else
+        {
+            bounds.sphere.Define(cameraView * light->WorldPosition(), light->Range());
+            bounds.minZ = bounds.sphere.center.z - light->Range();
+            bounds.maxZ = bounds.sphere.center.z + light->Range();
+        }
+    }
+
+    // Z-slices are in increasing depth order, so the slices within the geometry depth range are contiguous
+    size_t zBegin = clusterGridSize.z;
+    size_t zEnd = 0;
+    for (size_t z = 0; z < (size_t)clusterGridSize.z; ++z)
     {
-        size_t idx = z * NUM_CLUSTER_X * NUM_CLUSTER_Y;
+        size_t idx = z * clusterGridSize.x * clusterGridSize.y;
         const Frustum& clusterFrustum = clusterCullData[idx].frustum;
         if (minZ > clusterFrustum.vertices[4].z || maxZ < clusterFrustum.vertices[0].z)
             continue;
-        workQueue->QueueTask(cullLightsTasks[z]);
+        zBegin = Min(zBegin, z);
+        zEnd = z + 1;
     }
 
-    // Finally copy correct shadow matrices for the localized light data
-    // Note: directional light shadow matrices may still be pending, but they are not included here
-    for (size_t i = 0; i < lights.size(); ++i)
+    if (zBegin < zEnd)
     {
-        LightDrawable* light = lights[i];
-
-        if (light->ShadowMap())
+        workQueue->ParallelFor(cullLightsJob, zBegin, zEnd, 1, [this](size_t begin, size_t end, unsigned threadIndex)
         {
-            lightData[i + 1].shadowParameters = light->ShadowParameters();
-            lightData[i + 1].shadowMatrix = light->ShadowViews()[0].shadowMatrix;
-        }
+            CullLightsToFrustumWork(begin, end, threadIndex);
+        });
     }
 }
 
-void Renderer::CollectShadowBatchesWork(Task* task_, unsigned)
+void Renderer::CollectShadowBatchesWork(Task* task_, unsigned threadIndex)
 {
     ZoneScoped;
 
@@ -1528,33 +2410,58 @@ void Renderer::CollectShadowBatchesWork(Task* task_, unsigned)
     ShadowMap& shadowMap = shadowMaps[task->shadowMapIdx];
     size_t viewIdx = task->viewIdx;
 
-    for (;;)
+    // Focus directional light shadow cameras to the visible geometry combined bounds, and query for shadowcasters of all splits late
+    if (shadowMap.shadowViews[viewIdx]->light->GetLightType() == LIGHT_DIRECTIONAL)
     {
-        ShadowView& view = *shadowMap.shadowViews[viewIdx];
-
-        LightDrawable* light = view.light;
-        LightType lightType = light->GetLightType();
+        LightDrawable* light = shadowMap.shadowViews[viewIdx]->light;
+        Frustum frusta[MAX_QUERY_FRUSTA];
+        size_t numFrusta = 0;
 
-        float splitMinZ = minZ, splitMaxZ = maxZ;
-
-        // Focus directional light shadow camera to the visible geometry combined bounds, and query for shadowcasters late
-        if (lightType == LIGHT_DIRECTIONAL)
+        for (size_t i = viewIdx; i < shadowMap.shadowViews.size() && shadowMap.shadowViews[i]->light == light; ++i)
         {
-            if (!light->SetupShadowView(viewIdx, camera, &geometryBounds))
+            ShadowView& view = *shadowMap.shadowViews[i];
+            view.casterMask = 0;
+
+            if (!light->SetupShadowView(i - task->viewIdx, camera, &geometryBounds))
                 view.viewport = IntRect::ZERO;
             else
             {
-                splitMinZ = Max(splitMinZ, view.splitMinZ);
-                splitMaxZ = Min(splitMaxZ, view.splitMaxZ);
+                float splitMinZ = Max(minZ, view.splitMinZ);
+                float splitMaxZ = Min(maxZ, view.splitMaxZ);
 
                 // Before querying (which is potentially expensive), check for degenerate depth range or frustum outside split
                 if (splitMinZ >= splitMaxZ || splitMinZ > view.splitMaxZ || splitMaxZ < view.splitMinZ)
                     view.viewport = IntRect::ZERO;
                 else
-                    octree->FindDrawablesMasked(shadowMap.shadowCasters[view.casterListIdx], view.shadowFrustum, DF_GEOMETRY | DF_CAST_SHADOWS);
+                {
+                    view.casterMask = 1 << numFrusta;
+                    frusta[numFrusta++] = view.shadowFrustum;
+                }
             }
         }
 
+        if (numFrusta)
+        {
+            ArenaVector<FrustumQueryResult>& shadowCasters = shadowMap.shadowCasters[shadowMap.shadowViews[viewIdx]->casterListIdx];
+            shadowCasters.SetArena(workQueue->ThreadArena(threadIndex));
+            octree->FindDrawablesMasked(shadowCasters, frusta, numFrusta, DF_GEOMETRY | DF_CAST_SHADOWS);
+        }
+    }
+
+    for (;;)
+    {
+        ShadowView& view = *shadowMap.shadowViews[viewIdx];
+
+        LightDrawable* light = view.light;
+        LightType lightType = light->GetLightType();
+
+        float splitMinZ = minZ, splitMaxZ = maxZ;
+        if (lightType == LIGHT_DIRECTIONAL)
+        {
+            splitMinZ = Max(splitMinZ, view.splitMinZ);
+            splitMaxZ = Min(splitMaxZ, view.splitMaxZ);
+        }
+
         // Skip view? (no geometry, out of range or point light face not in view)
         if (view.viewport == IntRect::ZERO)
         {
@@ -1563,9 +2470,8 @@ void Renderer::CollectShadowBatchesWork(Task* task_, unsigned)
         }
         else
         {
-            const Frustum& shadowFrustum = view.shadowFrustum;
             const Matrix3x4& lightView = view.shadowCamera->ViewMatrix();
-            const std::vector<Drawable*>& initialShadowCasters = shadowMap.shadowCasters[view.casterListIdx];
+            const ArenaVector<FrustumQueryResult>& initialShadowCasters = shadowMap.shadowCasters[view.casterListIdx];
 
             bool dynamicOrDirLight = lightType == LIGHT_DIRECTIONAL || !light->IsStatic();
             bool dynamicCastersMoved = false;
@@ -1582,16 +2488,16 @@ void Renderer::CollectShadowBatchesWork(Task* task_, unsigned)
 
             for (auto it = initialShadowCasters.begin(); it != initialShadowCasters.end(); ++it)
             {
-                Drawable* drawable = *it;
+                // Check shadowcaster frustum visibility for this view; point light casters may be visible in view, but not in each cube map face
+                if (!(it->frustumMask & view.casterMask))
+                    continue;
+
+                Drawable* drawable = it->drawable;
                 const BoundingBox& geometryBox = drawable->WorldBoundingBox();
 
                 bool inView = drawable->InView(frameNumber);
                 bool staticNode = drawable->IsStatic();
 
-                // Check shadowcaster frustum visibility for point lights; may be visible in view, but not in each cube map face
-                if (lightType == LIGHT_POINT && !shadowFrustum.IsInsideFast(geometryBox))
-                    continue;
-
                 // Furthermore, check by bounding box extrusion if out-of-view or directional light shadowcaster actually contributes to visible geometry shadowing or if it can be skipped
                 // This is done only for dynamic objects or dynamic lights' shadows; cached static shadowmap needs to render everything
                 if ((!staticNode || dynamicOrDirLight) && !inView)
@@ -1723,8 +2629,8 @@ void Renderer::CollectShadowBatchesWork(Task* task_, unsigned)
             }
         }
 
-        // For a point light, process all its views in the same task
-        if (lightType == LIGHT_POINT && viewIdx < shadowMap.shadowViews.size() - 1 && shadowMap.shadowViews[viewIdx + 1]->light == light)
+        // For a point or directional light, process all its views in the same task
+        if (lightType != LIGHT_SPOT && viewIdx < shadowMap.shadowViews.size() - 1 && shadowMap.shadowViews[viewIdx + 1]->light == light)
             ++viewIdx;
         else
             break;
@@ -1735,82 +2641,200 @@ void Renderer::CollectShadowBatchesWork(Task* task_, unsigned)
         SortShadowBatches(shadowMap);
 }
 
-void Renderer::CullLightsToFrustumWork(Task* task, unsigned)
+void Renderer::SortBatchesWork(size_t begin, size_t end, unsigned threadIndex)
 {
     ZoneScoped;
 
-    // Cull lights against each cluster frustum on the given Z-level
-    size_t z = static_cast<CullLightsTask*>(task)->z;
-    const Matrix3x4& cameraView = camera->ViewMatrix();
+    FrameArena* arena = workQueue->ThreadArena(threadIndex);
 
-    // Clear old light data first
-    size_t idx = z * NUM_CLUSTER_X * NUM_CLUSTER_Y;
-    ClusterCullData* cullData = &clusterCullData[idx];
-    for (size_t i = 0; i < NUM_CLUSTER_X * NUM_CLUSTER_Y; ++i)
+    for (size_t i = begin; i < end; ++i)
     {
-        cullData->numLights = 0;
-        ++cullData;
+        // Even indices are opaque batches, odd are alpha
+        ThreadBatchResult& res = batchResults[i / 2];
+        bool alpha = (i & 1) != 0;
+        const ArenaVector<Batch>& batches = alpha ? res.alphaBatches : res.opaqueBatches;
+        size_t count = batches.size();
+
+        BatchSortKey* keys = static_cast<BatchSortKey*>(arena->Allocate(count * 2 * sizeof(BatchSortKey), alignof(BatchSortKey)));
+        if (count)
+        {
+            CalculateSortKeys(batches.begin(), keys, count, alpha ? SORT_DISTANCE : SORT_STATE_AND_DISTANCE, camera->FarClip());
+            SortBatchKeys(keys, keys + count, count);
+        }
+
+        (alpha ? res.alphaKeys : res.opaqueKeys) = ArenaSpan<BatchSortKey>(keys, count);
     }
+}
 
-    // Go through lights and add to each affected cluster. Do culling checks both ways to reduce false positives
-    for (size_t i = 0; i < lights.size(); ++i)
+void Renderer::MergeBatchesWork(size_t begin, size_t end, unsigned threadIndex)
+{
+    ZoneScoped;
+
+    size_t numThreads = workQueue->NumThreads();
+    size_t* positions = static_cast<size_t*>(workQueue->ThreadArena(threadIndex)->Allocate(numThreads * sizeof(size_t)));
+
+    for (size_t i = begin; i < end; ++i)
     {
-        LightDrawable* light = lights[i];
-        LightType lightType = light->GetLightType();
+        size_t queueIndex = i < numMergeRanges[0] ? 0 : 1;
+        size_t rangeIndex = queueIndex ? i - numMergeRanges[0] : i;
+        BatchQueue& queue = queueIndex ? alphaBatches : opaqueBatches;
+        const size_t* rangeBounds = &mergeBounds[((queueIndex ? numMergeRanges[0] + 1 : 0) + rangeIndex) * numThreads];
+
+        memcpy(positions, rangeBounds, numThreads * sizeof(size_t));
+        if (queue.batches.size())
+            MergeBatches(&sortRuns[queueIndex * numThreads], positions, rangeBounds + numThreads, numThreads, &queue.batches[mergeOffsets[i]]);
+    }
+}
 
-        if (lightType == LIGHT_POINT)
-        {
-            Sphere bounds(cameraView * light->WorldPosition(), light->Range());
-            float minViewZ = bounds.center.z - light->Range();
-            float maxViewZ = bounds.center.z + light->Range();
+void Renderer::RecordCommandsWork(size_t begin, size_t end, unsigned)
+{
+    ZoneScoped;
 
-            idx = z * NUM_CLUSTER_X * NUM_CLUSTER_Y;
-            cullData = &clusterCullData[idx];
-            if (minViewZ > cullData->frustum.vertices[4].z || maxViewZ < cullData->frustum.vertices[0].z)
-                continue;
+    BatchQueue* queues[] = { &staticBatches.batches, &opaqueBatches, &alphaBatches };
 
-            for (size_t y = 0; y < NUM_CLUSTER_Y; ++y)
-            {
-                for (size_t x = 0; x < NUM_CLUSTER_X; ++x)
-                {
-                    if (cullData->numLights < MAX_LIGHTS_CLUSTER)
-                    {
-                        if (bounds.IsInsideFast(cullData->boundingBox) && cullData->frustum.IsInsideFast(bounds))
-                            clusterData[(idx << 4) + cullData->numLights++] = (unsigned char)(i + 1);
-                    }
+    // The range covers the static, opaque and alpha queues in order
+    for (size_t i = 0; i < 3 && end; ++i)
+    {
+        BatchQueue& queue = *queues[i];
+        size_t count = queue.commands.size();
+        size_t queueBegin = Min(begin, count);
+        size_t queueEnd = Min(end, count);
 
-                    ++idx;
-                    ++cullData;
-                }
-            }
+        if (queueEnd > queueBegin)
+            RecordRenderCommands(&queue.batches[queueBegin], &queue.commands[queueBegin], queueEnd - queueBegin);
+
+        begin -= queueBegin;
+        end -= queueEnd;
+    }
+}
+
+void Renderer::AddOccluderTrianglesWork(size_t begin, size_t end, unsigned threadIndex)
+{
+    ZoneScoped;
+
+    ArenaVector<OcclusionTriangle>& triangles = occluderTriangles[threadIndex];
+
+    for (size_t i = begin; i < end; ++i)
+    {
+        GeometryDrawable* drawable = static_cast<GeometryDrawable*>(occluders[i]);
+
+        // Only static geometry has its vertices at the world transform on the CPU
+        if (drawable->Flags() & DF_GEOMETRY_TYPE_BITS)
+            continue;
+        if (drawable->MaxDistance() > 0.0f && camera->Distance(drawable->WorldPosition()) > drawable->MaxDistance())
+            continue;
+
+        const SourceBatches& batches = drawable->Batches();
+        size_t numGeometries = batches.NumGeometries();
+        for (size_t j = 0; j < numGeometries; ++j)
+            occlusionBuffer->AddTriangles(triangles, drawable->WorldTransform(), batches.GetGeometry(j));
+    }
+}
+
+void Renderer::RasterizeOccludersWork(size_t begin, size_t end, unsigned)
+{
+    ZoneScoped;
+
+    occlusionBuffer->Rasterize(occluderTriangleSpans.Get(), workQueue->NumThreads(), (int)begin, (int)end);
+}
+
+void Renderer::CullLightsToFrustumWork(size_t begin, size_t end, unsigned)
+{
+    ZoneScoped;
+
+    size_t numX = clusterGridSize.x;
+    size_t numY = clusterGridSize.y;
+    size_t clustersPerSlice = numX * numY;
+    size_t rowStride = (numX + 3) & ~(size_t)3;
+    size_t numTiles = rowStride / 4;
+
+    // Cull lights against each cluster on the given Z-levels
+    for (size_t z = begin; z < end; ++z)
+    {
+        size_t sliceStart = z * clustersPerSlice;
+        const ClusterSliceBounds& slice = clusterSliceBounds[z];
+        const Frustum& sliceFrustum = clusterCullData[sliceStart].frustum;
+
+        // Find the lights overlapping the slice's depth range first
+        std::vector<unsigned>& candidates = sliceLights[z];
+        candidates.clear();
+        for (size_t i = 0; i < clusterLightBounds.size(); ++i)
+        {
+            const ClusterLightBounds& bounds = clusterLightBounds[i];
+            if (bounds.minZ <= sliceFrustum.vertices[4].z && bounds.maxZ >= sliceFrustum.vertices[0].z && bounds.sphere.IsInsideFast(slice.box) != OUTSIDE)
+                candidates.push_back((unsigned)i);
         }
-        else if (lightType == LIGHT_SPOT)
+
+        // Test each light's bounding sphere coarse to fine: 4-column tiles spanning the slice, then rows, then the clusters of the remaining tiles 4 at a time.
+        // Refine the clusters that pass with the frustum tests to reduce false positives
+        std::vector<std::pair<unsigned, unsigned> >& hits = sliceLightHits[z];
+        hits.clear();
+
+        for (auto it = candidates.begin(); it != candidates.end(); ++it)
         {
-            Frustum bounds(light->WorldFrustum().Transformed(cameraView));
-            BoundingBox boundsBox(bounds);
-            float minViewZ = boundsBox.min.z;
-            float maxViewZ = boundsBox.max.z;
-
-            idx = z * NUM_CLUSTER_X * NUM_CLUSTER_Y;
-            cullData = &clusterCullData[idx];
-            if (minViewZ > cullData->frustum.vertices[4].z || maxViewZ < cullData->frustum.vertices[0].z)
+            const ClusterLightBounds& bounds = clusterLightBounds[*it];
+
+            unsigned tileMask = 0;
+            for (size_t t = 0; t < numTiles; t += 4)
+                tileMask |= slice.tiles.IsInsideFast4(bounds.sphere, t) << t;
+            if (!tileMask)
                 continue;
 
-            for (size_t y = 0; y < NUM_CLUSTER_Y; ++y)
+            for (size_t y = 0; y < numY; ++y)
             {
-                for (size_t x = 0; x < NUM_CLUSTER_X; ++x)
+                if (bounds.sphere.IsInsideFast(slice.rows[y]) == OUTSIDE)
+                    continue;
+
+                for (size_t t = 0; t < numTiles; ++t)
                 {
-                    if (cullData->numLights < MAX_LIGHTS_CLUSTER)
+                    if (!(tileMask & (1u << t)))
+                        continue;
+
+                    unsigned clusterMask = slice.clusters.IsInsideFast4(bounds.sphere, y * rowStride + t * 4);
+                    if (!clusterMask)
+                        continue;
+
+                    for (size_t i = 0; i < 4; ++i)
                     {
-                        if (bounds.IsInsideFast(cullData->boundingBox) && cullData->frustum.IsInsideFast(boundsBox))
-                            clusterData[(idx << 4) + cullData->numLights++] = (unsigned char)(i + 1);
-                    }
+                        if (!(clusterMask & (1 << i)))
+                            continue;
 
-                    ++idx;
-                    ++cullData;
+                        size_t x = t * 4 + i;
+                        const ClusterCullData& cullData = clusterCullData[sliceStart + y * numX + x];
+                        if (bounds.spot)
+                        {
+                            if (bounds.frustum.IsInsideFast(cullData.boundingBox) == OUTSIDE || cullData.frustum.IsInsideFast(bounds.boundingBox) == OUTSIDE)
+                                continue;
+                        }
+                        else if (cullData.frustum.IsInsideFast(bounds.sphere) == OUTSIDE)
+                            continue;
+
+                        hits.push_back(std::make_pair((unsigned)(y * numX + x), *it));
+                    }
                 }
             }
         }
+
+        // Group the hits by cluster into the slice's index list. The lights stay in ascending order within each cluster
+        unsigned* cluster = &clusterData[2 * sliceStart];
+        for (auto it = hits.begin(); it != hits.end(); ++it)
+            ++cluster[2 * it->first + 1];
+
+        unsigned offset = 0;
+        for (size_t i = 0; i < clustersPerSlice; ++i)
+        {
+            cluster[2 * i] = offset;
+            offset += cluster[2 * i + 1];
+            cluster[2 * i + 1] = 0;
+        }
+
+        std::vector<unsigned>& indices = sliceLightIndices[z];
+        indices.resize(hits.size());
+        for (auto it = hits.begin(); it != hits.end(); ++it)
+        {
+            unsigned* dest = &cluster[2 * it->first];
+            indices[dest[0] + dest[1]++] = it->second;
+        }
     }
 }
 
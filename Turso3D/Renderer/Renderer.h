@@ -7,14 +7,17 @@
 #include "../Math/Frustum.h"
 #include "../Object/AutoPtr.h"
 #include "../Resource/Image.h"
-#include "../Thread/WorkQueue.h"
+#include "../Thread/TaskGraph.h"
+#include "../Time/Timer.h"
 #include "Batch.h"
+#include "OcclusionBuffer.h"
 
 #include <atomic>
 
 class Camera;
 class FrameBuffer;
 class GeometryDrawable;
+class GpuRingBuffer;
 class Graphics;
 class LightDrawable;
 class LightEnvironment;
@@ -27,19 +30,17 @@ class ShaderProgram;
 class Texture;
 class UniformBuffer;
 class VertexBuffer;
-struct CollectOctantsTask;
-struct CollectBatchesTask;
 struct CollectShadowBatchesTask;
 struct CollectShadowCastersTask;
-struct CullLightsTask;
+struct FrustumQueryResult;
+struct MaterialState;
 struct ShadowView;
 struct ThreadOctantResult;
 
-static const size_t NUM_CLUSTER_X = 16;
-static const size_t NUM_CLUSTER_Y = 8;
-static const size_t NUM_CLUSTER_Z = 8;
-static const size_t MAX_LIGHTS = 255;
-static const size_t MAX_LIGHTS_CLUSTER = 16;
+static const int DEFAULT_CLUSTER_X = 16;
+static const int DEFAULT_CLUSTER_Y = 8;
+static const int DEFAULT_CLUSTER_Z = 8;
+static const int MAX_CLUSTER_GRID_SIZE = 128;
 static const size_t NUM_OCTANT_TASKS = 9;
 static const size_t NUM_SHADOW_MAPS = 2; // One for directional lights and another for the rest
 
@@ -49,6 +50,17 @@ static const size_t TU_SHADOWATLAS = 9;
 static const size_t TU_FACESELECTION1 = 10;
 static const size_t TU_FACESELECTION2 = 11;
 static const size_t TU_LIGHTCLUSTERDATA = 12;
+static const size_t TU_SKINPALETTES = 13;
+static const size_t TU_LIGHTDATA = 14;
+static const size_t TU_LIGHTINDICES = 15;
+
+/// Distribution of the light cluster grid's Z-slices between the camera near and far clip distances.
+enum ClusterSlicing
+{
+    CLUSTER_SLICE_LINEAR = 0,
+    CLUSTER_SLICE_QUADRATIC,
+    CLUSTER_SLICE_EXPONENTIAL
+};
 
 /// Per-thread results for octant collection.
 struct ThreadOctantResult
@@ -56,20 +68,16 @@ struct ThreadOctantResult
     /// Clear for the next frame.
     void Clear();
 
-    /// Drawable accumulator. When full, queue the next batch collection task.
+    /// Drawable accumulator. Used to size the batch collection subranges.
     size_t drawableAcc;
-    /// Starting octant index for current task.
-    size_t taskOctantIdx;
-    /// Batch collection task index.
-    size_t batchTaskIdx;
     /// Intermediate octant list.
-    std::vector<std::pair<Octant*, unsigned char> > octants;
+    ArenaVector<std::pair<Octant*, unsigned char> > octants;
     /// Intermediate light drawable list.
-    std::vector<LightDrawable*> lights;
-    /// Tasks for main view batches collection, queued by the octant collection task when it finishes.
-    std::vector<AutoPtr<CollectBatchesTask> > collectBatchesTasks;
+    ArenaVector<LightDrawable*> lights;
+    /// Parallel range operation for main view batches collection, started by the octant collection when it finishes.
+    ParallelForHandle collectBatchesJob;
     /// New occlusion queries to be issued.
-    std::vector<Octant*> occlusionQueries;
+    ArenaVector<Octant*> occlusionQueries;
 };
 
 /// Per-thread results for batch collection.
@@ -85,9 +93,15 @@ struct ThreadBatchResult
     /// Combined bounding box of the visible geometries.
     BoundingBox geometryBounds;
     /// Initial opaque batches.
-    std::vector<Batch> opaqueBatches;
+    ArenaVector<Batch> opaqueBatches;
     /// Initial alpha batches.
-    std::vector<Batch> alphaBatches;
+    ArenaVector<Batch> alphaBatches;
+    /// Opaque batches of static geometry for rebuilding the static batch cache.
+    ArenaVector<Batch> staticBatches;
+    /// Sorted keys of the opaque batches.
+    ArenaSpan<BatchSortKey> opaqueKeys;
+    /// Sorted keys of the alpha batches.
+    ArenaSpan<BatchSortKey> alphaKeys;
 };
 
 /// Shadow map data structure. May be shared by several lights.
@@ -116,9 +130,15 @@ struct ShadowMap
     /// Shadow batch queues used by the shadow views.
     std::vector<BatchQueue> shadowBatches;
     /// Intermediate shadowcaster lists for processing.
-    std::vector<std::vector<Drawable*> > shadowCasters;
+    std::vector<ArenaVector<FrustumQueryResult> > shadowCasters;
     /// Instancing transforms for shadowcasters.
     std::vector<Matrix3x4> instanceTransforms;
+    /// Drawables of instanced skinned shadowcaster groups.
+    std::vector<GeometryDrawable*> instanceDrawables;
+    /// Byte offset of the instancing transforms in the frame data ring buffer.
+    size_t instanceDataOffset;
+    /// Whether the instancing transforms were written to the frame data ring buffer.
+    bool instanceDataInRing;
 };
 
 /// Per-view uniform buffer data.
@@ -140,6 +160,8 @@ struct PerViewUniforms
     Color fogColor;
     /// Current scene's fog start and end parameters.
     Vector4 fogParameters;
+    /// Light cluster Z-slice distribution parameters.
+    Vector4 clusterParameters;
     /// Directional light direction.
     Vector4 dirLightDirection;
     /// Directional light color.
@@ -176,8 +198,117 @@ struct ClusterCullData
     Frustum frustum;
     /// Cluster bounding box.
     BoundingBox boundingBox;
-    /// Number of lights already in cluster.
-    unsigned char numLights;
+};
+
+/// Bounding boxes in structure of arrays layout for testing several at once, padded to a multiple of 4 with empty boxes.
+struct BoundingBoxArray
+{
+    /// Resize and set all boxes empty.
+    void Resize(size_t count);
+    /// Set a box.
+    void Set(size_t index, const BoundingBox& box);
+    /// Test a sphere against 4 boxes starting from an index divisible by 4. Return a bitmask of the boxes that the sphere intersects.
+    unsigned IsInsideFast4(const Sphere& sphere, size_t index) const;
+
+    /// Minimum X coordinates.
+    std::vector<float> minX;
+    /// Minimum Y coordinates.
+    std::vector<float> minY;
+    /// Minimum Z coordinates.
+    std::vector<float> minZ;
+    /// Maximum X coordinates.
+    std::vector<float> maxX;
+    /// Maximum Y coordinates.
+    std::vector<float> maxY;
+    /// Maximum Z coordinates.
+    std::vector<float> maxZ;
+};
+
+/// Cluster bounding boxes of one Z-slice for light culling, with coarser boxes for rejecting whole rows and 4-column tiles first.
+struct ClusterSliceBounds
+{
+    /// Cluster boxes. Each row is padded to a multiple of 4 clusters so that the tiles start at a divisible index.
+    BoundingBoxArray clusters;
+    /// Boxes of the 4-column tiles, each spanning all rows.
+    BoundingBoxArray tiles;
+    /// Boxes of the rows.
+    std::vector<BoundingBox> rows;
+    /// Box of the whole slice.
+    BoundingBox box;
+};
+
+/// View space bounds of a point or spot light for culling against clusters.
+struct ClusterLightBounds
+{
+    /// Spot light frustum.
+    Frustum frustum;
+    /// Bounding box of the spot light frustum.
+    BoundingBox boundingBox;
+    /// Point light sphere, or the bounding sphere of the spot light frustum.
+    Sphere sphere;
+    /// Minimum view Z.
+    float minZ;
+    /// Maximum view Z.
+    float maxZ;
+    /// Spot light flag.
+    bool spot;
+};
+
+/// Sorted opaque batches of static geometry, which are reused while the view, the visible octants and the static content stay unchanged.
+struct StaticBatchCache
+{
+    /// Construct.
+    StaticBatchCache();
+    /// Destruct.
+    ~StaticBatchCache();
+
+    /// Valid for rendering flag.
+    bool valid;
+    /// Camera the batches were collected for.
+    Camera* camera;
+    /// Camera view matrix.
+    Matrix3x4 viewMatrix;
+    /// Camera projection matrix.
+    Matrix4 projectionMatrix;
+    /// Camera view mask.
+    unsigned viewMask;
+    /// Octree static content version.
+    unsigned staticContentVersion;
+    /// Occlusion use flag.
+    bool useOcclusion;
+    /// Software occlusion flag.
+    bool softwareOcclusion;
+    /// Visible octants and their frustum plane masks.
+    std::vector<std::pair<Octant*, unsigned char> > octants;
+    /// Sorted batches.
+    BatchQueue batches;
+    /// Instance transforms of the batches.
+    std::vector<Matrix3x4> instanceTransforms;
+    /// Instancing vertex buffer, which is only updated when the batches are collected.
+    AutoPtr<VertexBuffer> instanceVertexBuffer;
+};
+
+/// Rendering statistics accumulated from the batch queues rendered since the last view preparation.
+struct RenderStats
+{
+    /// Construct.
+    RenderStats();
+
+    /// Reset for the next frame.
+    void Reset();
+
+    /// Rendered batches, counting each instance of an instanced batch.
+    size_t batches;
+    /// Draw calls.
+    size_t drawCalls;
+    /// Shader program changes.
+    size_t programChanges;
+    /// %Material changes, which bind textures and material uniforms.
+    size_t materialChanges;
+    /// Render state changes due to material pass changes.
+    size_t renderStateChanges;
+    /// %Geometry changes, which bind vertex and index buffers.
+    size_t geometryChanges;
 };
 
 /// High-level rendering subsystem. Performs rendering of 3D scenes.
@@ -195,6 +326,16 @@ public:
     void SetupShadowMaps(int dirLightSize, int lightAtlasSize, ImageFormat format);
     /// Set global depth bias multipiers for shadow maps.
     void SetShadowDepthBiasMul(float depthBiasMul, float slopeScaleBiasMul);
+    /// Set light cluster grid dimensions and Z-slice distribution. Finer grids cull lights more precisely per pixel, but take longer to cull. Each dimension is clamped to 1-128.
+    void SetClusterGrid(const IntVector3& size, ClusterSlicing slicing = CLUSTER_SLICE_QUADRATIC);
+    /// Set whether occlusion culling uses a CPU-rasterized buffer of occluder drawables instead of hardware occlusion queries. The buffer height follows the camera aspect ratio.
+    void SetSoftwareOcclusion(bool enable, int bufferWidth = DEFAULT_OCCLUSION_BUFFER_WIDTH);
+    /// Start compiling all reachable shader variations of the existing materials' passes, so that they are not compiled on first use while rendering. Return the number of variations.
+    size_t BeginPrecompileShaders();
+    /// Finish the started shader variations whose compile has completed. Does not block if parallel shader compile is supported. Return true and log the variation count and time taken when all are finished.
+    bool UpdatePrecompileShaders();
+    /// Compile all reachable shader variations of the existing materials' passes and wait for them to finish. Return the number of variations.
+    size_t PrecompileShaders();
     /// Prepare view for rendering. This will utilize worker threads.
     void PrepareView(Scene* scene, Camera* camera, bool drawShadows, bool useOcclusion);
     /// Render shadowmaps before rendering the view. Last shadow framebuffer will be left bound.
@@ -208,24 +349,48 @@ public:
 
     /// Return a shadow map texture by index for debugging.
     Texture* ShadowMapTexture(size_t index) const;
+    /// Return whether software occlusion is enabled.
+    bool SoftwareOcclusion() const { return softwareOcclusion; }
+    /// Return light cluster grid dimensions.
+    const IntVector3& ClusterGridSize() const { return clusterGridSize; }
+    /// Return light cluster Z-slice distribution.
+    ClusterSlicing GetClusterSlicing() const { return clusterSlicing; }
+    /// Return the software occlusion buffer for debugging, or null if not in use.
+    const OcclusionBuffer* GetOcclusionBuffer() const { return softwareOcclusion ? occlusionBuffer.Get() : nullptr; }
+    /// Return rendering statistics of the current frame.
+    const RenderStats& GetRenderStats() const { return renderStats; }
 
 private:
-    /// Collect octants and lights from the octree recursively. Queue batch collection tasks while ongoing.
+    /// Collect octants and lights from the octree recursively.
     void CollectOctantsAndLights(Octant* octant, ThreadOctantResult& result, unsigned char planeMask = 0x3f);
     /// Add an occlusion query for the octant if applicable.
     void AddOcclusionQuery(Octant* octant, ThreadOctantResult& result, unsigned char planeMask);
+    /// Collect occluders in view and rasterize them into the software occlusion buffer.
+    void RenderOccluders();
     /// Allocate shadow map for a light. Return true on success.
     bool AllocateShadowMap(LightDrawable* light);
-    /// Sort main opaque and alpha batch queues.
+    /// Check whether static opaque batches can be kept separately and reused from the previous frame.
+    void PrepareStaticBatches();
+    /// Verify the cached static batches against the visible octants, and collect and sort them again if necessary.
+    void UpdateStaticBatches();
+    /// Sort main opaque and alpha batch queues. The per-thread batches are sorted and merged on worker threads.
     void SortMainBatches();
+    /// Choose key ranges for merging a main batch queue's per-thread sorted runs in parallel.
+    void PrepareBatchMerge(BatchQueue& queue, size_t queueIndex);
     /// Sort all batch queues of a shadowmap.
     void SortShadowBatches(ShadowMap& shadowMap);
-    /// Upload instance transforms before rendering.
-    void UpdateInstanceTransforms(const std::vector<Matrix3x4>& transforms);
-    /// Upload light uniform buffer and cluster texture data.
+    /// Upload instance transforms to an instancing vertex buffer before rendering.
+    void UpdateInstanceTransforms(VertexBuffer* buffer, const std::vector<Matrix3x4>& transforms);
+    /// Write instance transforms to the frame data ring buffer and output the byte offset. Return false if the ring buffer is not available or is full. Can be called from worker threads.
+    bool WriteInstanceTransforms(const std::vector<Matrix3x4>& transforms, size_t& offset);
+    /// Write world transforms of static non-instanced batches to the frame data ring buffer and assign their offsets. Can be called from worker threads.
+    void WriteObjectData(BatchQueue& queue);
+    /// Write skin matrices of instanced skinned batch groups to the frame data ring buffer. Groups that do not fit are reverted to separate batches. Can be called from worker threads.
+    void WriteSkinPalettes(BatchQueue& queue, const std::vector<GeometryDrawable*>& drawables);
+    /// Upload light data, light index list and cluster texture data.
     void UpdateLightData();
-    /// Render a batch queue.
-    void RenderBatches(Camera* camera, const BatchQueue& queue);
+    /// Render a batch queue by replaying its recorded commands, using an instancing vertex buffer. If the vertex buffer is null, instance transforms are read from the frame data ring buffer at the byte offset instead.
+    void RenderBatches(Camera* camera, const BatchQueue& queue, VertexBuffer* instanceBuffer, size_t instanceDataOffset = 0);
     /// Check occlusion query results and propagate visibility hierarchically.
     void CheckOcclusionQueries();
     /// Render occlusion queries for octants.
@@ -236,22 +401,34 @@ private:
     void DefineBoundingBoxGeometry();
     /// Setup light cluster frustums and bounding boxes if necessary.
     void DefineClusterFrustums();
-    /// Work function to collect octants.
-    void CollectOctantsWork(Task* task, unsigned threadIndex);
+    /// Work function to collect octants from a range of root-level octants, then start batch collection from them.
+    void CollectOctantsWork(size_t begin, size_t end, unsigned threadIndex);
     /// Process lights collected by octant tasks, and queue shadowcaster query tasks for them as necessary.
     void ProcessLightsWork(Task* task, unsigned threadIndex);
-    /// Work function to collect main view batches from geometries.
-    void CollectBatchesWork(Task* task, unsigned threadIndex);
+    /// Work function to collect main view batches from geometries in a range of octants. Optionally collect only the cacheable static opaque batches.
+    void CollectBatchesWork(ArenaSpan<std::pair<Octant*, unsigned char> > octants, size_t begin, size_t end, unsigned threadIndex, bool staticOnly = false);
     /// Work function to collect shadowcasters per shadowcasting light.
     void CollectShadowCastersWork(Task* task, unsigned threadIndex);
     /// Work function for dummy task that signals batches are ready for sorting.
     void BatchesReadyWork(Task* task, unsigned threadIndex);
     /// Work function to queue shadowcaster batch collection tasks. Requires batch collection and shadowcaster query tasks to be complete.
     void ProcessShadowCastersWork(Task* task, unsigned threadIndex);
+    /// Work function to update light cluster frustums and queue light culling. Requires light processing and batch collection to be complete.
+    void ProcessClustersWork(Task* task, unsigned threadIndex);
     /// Work function to collect shadowcaster batches per shadow view.
     void CollectShadowBatchesWork(Task* task, unsigned threadIndex);
-    /// Work function to cull lights against a Z-slice of the frustum grid.
-    void CullLightsToFrustumWork(Task* task, unsigned threadIndex);
+    /// Work function to cull lights against a range of Z-slices of the frustum grid. Each slice produces its own light index list, with the cluster offsets relative to it.
+    void CullLightsToFrustumWork(size_t begin, size_t end, unsigned threadIndex);
+    /// Work function to sort a range of the per-thread opaque and alpha batch lists.
+    void SortBatchesWork(size_t begin, size_t end, unsigned threadIndex);
+    /// Work function to merge a range of the main batch queue key ranges.
+    void MergeBatchesWork(size_t begin, size_t end, unsigned threadIndex);
+    /// Work function to record render commands from a range of the main view batches. The range covers the static, opaque and alpha batch queues in order.
+    void RecordCommandsWork(size_t begin, size_t end, unsigned threadIndex);
+    /// Work function to transform the triangles of a range of occluders.
+    void AddOccluderTrianglesWork(size_t begin, size_t end, unsigned threadIndex);
+    /// Work function to rasterize occluders into a range of occlusion buffer block rows.
+    void RasterizeOccludersWork(size_t begin, size_t end, unsigned threadIndex);
 
     /// Current scene.
     Scene* scene;
@@ -275,20 +452,30 @@ private:
     bool drawShadows;
     /// Occlusion use flag.
     bool useOcclusion;
+    /// Software occlusion flag.
+    bool softwareOcclusion;
+    /// Software occlusion buffer rasterized for the current view flag.
+    bool occlusionBufferValid;
+    /// Keep static opaque batches separately in the static batch cache flag.
+    bool separateStaticBatches;
+    /// Reuse the static batch cache from the previous frame flag.
+    bool reuseStaticBatches;
     /// Shadow maps globally dirty flag. All cached shadow content should be reset.
     bool shadowMapsDirty;
     /// Cluster frustums dirty flag.
     bool clusterFrustumsDirty;
     /// Instancing supported flag.
     bool hasInstancing;
+    /// Main view instance transforms written to the frame data ring buffer flag.
+    bool instanceDataInRing;
+    /// Per-view uniform data written to the frame data ring buffer flag.
+    bool perViewDataInRing;
     /// Previous frame camera position for occlusion culling bounding box elongation.
     Vector3 previousCameraPosition;
     /// Last frame time for occlusion query staggering.
     float lastFrameTime;
     /// Root-level octants, used as a starting point for octant and batch collection. The root octant is included if it also contains drawables.
     std::vector<Octant*> rootLevelOctants;
-    /// Counter for batch collection tasks remaining. When zero, main batch sorting can begin while other tasks go on.
-    std::atomic<int> numPendingBatchTasks;
     /// Counters for shadow views remaining per shadowmap. When zero, the shadow batches can be sorted.
     std::atomic<int> numPendingShadowViews[2];
     /// Per-octree branch octant collection results.
@@ -313,30 +500,90 @@ private:
     BatchQueue alphaBatches;
     /// Instance transforms for opaque and alpha batches.
     std::vector<Matrix3x4> instanceTransforms;
+    /// Drawables of instanced skinned opaque and alpha batch groups.
+    std::vector<GeometryDrawable*> instanceDrawables;
+    /// Cached static opaque batches.
+    StaticBatchCache staticBatches;
+    /// Per-thread sorted opaque and alpha batch runs for merging.
+    std::vector<BatchSortRun> sortRuns;
+    /// Run positions at the merge key range boundaries.
+    std::vector<size_t> mergeBounds;
+    /// Destination offsets of the merge key ranges.
+    std::vector<size_t> mergeOffsets;
+    /// Number of merge key ranges of the opaque and alpha batch queues.
+    size_t numMergeRanges[2];
     /// Last camera used for rendering.
     Camera* lastCamera;
     /// Last material pass used for rendering.
     Pass* lastPass;
-    /// Last material used for rendering.
-    Material* lastMaterial;
+    /// Last material state used for rendering.
+    const MaterialState* lastMaterialState;
+    /// Rendering statistics.
+    RenderStats renderStats;
     /// Constant depth bias multiplier.
     float depthBiasMul;
     /// Slope-scaled depth bias multiplier.
     float slopeScaleBiasMul;
     /// Last projection matrix used to initialize cluster frustums.
     Matrix4 lastClusterFrustumProj;
-    /// Cluster frustums, bounding boxes and number of found lights.
+    /// Cluster frustums and bounding boxes.
     AutoArrayPtr<ClusterCullData> clusterCullData;
-    /// Cluster uniform buffer data CPU copy.
-    AutoArrayPtr<unsigned char> clusterData;
-    /// Light uniform buffer data CPU copy.
-    AutoArrayPtr<LightData> lightData;
+    /// Cluster texture data CPU copy. Contains the light index list offset and light count per cluster.
+    AutoArrayPtr<unsigned> clusterData;
+    /// View space bounds of the lights for cluster culling.
+    std::vector<ClusterLightBounds> clusterLightBounds;
+    /// Light cluster grid dimensions.
+    IntVector3 clusterGridSize;
+    /// Light cluster Z-slice distribution.
+    ClusterSlicing clusterSlicing;
+    /// Cluster bounds of each Z-slice for SIMD culling.
+    std::vector<ClusterSliceBounds> clusterSliceBounds;
+    /// Lights overlapping each Z-slice's depth range.
+    std::vector<std::vector<unsigned> > sliceLights;
+    /// Cluster and light index pairs found by culling in each Z-slice.
+    std::vector<std::vector<std::pair<unsigned, unsigned> > > sliceLightHits;
+    /// Light index lists of each Z-slice.
+    std::vector<std::vector<unsigned> > sliceLightIndices;
+    /// Light index list of all clusters for uploading.
+    std::vector<unsigned> lightIndices;
+    /// Light data CPU copy.
+    std::vector<LightData> lightData;
+    /// Maximum texels in a buffer texture.
+    size_t maxBufferTexels;
+    /// Light data and cluster data need upload flag.
+    bool lightDataDirty;
     /// Per-view uniform buffer data CPU copy.
     PerViewUniforms perViewData;
+    /// Byte offset of the per-view uniform data in the frame data ring buffer.
+    size_t perViewDataOffset;
+    /// Byte offset of the main view instance transforms in the frame data ring buffer.
+    size_t instanceDataOffset;
     /// Frustum SAT test data for verifying whether to add an occlusion query.
     SATData frustumSATData;
-    /// Tasks for octant collection.
-    AutoPtr<CollectOctantsTask> collectOctantsTasks[NUM_OCTANT_TASKS];
+    /// Software occlusion buffer.
+    AutoPtr<OcclusionBuffer> occlusionBuffer;
+    /// Software occlusion buffer width.
+    int occlusionBufferWidth;
+    /// Occluders in view.
+    ArenaVector<Drawable*> occluders;
+    /// Per-thread transformed occluder triangles.
+    AutoArrayPtr<ArenaVector<OcclusionTriangle> > occluderTriangles;
+    /// Views to the per-thread occluder triangles for rasterization.
+    AutoArrayPtr<ArenaSpan<OcclusionTriangle> > occluderTriangleSpans;
+    /// Parallel range operation for occluder triangle transform.
+    ParallelForHandle occluderTrianglesJob;
+    /// Parallel range operation for occluder rasterization.
+    ParallelForHandle rasterizeOccludersJob;
+    /// Parallel range operation for octant collection.
+    ParallelForHandle collectOctantsJob;
+    /// Parallel range operation for collecting the static batches when the visible octants changed.
+    ParallelForHandle collectStaticBatchesJob;
+    /// Parallel range operation for per-thread batch sorting.
+    ParallelForHandle sortBatchesJob;
+    /// Parallel range operation for merging the sorted batches.
+    ParallelForHandle mergeBatchesJob;
+    /// Parallel range operation for recording the main view render commands.
+    ParallelForHandle recordCommandsJob;
     /// %Task for light processing.
     AutoPtr<Task> processLightsTask;
     /// Tasks for shadow light processing.
@@ -345,10 +592,14 @@ private:
     AutoPtr<Task> batchesReadyTask;
     /// %Task for queuing shadow views for further processing.
     AutoPtr<Task> processShadowCastersTask;
+    /// %Task for queuing light grid culling.
+    AutoPtr<Task> processClustersTask;
+    /// Recorded view preparation task graph.
+    TaskGraph frameGraph;
     /// Tasks for shadow batch processing.
     std::vector<AutoPtr<CollectShadowBatchesTask> > collectShadowBatchesTasks;
-    /// Tasks for light grid culling.
-    AutoPtr<CullLightsTask> cullLightsTasks[NUM_CLUSTER_Z];
+    /// Parallel range operation for light grid culling.
+    ParallelForHandle cullLightsJob;
     /// Face selection UV indirection texture 1.
     AutoPtr<Texture> faceSelectionTexture1;
     /// Face selection UV indirection texture 2.
@@ -357,8 +608,16 @@ private:
     AutoPtr<Texture> clusterTexture;
     /// Per-view uniform buffer.
     AutoPtr<UniformBuffer> perViewDataBuffer;
-    /// Light data uniform buffer.
+    /// Per-object uniform buffer for world transforms that did not fit in the frame data ring buffer.
+    AutoPtr<UniformBuffer> objectDataBuffer;
+    /// Light data buffer.
     AutoPtr<UniformBuffer> lightDataBuffer;
+    /// Light data buffer texture.
+    AutoPtr<Texture> lightDataTexture;
+    /// Light index list buffer.
+    AutoPtr<UniformBuffer> lightIndexBuffer;
+    /// Light index list buffer texture.
+    AutoPtr<Texture> lightIndexTexture;
     /// Instancing vertex buffer.
     AutoPtr<VertexBuffer> instanceVertexBuffer;
     /// Bounding box vertex buffer.
@@ -373,6 +632,14 @@ private:
     AutoPtr<FrameBuffer> staticObjectShadowFbo;
     /// Vertex elements for the instancing buffer.
     std::vector<VertexElement> instanceVertexElements;
+    /// Shader variations started compiling and not yet finished.
+    std::vector<SharedPtr<ShaderProgram> > precompilePrograms;
+    /// Number of shader variations found when starting the precompile.
+    size_t numPrecompileVariations;
+    /// Number of shader variations newly compiled by the precompile.
+    size_t numPrecompileCompiled;
+    /// Timer for the precompile report.
+    HiresTimer precompileTimer;
 };
 
 /// Register Renderer related object factories and attributes.
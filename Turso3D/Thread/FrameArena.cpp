@@ -0,0 +1,84 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "FrameArena.h"
+
+FrameArena::FrameArena(size_t initialSize) :
+    current(nullptr)
+{
+    if (initialSize)
+        AllocateBlock(initialSize);
+}
+
+FrameArena::~FrameArena()
+{
+    FreeBlocks();
+}
+
+void* FrameArena::Allocate(size_t size, size_t alignment)
+{
+    assert(alignment && !(alignment & (alignment - 1)));
+
+    if (current)
+    {
+        unsigned char* blockData = reinterpret_cast<unsigned char*>(current + 1);
+        size_t offset = (reinterpret_cast<size_t>(blockData + current->used) + alignment - 1) & ~(alignment - 1);
+        offset -= reinterpret_cast<size_t>(blockData);
+
+        if (offset + size <= current->size)
+        {
+            current->used = offset + size;
+            return blockData + offset;
+        }
+    }
+
+    // Does not fit, start a new block at least twice the size of the previous
+    size_t newSize = current ? current->size * 2 : DEFAULT_FRAME_ARENA_SIZE;
+    if (newSize < size + alignment)
+        newSize = size + alignment;
+
+    AllocateBlock(newSize);
+    return Allocate(size, alignment);
+}
+
+void FrameArena::Reset()
+{
+    if (!current)
+        return;
+
+    if (current->next)
+    {
+        size_t totalSize = Capacity();
+        FreeBlocks();
+        AllocateBlock(totalSize);
+    }
+    else
+        current->used = 0;
+}
+
+size_t FrameArena::Capacity() const
+{
+    size_t totalSize = 0;
+    for (FrameArenaBlock* block = current; block; block = block->next)
+        totalSize += block->size;
+    return totalSize;
+}
+
+void FrameArena::AllocateBlock(size_t size)
+{
+    unsigned char* blockPtr = new unsigned char[sizeof(FrameArenaBlock) + size];
+    FrameArenaBlock* newBlock = reinterpret_cast<FrameArenaBlock*>(blockPtr);
+    newBlock->size = size;
+    newBlock->used = 0;
+    newBlock->next = current;
+    current = newBlock;
+}
+
+void FrameArena::FreeBlocks()
+{
+    while (current)
+    {
+        FrameArenaBlock* next = current->next;
+        delete[] reinterpret_cast<unsigned char*>(current);
+        current = next;
+    }
+}
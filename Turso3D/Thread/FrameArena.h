@@ -0,0 +1,200 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstring>
+#include <new>
+
+static const size_t DEFAULT_FRAME_ARENA_SIZE = 256 * 1024;
+static const size_t ARENA_CACHE_LINE_SIZE = 64;
+
+/// %Frame arena memory block.
+struct FrameArenaBlock
+{
+    /// Usable size of the block.
+    size_t size;
+    /// Bytes used.
+    size_t used;
+    /// Previously filled block.
+    FrameArenaBlock* next;
+    /// Data follows.
+};
+
+/// Linear allocator for per-frame scratch memory. Allocations are not freed individually, instead all at once when the arena is reset. Not thread-safe, so each thread should use its own.
+class FrameArena
+{
+public:
+    /// Construct with initial size.
+    FrameArena(size_t initialSize = DEFAULT_FRAME_ARENA_SIZE);
+    /// Destruct. Free all blocks.
+    ~FrameArena();
+
+    /// Allocate memory. Alignment must be a power of two.
+    void* Allocate(size_t size, size_t alignment = sizeof(void*));
+    /// Free all allocations. If the previous usage needed several blocks, replace them with one large enough block, so that steady-state frames do not allocate from the heap.
+    void Reset();
+
+    /// Return total size of the blocks.
+    size_t Capacity() const;
+
+private:
+    /// Prevent copy construction.
+    FrameArena(const FrameArena& rhs);
+    /// Prevent assignment.
+    FrameArena& operator = (const FrameArena& rhs);
+
+    /// Allocate a new block and make it current.
+    void AllocateBlock(size_t size);
+    /// Free all blocks.
+    void FreeBlocks();
+
+    /// Current block being filled.
+    FrameArenaBlock* current;
+    /// Padding to keep arenas of different threads on separate cache lines.
+    char padding[ARENA_CACHE_LINE_SIZE - sizeof(FrameArenaBlock*)];
+};
+
+/// Non-owning view to a contiguous array, for example the contents of an ArenaVector.
+template <class T> struct ArenaSpan
+{
+    /// Construct empty.
+    ArenaSpan() :
+        data(nullptr),
+        count(0)
+    {
+    }
+
+    /// Construct with pointer and count.
+    ArenaSpan(T* data_, size_t count_) :
+        data(data_),
+        count(count_)
+    {
+    }
+
+    /// Return element at index.
+    T& operator [] (size_t index) const { assert(index < count); return data[index]; }
+    /// Return iterator to the beginning.
+    T* begin() const { return data; }
+    /// Return iterator to the end.
+    T* end() const { return data + count; }
+    /// Return number of elements.
+    size_t size() const { return count; }
+    /// Return whether is empty.
+    bool empty() const { return count == 0; }
+
+    /// Data pointer.
+    T* data;
+    /// Number of elements.
+    size_t count;
+};
+
+/// Growable array which allocates from a frame arena. Should only hold types that can be copied with memcpy and need no destruction. The contents become invalid when the arena is reset.
+/// Follows std::vector naming to be usable in the same templated code.
+template <class T> class ArenaVector
+{
+public:
+    typedef T value_type;
+    typedef T* iterator;
+    typedef const T* const_iterator;
+
+    /// Construct with no arena.
+    ArenaVector() :
+        arena(nullptr),
+        data(nullptr),
+        count(0),
+        capacity(0)
+    {
+    }
+
+    /// Construct with arena.
+    ArenaVector(FrameArena* arena_) :
+        arena(arena_),
+        data(nullptr),
+        count(0),
+        capacity(0)
+    {
+    }
+
+    /// Set the arena to allocate from. The current contents are forgotten.
+    void SetArena(FrameArena* arena_)
+    {
+        arena = arena_;
+        clear();
+    }
+
+    /// Add an element to the end.
+    void push_back(const T& value)
+    {
+        if (count == capacity)
+            Grow(count + 1);
+        new(data + count) T(value);
+        ++count;
+    }
+
+    /// Reserve space for elements.
+    void reserve(size_t newCapacity)
+    {
+        if (newCapacity > capacity)
+            Grow(newCapacity);
+    }
+
+    /// Forget the contents and the storage. The memory is reclaimed when the arena is reset.
+    void clear()
+    {
+        data = nullptr;
+        count = 0;
+        capacity = 0;
+    }
+
+    /// Return element at index.
+    T& operator [] (size_t index) { assert(index < count); return data[index]; }
+    /// Return const element at index.
+    const T& operator [] (size_t index) const { assert(index < count); return data[index]; }
+    /// Return iterator to the beginning.
+    T* begin() { return data; }
+    /// Return iterator to the end.
+    T* end() { return data + count; }
+    /// Return const iterator to the beginning.
+    const T* begin() const { return data; }
+    /// Return const iterator to the end.
+    const T* end() const { return data + count; }
+    /// Return last element.
+    T& back() { assert(count); return data[count - 1]; }
+    /// Return number of elements.
+    size_t size() const { return count; }
+    /// Return whether is empty.
+    bool empty() const { return count == 0; }
+    /// Return the contents as a span.
+    ArenaSpan<T> Span() const { return ArenaSpan<T>(data, count); }
+    /// Return the arena.
+    FrameArena* Arena() const { return arena; }
+
+private:
+    /// Reallocate to hold at least the specified amount of elements.
+    void Grow(size_t minCapacity)
+    {
+        assert(arena);
+
+        size_t newCapacity = capacity ? capacity * 2 : 16;
+        if (newCapacity < minCapacity)
+            newCapacity = minCapacity;
+
+        T* newData = static_cast<T*>(arena->Allocate(newCapacity * sizeof(T), alignof(T)));
+        if (count)
+            memcpy(static_cast<void*>(newData), data, count * sizeof(T));
+
+        data = newData;
+        capacity = newCapacity;
+    }
+
+    /// Arena to allocate from.
+    FrameArena* arena;
+    /// Elements.
+    T* data;
+    /// Number of elements.
+    size_t count;
+    /// Number of elements that fit the current allocation.
+    size_t capacity;
+};
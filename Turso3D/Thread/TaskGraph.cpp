@@ -0,0 +1,132 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#include "TaskGraph.h"
+
+#include <cassert>
+#include <tracy/Tracy.hpp>
+
+// Dependency counter value for disabled tasks, which prevents them from ever being queued by their dependencies.
+static const int DISABLED_TASK_DEPENDENCIES = 0x40000000;
+
+TaskGraph::TaskGraph() :
+    dependencyCountsDirty(true)
+{
+}
+
+TaskGraph::~TaskGraph()
+{
+    for (auto it = nodes.begin(); it != nodes.end(); ++it)
+    {
+        it->task->graph = nullptr;
+        it->task->dependentTasks.clear();
+    }
+}
+
+void TaskGraph::AddTask(Task* task, bool autoQueue)
+{
+    assert(task);
+    assert(!task->graph);
+
+    task->graph = this;
+
+    TaskGraphNode newNode;
+    newNode.task = task;
+    newNode.numEnabledDependencies = 0;
+    newNode.enabled = true;
+    newNode.autoQueue = autoQueue;
+    nodes.push_back(newNode);
+
+    dependencyCountsDirty = true;
+}
+
+void TaskGraph::AddDependency(Task* task, Task* dependency)
+{
+    size_t taskIdx = NodeIndex(task);
+    size_t dependencyIdx = NodeIndex(dependency);
+    assert(taskIdx < nodes.size() && dependencyIdx < nodes.size());
+
+    // The dependent list stays in the task after completion, as it is recorded into a graph
+    dependency->dependentTasks.push_back(task);
+    nodes[taskIdx].dependencies.push_back(dependencyIdx);
+
+    dependencyCountsDirty = true;
+}
+
+void TaskGraph::SetEnabled(Task* task, bool enable)
+{
+    size_t index = NodeIndex(task);
+    assert(index < nodes.size());
+
+    if (nodes[index].enabled != enable)
+    {
+        nodes[index].enabled = enable;
+        dependencyCountsDirty = true;
+    }
+}
+
+void TaskGraph::Run(WorkQueue* workQueue)
+{
+    ZoneScoped;
+
+    assert(workQueue);
+
+    if (dependencyCountsDirty)
+        UpdateDependencyCounts();
+
+    // Reset all counters first, as queuing may complete tasks immediately
+    int numWaitingTasks = 0;
+
+    for (auto it = nodes.begin(); it != nodes.end(); ++it)
+    {
+        if (!it->enabled)
+            it->task->numDependencies.store(DISABLED_TASK_DEPENDENCIES);
+        else
+        {
+            it->task->numDependencies.store(it->numEnabledDependencies);
+            if (it->numEnabledDependencies)
+                ++numWaitingTasks;
+        }
+    }
+
+    // Tasks waiting for dependencies count as pending, like when added through WorkQueue::AddDependency()
+    if (numWaitingTasks)
+        workQueue->numPendingTasks.fetch_add(numWaitingTasks);
+
+    for (auto it = nodes.begin(); it != nodes.end(); ++it)
+    {
+        if (it->enabled && it->autoQueue && !it->numEnabledDependencies)
+            workQueue->QueueTask(it->task);
+    }
+}
+
+bool TaskGraph::IsEnabled(Task* task) const
+{
+    size_t index = NodeIndex(task);
+    return index < nodes.size() ? nodes[index].enabled : false;
+}
+
+size_t TaskGraph::NodeIndex(Task* task) const
+{
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        if (nodes[i].task == task)
+            return i;
+    }
+
+    return nodes.size();
+}
+
+void TaskGraph::UpdateDependencyCounts()
+{
+    for (auto it = nodes.begin(); it != nodes.end(); ++it)
+    {
+        it->numEnabledDependencies = 0;
+        for (auto dIt = it->dependencies.begin(); dIt != it->dependencies.end(); ++dIt)
+        {
+            if (nodes[*dIt].enabled)
+                ++it->numEnabledDependencies;
+        }
+    }
+
+    dependencyCountsDirty = false;
+}
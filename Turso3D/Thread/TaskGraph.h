@@ -0,0 +1,60 @@
+// For conditions of distribution and use, see copyright notice in License.txt
+
+#pragma once
+
+#include "WorkQueue.h"
+
+/// %Task graph node.
+struct TaskGraphNode
+{
+    /// %Task.
+    Task* task;
+    /// Indices of the nodes this task depends on.
+    std::vector<size_t> dependencies;
+    /// Number of enabled dependencies.
+    int numEnabledDependencies;
+    /// Enabled flag. Disabled tasks are not executed, and do not hold back their dependents.
+    bool enabled;
+    /// Whether the task is queued automatically when the graph is run and it has no enabled dependencies.
+    bool autoQueue;
+};
+
+/// Reusable graph of tasks and their dependencies. Recorded once, then run repeatedly without rebuilding the dependencies.
+class TaskGraph
+{
+public:
+    /// Construct.
+    TaskGraph();
+    /// Destruct. Detach the recorded tasks.
+    ~TaskGraph();
+
+    /// Record a task. If autoQueue is false, the task will not be queued when the graph is run even if it has no dependencies; it should then be queued manually through WorkQueue::QueueTask().
+    void AddTask(Task* task, bool autoQueue = true);
+    /// Record a dependency between two recorded tasks.
+    void AddDependency(Task* task, Task* dependency);
+    /// Enable or disable a task for the following runs.
+    void SetEnabled(Task* task, bool enable);
+    /// Reset the dependency counters and queue the enabled tasks which have no enabled dependencies. WorkQueue::Complete() will also wait for the graph's tasks. The previous run must have been completed.
+    void Run(WorkQueue* workQueue);
+
+    /// Return whether a task is enabled.
+    bool IsEnabled(Task* task) const;
+    /// Return the recorded nodes.
+    const std::vector<TaskGraphNode>& Nodes() const { return nodes; }
+
+private:
+    /// Prevent copy construction.
+    TaskGraph(const TaskGraph& rhs);
+    /// Prevent assignment.
+    TaskGraph& operator = (const TaskGraph& rhs);
+
+    /// Return node index of a recorded task.
+    size_t NodeIndex(Task* task) const;
+    /// Recalculate number of enabled dependencies for each node.
+    void UpdateDependencyCounts();
+
+    /// Recorded nodes.
+    std::vector<TaskGraphNode> nodes;
+    /// Dependency counts dirty flag. Set when the graph is modified or tasks are enabled / disabled.
+    bool dependencyCountsDirty;
+};
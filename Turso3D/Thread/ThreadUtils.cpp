@@ -2,6 +2,13 @@
 
 #include <thread>
 
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 std::thread::id mainThreadId = std::this_thread::get_id();
 
 bool IsMainThread()
@@ -12,4 +19,24 @@ bool IsMainThread()
 unsigned CPUCount()
 {
     return std::thread::hardware_concurrency();
-}
\ No newline at end of file
+}
+
+bool SetCurrentThreadAffinity(unsigned core)
+{
+#ifdef _WIN32
+    if (core >= sizeof(DWORD_PTR) * 8)
+        return false;
+    return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << core) != 0;
+#elif defined(__linux__)
+    if (core >= CPU_SETSIZE)
+        return false;
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    CPU_SET(core, &cpuSet);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) == 0;
+#else
+    // Not supported on this platform
+    (void)core;
+    return false;
+#endif
+}
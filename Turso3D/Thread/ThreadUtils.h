@@ -6,3 +6,5 @@
 bool IsMainThread();
 // Return hardware CPU count, for determining e.g. amount of worker threads.
 unsigned CPUCount();
+// Pin the calling thread to a CPU core. Return true on success.
+bool SetCurrentThreadAffinity(unsigned core);
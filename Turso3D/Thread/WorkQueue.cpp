@@ -1,13 +1,28 @@
 // For conditions of distribution and use, see copyright notice in License.txt
 
+#include "../Math/Math.h"
 #include "ThreadUtils.h"
 #include "WorkQueue.h"
 
 #include <tracy/Tracy.hpp>
 
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#define CPU_PAUSE() _mm_pause()
+#else
+#define CPU_PAUSE() std::this_thread::yield()
+#endif
+
+// Spin iterations between yielding the time slice while spinning.
+static const unsigned SPIN_YIELD_INTERVAL = 64;
+// Initial task buffer size of a deque. Must be a power of two.
+static const long long INITIAL_DEQUE_SIZE = 256;
+
 thread_local unsigned WorkQueue::threadIndex = 0;
 
-Task::Task()
+Task::Task() :
+    priority(TP_NORMAL),
+    graph(nullptr)
 {
     numDependencies.store(0);
 }
@@ -16,22 +31,170 @@ Task::~Task()
 {
 }
 
-WorkQueue::WorkQueue(unsigned numThreads) :
-    shouldExit(false)
+void RangeTask::Complete(unsigned threadIndex)
+{
+    handle->Execute(this, threadIndex);
+}
+
+void RangeTask::Finish()
+{
+    // The handle may be destroyed or reused as soon as the counter reaches zero, so this must be the last access to the task
+    handle->numPendingTasks.fetch_add(-1);
+}
+
+TaskDeque::TaskDeque()
+{
+    top.store(0);
+    bottom.store(0);
+    buffers.push_back(new Buffer(INITIAL_DEQUE_SIZE));
+    buffer.store(buffers.back().Get());
+}
+
+TaskDeque::~TaskDeque()
+{
+}
+
+void TaskDeque::Push(Task* task)
+{
+    long long b = bottom.load(std::memory_order_relaxed);
+    long long t = top.load(std::memory_order_acquire);
+    Buffer* current = buffer.load(std::memory_order_relaxed);
+
+    if (b - t > current->size - 1)
+    {
+        // Full: copy to a buffer of double size. The old buffer stays alive for stealing threads that already loaded it
+        Buffer* grown = new Buffer(current->size * 2);
+        for (long long i = t; i < b; ++i)
+            grown->Put(i, current->Get(i));
+        buffers.push_back(grown);
+        buffer.store(grown, std::memory_order_release);
+        current = grown;
+    }
+
+    current->Put(b, task);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+Task* TaskDeque::Pop()
+{
+    long long b = bottom.load(std::memory_order_relaxed) - 1;
+    Buffer* current = buffer.load(std::memory_order_relaxed);
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long long t = top.load(std::memory_order_relaxed);
+
+    if (t > b)
+    {
+        // Was empty
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    Task* task = current->Get(b);
+    if (t == b)
+    {
+        // Last task: race against stealing threads
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            task = nullptr;
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+
+    return task;
+}
+
+Task* TaskDeque::Steal()
+{
+    long long t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    long long b = bottom.load(std::memory_order_acquire);
+
+    if (t >= b)
+        return nullptr;
+
+    Buffer* current = buffer.load(std::memory_order_acquire);
+    Task* task = current->Get(t);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+        return nullptr;
+
+    return task;
+}
+
+ParallelForHandle::ParallelForHandle() :
+    workQueue(nullptr),
+    grainSize(1),
+    splitSize(1),
+    priority(TP_NORMAL)
+{
+    numUsedTasks.store(0);
+    numPendingTasks.store(0);
+}
+
+ParallelForHandle::~ParallelForHandle()
+{
+    assert(IsDone());
+}
+
+void ParallelForHandle::Join()
+{
+    ZoneScoped;
+
+    while (!IsDone())
+        workQueue->TryComplete();
+}
+
+void ParallelForHandle::Execute(RangeTask* task, unsigned threadIndex)
+{
+    size_t begin = task->begin;
+    size_t end = task->end;
+
+    // Split off the upper half as a new task while the range is over the split size, or while there is too little work queued for the other threads
+    // Split points are aligned to the grain size so that the preallocated tasks always suffice
+    for (;;)
+    {
+        size_t numChunks = (end - begin + grainSize - 1) / grainSize;
+        if (numChunks < 2 || (end - begin <= splitSize && workQueue->NumQueuedTasks() >= workQueue->NumThreads()))
+            break;
+
+        size_t mid = begin + (numChunks / 2) * grainSize;
+        RangeTask* splitTask = tasks[numUsedTasks.fetch_add(1)];
+        splitTask->begin = mid;
+        splitTask->end = end;
+        splitTask->priority = priority;
+        numPendingTasks.fetch_add(1);
+        workQueue->QueueTask(splitTask);
+        end = mid;
+    }
+
+    function(begin, end, threadIndex);
+
+    // The pending counter is decremented in RangeTask::Finish(), once the work queue no longer accesses the task
+}
+
+WorkQueue::WorkQueue(unsigned numThreads, bool pinThreads_) :
+    shouldExit(false),
+    pinThreads(pinThreads_),
+    mainThreadId(std::this_thread::get_id())
 {
     RegisterSubsystem(this);
 
     numQueuedTasks.store(0);
+    numInjectedTasks.store(0);
     numPendingTasks.store(0);
+    numSleepingWorkers.store(0);
+    spinCount.store(DEFAULT_WORKER_SPIN_COUNT);
 
     if (numThreads == 0)
     {
         numThreads = CPUCount();
         // Avoid completely excessive core count
-        if (numThreads > 16)
-            numThreads = 16;
+        if (numThreads > MAX_AUTO_THREADS)
+            numThreads = MAX_AUTO_THREADS;
     }
 
+    deques = new ThreadTaskDeques[numThreads];
+    frameArenas = new FrameArena[numThreads];
+
     for (unsigned  i = 0; i < numThreads - 1; ++i)
         threads.push_back(std::thread(&WorkQueue::WorkerLoop, this, i + 1));
 }
@@ -42,7 +205,10 @@ WorkQueue::~WorkQueue()
         return;
 
     // Signal exit and wait for threads to finish
-    shouldExit = true;
+    {
+        std::lock_guard<std::mutex> lock(signalMutex);
+        shouldExit = true;
+    }
 
     signal.notify_all();
     for (auto it = threads.begin(); it != threads.end(); ++it)
@@ -56,15 +222,9 @@ void WorkQueue::QueueTask(Task* task)
 
     if (threads.size())
     {
-        {
-            std::lock_guard<std::mutex> lock(queueMutex);
-            tasks.push(task);
-        }
-
-        numQueuedTasks.fetch_add(1);
         numPendingTasks.fetch_add(1);
-
-        signal.notify_one();
+        PushTask(task, threadIndex);
+        WakeWorkers(1);
     }
     else
     {
@@ -79,26 +239,32 @@ void WorkQueue::QueueTasks(size_t count, Task** tasks_)
     {
         ZoneScoped;
 
+        numPendingTasks.fetch_add((int)count);
+
+        if (IsForeignThread())
         {
-            std::lock_guard<std::mutex> lock(queueMutex);
             for (size_t i = 0; i < count; ++i)
             {
                 assert(tasks_[i]);
                 assert(tasks_[i]->numDependencies.load() == 0);
-                tasks.push(tasks_[i]);
+                PushTask(tasks_[i], threadIndex);
             }
         }
-
-        numQueuedTasks.fetch_add((int)count);
-        numPendingTasks.fetch_add((int)count);
-
-        if (count >= threads.size())
-            signal.notify_all();
         else
         {
+            ThreadTaskDeques& deque = deques[threadIndex];
+            deque.numTasks.fetch_add((int)count);
             for (size_t i = 0; i < count; ++i)
-                signal.notify_one();
+            {
+                assert(tasks_[i]);
+                assert(tasks_[i]->numDependencies.load() == 0);
+                deque.tasks[tasks_[i]->priority].Push(tasks_[i]);
+            }
+
+            numQueuedTasks.fetch_add((int)count);
         }
+
+        WakeWorkers(count);
     }
     else
     {
@@ -112,10 +278,62 @@ void WorkQueue::QueueTasks(size_t count, Task** tasks_)
     }
 }
 
+ParallelForHandle& WorkQueue::ParallelFor(ParallelForHandle& handle, size_t begin, size_t end, size_t grainSize, const RangeWorkFunction& function)
+{
+    assert(handle.IsDone());
+    assert(function);
+
+    handle.workQueue = this;
+
+    if (begin >= end)
+        return handle;
+
+    // If no threads, execute directly
+    if (!threads.size())
+    {
+        function(begin, end, 0);
+        return handle;
+    }
+
+    ZoneScoped;
+
+    if (!grainSize)
+        grainSize = 1;
+
+    size_t numChunks = (end - begin + grainSize - 1) / grainSize;
+    while (handle.tasks.size() < numChunks)
+        handle.tasks.push_back(new RangeTask(&handle));
+
+    handle.function = function;
+    handle.grainSize = grainSize;
+    // Always split until there are a few subranges per thread, further only on demand
+    handle.splitSize = Max((end - begin) / (NumThreads() * 2), grainSize);
+    handle.numUsedTasks.store(1);
+    handle.numPendingTasks.store(1);
+
+    RangeTask* task = handle.tasks[0];
+    task->begin = begin;
+    task->end = end;
+    task->priority = handle.priority;
+    QueueTask(task);
+
+    return handle;
+}
+
+void WorkQueue::ResetFrameArenas()
+{
+    assert(!numPendingTasks.load());
+
+    for (unsigned i = 0; i < NumThreads(); ++i)
+        frameArenas[i].Reset();
+}
+
 void WorkQueue::AddDependency(Task* task, Task* dependency)
 {
     assert(task);
     assert(dependency);
+    // Dependents added to a recorded task would stay in it permanently
+    assert(!dependency->graph);
 
     dependency->dependentTasks.push_back(task);
 
@@ -136,46 +354,29 @@ void WorkQueue::Complete()
         if (!numPendingTasks.load())
             break;
 
-        // Avoid locking the queue mutex if do not have tasks in queue, just wait for the workers to finish
+        // Avoid touching the deques if do not have tasks in queue, just wait for the workers to finish
         if (!numQueuedTasks.load())
             continue;
 
         // Otherwise if have still tasks, execute them in the main thread
-        Task* task;
-
-        {
-            std::lock_guard<std::mutex> lock(queueMutex);
-            if (!tasks.size())
-                continue;
-
-            task = tasks.front();
-            tasks.pop();
-        }
-
-        numQueuedTasks.fetch_add(-1);
-        CompleteTask(task, 0);
+        Task* task = PopTask(0);
+        if (task)
+            CompleteTask(task, 0);
     }
 }
 
 bool WorkQueue::TryComplete()
 {
-    if (!threads.size() || !numPendingTasks.load() || !numQueuedTasks.load())
+    // Threads other than the main and worker threads have no deque or frame arena, so they can not execute tasks
+    if (!threads.size() || !numPendingTasks.load() || !numQueuedTasks.load() || IsForeignThread())
         return false;
 
-    Task* task;
-
-    {
-        std::lock_guard<std::mutex> lock(queueMutex);
-        if (!tasks.size())
-            return false;
-
-        task = tasks.front();
-        tasks.pop();
-    }
-
-    numQueuedTasks.fetch_add(-1);
-    CompleteTask(task, 0);
+    // The deque may only be popped by its owner, so use the calling thread's index
+    Task* task = PopTask(threadIndex);
+    if (!task)
+        return false;
 
+    CompleteTask(task, threadIndex);
     return true;
 }
 
@@ -183,25 +384,34 @@ void WorkQueue::WorkerLoop(unsigned threadIndex_)
 {
     WorkQueue::threadIndex = threadIndex_;
 
+    // Leave the first core to the main thread
+    if (pinThreads)
+        SetCurrentThreadAffinity(threadIndex_ % CPUCount());
+
     for (;;)
     {
-        Task* task;
+        Task* task = PopTask(threadIndex_);
 
+        if (!task)
         {
-            std::unique_lock<std::mutex> lock(queueMutex);
+            // Poll for a while before blocking, as waking up a blocked worker is slow compared to short tasks
+            if (SpinWait())
+                continue;
+
+            std::unique_lock<std::mutex> lock(signalMutex);
+            numSleepingWorkers.fetch_add(1);
             signal.wait(lock, [this]
             {
-                return !tasks.empty() || shouldExit;
+                return numQueuedTasks.load() > 0 || shouldExit;
             });
+            numSleepingWorkers.fetch_add(-1);
 
             if (shouldExit)
                 break;
-
-            task = tasks.front();
-            tasks.pop();
+            else
+                continue;
         }
 
-        numQueuedTasks.fetch_add(-1);
         CompleteTask(task, threadIndex_);
     }
 }
@@ -221,15 +431,9 @@ void WorkQueue::CompleteTask(Task* task, unsigned threadIndex_)
             {
                 if (threads.size())
                 {
-                    {
-                        std::lock_guard<std::mutex> lock(queueMutex);
-                        tasks.push(dependentTask);
-                    }
-
                     // Note: numPendingTasks counter was already incremented when adding the first dependency, do not do again here
-                    numQueuedTasks.fetch_add(1);
-
-                    signal.notify_one();
+                    PushTask(dependentTask, threadIndex_);
+                    WakeWorkers(1);
                 }
                 else
                 {
@@ -239,9 +443,138 @@ void WorkQueue::CompleteTask(Task* task, unsigned threadIndex_)
             }
         }
 
-        task->dependentTasks.clear();
+        // Dependents recorded into a task graph are kept for the next run
+        if (!task->graph)
+            task->dependentTasks.clear();
     }
 
+    // The task must not be accessed after this
+    task->Finish();
+
     // Decrement pending task counter last, so that WorkQueue::Complete() will also wait for the potentially added dependent tasks
     numPendingTasks.fetch_add(-1);
 }
+
+void WorkQueue::PushTask(Task* task, unsigned threadIndex_)
+{
+    // The deques may only be pushed to by their owners. Other threads use the locked injection queue
+    if (!threadIndex_ && IsForeignThread())
+    {
+        {
+            std::lock_guard<std::mutex> lock(injectionMutex);
+            injectedTasks[task->priority].push_back(task);
+        }
+
+        numInjectedTasks.fetch_add(1);
+        numQueuedTasks.fetch_add(1);
+        return;
+    }
+
+    // Count the task before pushing, so that a stealing thread can not decrement the counter below zero
+    ThreadTaskDeques& deque = deques[threadIndex_];
+    deque.numTasks.fetch_add(1);
+    deque.tasks[task->priority].Push(task);
+    numQueuedTasks.fetch_add(1);
+}
+
+Task* WorkQueue::PopTask(unsigned threadIndex_)
+{
+    unsigned numDeques = NumThreads();
+
+    for (int priority = MAX_TASK_PRIORITIES - 1; priority >= 0; --priority)
+    {
+        // Own deque first, newest task first for cache locality
+        {
+            ThreadTaskDeques& deque = deques[threadIndex_];
+            if (deque.numTasks.load(std::memory_order_relaxed) > 0)
+            {
+                Task* task = deque.tasks[priority].Pop();
+                if (task)
+                {
+                    deque.numTasks.fetch_add(-1);
+                    numQueuedTasks.fetch_add(-1);
+                    return task;
+                }
+            }
+        }
+
+        // Then take tasks queued from outside the main and worker threads
+        if (numInjectedTasks.load(std::memory_order_relaxed) > 0)
+        {
+            std::lock_guard<std::mutex> lock(injectionMutex);
+            std::deque<Task*>& tasks = injectedTasks[priority];
+            if (tasks.size())
+            {
+                Task* task = tasks.front();
+                tasks.pop_front();
+                numInjectedTasks.fetch_add(-1);
+                numQueuedTasks.fetch_add(-1);
+                return task;
+            }
+        }
+
+        // Then steal the oldest task from the other threads, starting from the next thread to spread contention. Skip threads with nothing queued
+        for (unsigned i = 1; i < numDeques; ++i)
+        {
+            ThreadTaskDeques& deque = deques[(threadIndex_ + i) % numDeques];
+            if (deque.numTasks.load(std::memory_order_relaxed) <= 0 || deque.tasks[priority].Size() <= 0)
+                continue;
+
+            Task* task = deque.tasks[priority].Steal();
+            if (task)
+            {
+                deque.numTasks.fetch_add(-1);
+                numQueuedTasks.fetch_add(-1);
+                return task;
+            }
+        }
+    }
+
+    return nullptr;
+}
+
+bool WorkQueue::IsForeignThread() const
+{
+    return !threadIndex && std::this_thread::get_id() != mainThreadId;
+}
+
+bool WorkQueue::SpinWait()
+{
+    unsigned count = spinCount.load();
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        if (shouldExit)
+            return false;
+        if (numQueuedTasks.load() > 0)
+            return true;
+
+        if ((i % SPIN_YIELD_INTERVAL) == SPIN_YIELD_INTERVAL - 1)
+            std::this_thread::yield();
+        else
+            CPU_PAUSE();
+    }
+
+    return false;
+}
+
+void WorkQueue::WakeWorkers(size_t count)
+{
+    // If no worker is blocked, the spinning or busy workers will find the tasks on their own. The queued task counter is always incremented before
+    // checking, while a blocking worker increments the sleeping counter before checking the queued task counter, so one of them sees the other's change
+    if (!numSleepingWorkers.load())
+        return;
+
+    // Lock the signal mutex momentarily so that a worker which just found no work can not miss the notification
+    {
+        std::lock_guard<std::mutex> lock(signalMutex);
+    }
+
+    if (count >= threads.size())
+        signal.notify_all();
+    else
+    {
+        for (size_t i = 0; i < count; ++i)
+            signal.notify_one();
+    }
+}
@@ -2,14 +2,32 @@
 
 #pragma once
 
+#include "../Object/AutoPtr.h"
 #include "../Object/Object.h"
+#include "FrameArena.h"
 
 #include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <functional>
 #include <mutex>
-#include <queue>
 #include <thread>
 
+class TaskGraph;
+
+/// Default amount of spin iterations idle workers poll for new tasks before blocking.
+static const unsigned DEFAULT_WORKER_SPIN_COUNT = 4096;
+/// Maximum amount of threads used when guessing the thread count from CPU core count.
+static const unsigned MAX_AUTO_THREADS = 16;
+
+/// %Task priority levels. Higher priority tasks are always executed first.
+enum TaskPriority
+{
+    TP_NORMAL = 0,
+    TP_HIGH,
+    MAX_TASK_PRIORITIES
+};
+
 /// %Task for execution by worker threads.
 struct Task
 {
@@ -20,11 +38,17 @@ struct Task
 
     /// Call the work function. Thread index 0 is the main thread.
     virtual void Complete(unsigned threadIndex) = 0;
+    /// Called after the work queue has finished using the task, including queuing its dependents. The task may be destroyed or reused once this has been called.
+    virtual void Finish() {}
 
     /// Dependent tasks.
     std::vector<Task*> dependentTasks;
     /// Dependency counter. Once zero, this task will be automatically queue itself.
     std::atomic<int> numDependencies;
+    /// Execution priority.
+    TaskPriority priority;
+    /// %Task graph the task is recorded into, or null if none. Recorded tasks keep their dependent tasks after completion.
+    TaskGraph* graph;
 };
 
 /// Free function task.
@@ -72,31 +96,194 @@ template<class T> struct MemberFunctionTask : public Task
     MemberWorkFunctionPtr function;
 };
 
+class ParallelForHandle;
+class WorkQueue;
+
+/// Range work function for ParallelFor. Called with the subrange start and end, and the executing thread index.
+typedef std::function<void(size_t, size_t, unsigned)> RangeWorkFunction;
+
+/// %Task for executing a subrange of a ParallelFor operation.
+struct RangeTask : public Task
+{
+    /// Construct.
+    RangeTask(ParallelForHandle* handle_) :
+        handle(handle_)
+    {
+    }
+
+    /// Call the work function, splitting off further subranges first as necessary.
+    void Complete(unsigned threadIndex) override;
+    /// Signal the owning handle that the subrange has finished.
+    void Finish() override;
+
+    /// Owning handle.
+    ParallelForHandle* handle;
+    /// Range start.
+    size_t begin;
+    /// Range end.
+    size_t end;
+};
+
+/// Joinable handle for a ParallelFor operation. Owns the subrange tasks, which are reused when the same handle is used again.
+class ParallelForHandle
+{
+    friend class WorkQueue;
+    friend struct RangeTask;
+
+public:
+    /// Construct.
+    ParallelForHandle();
+    /// Destruct.
+    ~ParallelForHandle();
+
+    /// Complete tasks on the calling thread until the operation has finished. Can be called from the main thread or from within a work function.
+    void Join();
+    /// Set priority of the subrange tasks. Takes effect on the next operation.
+    void SetPriority(TaskPriority priority_) { priority = priority_; }
+
+    /// Return whether the operation has finished.
+    bool IsDone() const { return numPendingTasks.load() == 0; }
+    /// Return priority of the subrange tasks.
+    TaskPriority Priority() const { return priority; }
+
+private:
+    /// Prevent copy construction.
+    ParallelForHandle(const ParallelForHandle& rhs);
+    /// Prevent assignment.
+    ParallelForHandle& operator = (const ParallelForHandle& rhs);
+
+    /// Execute a subrange task. Split in halves while the range is large, or other threads are starving.
+    void Execute(RangeTask* task, unsigned threadIndex);
+
+    /// Work queue used for the operation.
+    WorkQueue* workQueue;
+    /// Work function.
+    RangeWorkFunction function;
+    /// Minimum number of elements per subrange.
+    size_t grainSize;
+    /// Subrange size above which splitting always happens.
+    size_t splitSize;
+    /// Priority of the subrange tasks.
+    TaskPriority priority;
+    /// Subrange tasks. Enough are allocated to cover the whole range at grain size.
+    std::vector<AutoPtr<RangeTask> > tasks;
+    /// Amount of subrange tasks in use.
+    std::atomic<size_t> numUsedTasks;
+    /// Amount of subrange tasks queued and not yet completed.
+    std::atomic<int> numPendingTasks;
+};
+
+/// Lock-free work-stealing (Chase-Lev) deque of tasks. The owning thread pushes and pops at the bottom (LIFO) while other threads steal from the top (FIFO).
+class TaskDeque
+{
+public:
+    /// Construct.
+    TaskDeque();
+    /// Destruct.
+    ~TaskDeque();
+
+    /// Push a task to the bottom, growing the buffer if necessary. To be called only from the owning thread.
+    void Push(Task* task);
+    /// Pop the newest task from the bottom. To be called only from the owning thread. Return null if empty.
+    Task* Pop();
+    /// Steal the oldest task from the top. Return null if empty or another thread won the race for the task.
+    Task* Steal();
+
+    /// Return approximate amount of tasks.
+    int Size() const { return (int)(bottom.load(std::memory_order_relaxed) - top.load(std::memory_order_relaxed)); }
+
+private:
+    /// Prevent copy construction.
+    TaskDeque(const TaskDeque& rhs);
+    /// Prevent assignment.
+    TaskDeque& operator = (const TaskDeque& rhs);
+
+    /// Circular task buffer with power of two size.
+    struct Buffer
+    {
+        /// Construct with size.
+        Buffer(long long size_) :
+            size(size_),
+            tasks(new std::atomic<Task*>[(size_t)size_])
+        {
+        }
+
+        /// Return task at index.
+        Task* Get(long long index) const { return tasks[index & (size - 1)].load(std::memory_order_relaxed); }
+        /// Set task at index.
+        void Put(long long index, Task* task) { tasks[index & (size - 1)].store(task, std::memory_order_relaxed); }
+
+        /// Buffer size.
+        long long size;
+        /// Task pointers.
+        AutoArrayPtr<std::atomic<Task*> > tasks;
+    };
+
+    /// Index of the oldest task. Advanced by stealing threads.
+    std::atomic<long long> top;
+    /// Index past the newest task. Modified only by the owning thread.
+    std::atomic<long long> bottom;
+    /// Current buffer.
+    std::atomic<Buffer*> buffer;
+    /// All buffers allocated so far. Outgrown buffers are kept alive, as stealing threads may still be reading them.
+    std::vector<AutoPtr<Buffer> > buffers;
+};
+
+/// Per-thread task deques for each priority.
+struct ThreadTaskDeques
+{
+    /// Construct.
+    ThreadTaskDeques()
+    {
+        numTasks.store(0);
+    }
+
+    /// Queued tasks per priority.
+    TaskDeque tasks[MAX_TASK_PRIORITIES];
+    /// Amount of tasks in all priorities. Checked to skip empty threads before stealing.
+    std::atomic<int> numTasks;
+};
+
 /// Worker thread subsystem for dividing tasks between CPU cores.
 class WorkQueue : public Object
 {
     OBJECT(WorkQueue);
 
+    friend class TaskGraph;
+
 public:
-    /// Create with specified amount of threads including the main thread. 1 to use just the main thread. 0 to guess a suitable amount of threads from CPU core count.
-    WorkQueue(unsigned numThreads);
+    /// Create with specified amount of threads including the main thread. 1 to use just the main thread. 0 to guess a suitable amount of threads from CPU core count, up to MAX_AUTO_THREADS; an explicit count is not limited. Optionally pin the worker threads to CPU cores.
+    WorkQueue(unsigned numThreads, bool pinThreads = false);
     /// Destruct. Stop worker threads.
     ~WorkQueue();
 
-    /// Queue a task for execution. If no threads, completes immediately in the main thread.
+    /// Queue a task for execution to the calling thread's deque. Can be called from any thread: threads other than the main and worker threads queue to a locked injection queue instead. If no threads, completes immediately in the calling thread.
     void QueueTask(Task* task);
-    /// Queue several tasks execution. If no threads, completes immediately in the main thread.
+    /// Queue several tasks for execution to the calling thread's deque. Can be called from any thread: threads other than the main and worker threads queue to a locked injection queue instead. If no threads, completes immediately in the calling thread.
     void QueueTasks(size_t count, Task** tasks);
-    /// Add a dependency to a task. These tasks should not be queued via QueueTask(), they will instead queue themselves when the dependencies have finished.
+    /// Add a dependency to a task. These tasks should not be queued via QueueTask(), they will instead queue themselves when the dependencies have finished. For dependencies that stay the same each frame, prefer recording a TaskGraph.
     void AddDependency(Task* task, Task* dependency);
+    /// Execute a work function over a range of indices, splitting it adaptively into subranges of at least grainSize elements. The handle can be joined to wait for completion, otherwise Complete() also waits for it. The handle must not be reused before the previous operation has finished.
+    ParallelForHandle& ParallelFor(ParallelForHandle& handle, size_t begin, size_t end, size_t grainSize, const RangeWorkFunction& function);
     /// Complete all currently queued tasks and tasks with dependencies. To be called only from the main thread. Ensure that all dependencies either have been queued or will be queued by other tasks, otherwise this function never returns.
     void Complete();
-    /// Execute a task from the queue if available, then return. To be called only from the main thread. Return true if a task was executed.
+    /// Execute a task from the queue if available, then return. Can be called from the main thread or from within a work function. Other threads never execute tasks and always return false. Return true if a task was executed.
     bool TryComplete();
+    /// Set amount of spin iterations idle workers poll for new tasks before blocking. Spinning avoids wakeup latency for short successive tasks, at the cost of CPU time. 0 to block immediately.
+    void SetSpinCount(unsigned count) { spinCount.store(count); }
 
     /// Return number of execution threads including the main thread.
     unsigned NumThreads() const { return (unsigned)threads.size() + 1; }
 
+    /// Return number of tasks currently waiting in the queues.
+    unsigned NumQueuedTasks() const { return (unsigned)numQueuedTasks.load(); }
+    /// Return amount of spin iterations before blocking.
+    unsigned SpinCount() const { return spinCount.load(); }
+    /// Return the frame arena of a thread. Thread index 0 is the main thread.
+    FrameArena* ThreadArena(unsigned threadIndex_) const { return &frameArenas[threadIndex_]; }
+    /// Free all frame arena allocations. To be called only from the main thread at frame start, when no tasks are executing.
+    void ResetFrameArenas();
+
     /// Return thread index when outside of a work function.
     static unsigned ThreadIndex() { return threadIndex; }
 
@@ -105,21 +292,47 @@ private:
     void WorkerLoop(unsigned threadIndex);
     /// Complete a task by calling its work function and signal dependents.
     void CompleteTask(Task*, unsigned threadIndex);
+    /// Push a task to a thread's deque. Does not wake up workers.
+    void PushTask(Task* task, unsigned threadIndex);
+    /// Pop the highest priority task from the thread's own deque, or steal from the other threads. Own lower priority tasks are executed only if no higher priority tasks can be stolen. Return null if no tasks available.
+    Task* PopTask(unsigned threadIndex);
+    /// Wake up sleeping workers after queuing tasks. No-op if no workers are blocked.
+    void WakeWorkers(size_t count);
+    /// Return whether the calling thread is neither the main thread nor a worker thread.
+    bool IsForeignThread() const;
+    /// Spin until tasks are queued, exit is requested or the spin count runs out. Return true if should continue without blocking.
+    bool SpinWait();
 
-    /// Mutex for the work queue.
-    std::mutex queueMutex;
+    /// Mutex for sleeping and waking up workers.
+    std::mutex signalMutex;
     /// Condition variable to wake up workers.
     std::condition_variable signal;
     /// Exit flag.
     volatile bool shouldExit;
-    /// Task queue.
-    std::queue<Task*> tasks;
+    /// Task deques, one per thread including the main thread.
+    AutoArrayPtr<ThreadTaskDeques> deques;
+    /// Per-thread frame arenas for scratch memory.
+    AutoArrayPtr<FrameArena> frameArenas;
     /// Worker threads.
     std::vector<std::thread> threads;
+    /// Mutex for the injection queue.
+    std::mutex injectionMutex;
+    /// Tasks queued per priority from threads other than the main and worker threads.
+    std::deque<Task*> injectedTasks[MAX_TASK_PRIORITIES];
+    /// Amount of tasks in the injection queue. Checked before locking.
+    std::atomic<int> numInjectedTasks;
     /// Amount of tasks in queue.
     std::atomic<int> numQueuedTasks;
     /// Amount of queued tasks. Used to check for completion.
     std::atomic<int> numPendingTasks;
+    /// Amount of workers blocked on the condition variable.
+    std::atomic<int> numSleepingWorkers;
+    /// Amount of spin iterations before blocking.
+    std::atomic<unsigned> spinCount;
+    /// Pin worker threads to CPU cores flag.
+    bool pinThreads;
+    /// Identifier of the main thread, which constructed the work queue.
+    std::thread::id mainThreadId;
 
     /// Thread index for queries outside the work functions.
     static thread_local unsigned threadIndex;
@@ -132,6 +132,7 @@ void CreateScene(Scene* scene, Camera* camera, int preset)
             object->SetModel(cache->LoadResource<Model>("Box.mdl"));
             object->SetMaterial(cache->LoadResource<Material>("Stone.json"));
             object->SetCastShadows(true);
+            object->SetOccluder(true);
         }
 
         {
@@ -142,6 +143,7 @@ void CreateScene(Scene* scene, Camera* camera, int preset)
             object->SetModel(cache->LoadResource<Model>("Box.mdl"));
             object->SetMaterial(cache->LoadResource<Material>("Stone.json"));
             object->SetCastShadows(true);
+            object->SetOccluder(true);
         }
     }
     // Preset 1: high number of animating cubes
@@ -219,13 +221,21 @@ void CreateScene(Scene* scene, Camera* camera, int preset)
 
 int ApplicationMain(const std::vector<std::string>& arguments)
 {
-    bool useThreads = true;
+    unsigned numThreads = 0;
+    bool pinThreads = false;
 
-    if (arguments.size() > 1 && arguments[1].find("nothreads") != std::string::npos)
-        useThreads = false;
+    for (size_t i = 1; i < arguments.size(); ++i)
+    {
+        if (arguments[i].find("nothreads") != std::string::npos)
+            numThreads = 1;
+        else if (arguments[i].find("threads=") == 0)
+            numThreads = (unsigned)Max(ParseInt(arguments[i].c_str() + 8), 1);
+        else if (arguments[i].find("pinthreads") != std::string::npos)
+            pinThreads = true;
+    }
 
     // Create subsystems that don't depend on the application window / OpenGL context
-    AutoPtr<WorkQueue> workQueue = new WorkQueue(useThreads ? 0 : 1);
+    AutoPtr<WorkQueue> workQueue = new WorkQueue(numThreads, pinThreads);
     AutoPtr<Profiler> profiler = new Profiler();
     AutoPtr<Log> log = new Log();
     AutoPtr<ResourceCache> cache = new ResourceCache();
@@ -236,6 +246,8 @@ int ApplicationMain(const std::vector<std::string>& arguments)
     if (!graphics->IsInitialized())
         return 1;
 
+    graphics->SetShaderCacheDir(ExecutableDir() + "ShaderCache");
+
     // Create subsystems that depend on the application window / OpenGL
     AutoPtr<Input> input = new Input(graphics->Window());
     AutoPtr<Renderer> renderer = new Renderer();
@@ -275,6 +287,8 @@ int ApplicationMain(const std::vector<std::string>& arguments)
     SharedPtr<Scene> scene = Object::Create<Scene>();
     SharedPtr<Camera> camera = Object::Create<Camera>();
     CreateScene(scene, camera, 0);
+    // Compile the shader variations of the loaded materials up front to avoid hitches on first use
+    renderer->PrecompileShaders();
 
     camera->SetPosition(Vector3(0.0f, 20.0f, -75.0f));
 
@@ -301,7 +315,9 @@ int ApplicationMain(const std::vector<std::string>& arguments)
 
         if (profilerTimer.ElapsedMSec() >= 1000)
         {
-            profilerOutput = profiler->OutputResults();
+            const RenderStats& stats = renderer->GetRenderStats();
+            profilerOutput = profiler->OutputResults() + FormatString("Batches %d DrawCalls %d Programs %d Materials %d RenderStates %d Geometries %d\n",
+                (int)stats.batches, (int)stats.drawCalls, (int)stats.programChanges, (int)stats.materialChanges, (int)stats.renderStateChanges, (int)stats.geometryChanges);
             profiler->BeginInterval();
             profilerTimer.Reset();
         }
@@ -339,6 +355,8 @@ int ApplicationMain(const std::vector<std::string>& arguments)
             drawShadowDebug = !drawShadowDebug;
         if (input->KeyPressed(SDLK_6))
             drawOcclusionDebug = !drawOcclusionDebug;
+        if (input->KeyPressed(SDLK_7))
+            renderer->SetSoftwareOcclusion(!renderer->SoftwareOcclusion());
         if (input->KeyPressed(SDLK_SPACE))
             animate = !animate;
 
@@ -530,6 +548,33 @@ int ApplicationMain(const std::vector<std::string>& arguments)
                 graphics->SetTexture(0, nullptr);
             }
 
+            // Optional debug render of the software occlusion buffer
+            const OcclusionBuffer* occlusionBuffer = renderer->GetOcclusionBuffer();
+            if (drawOcclusionDebug && useOcclusion && occlusionBuffer)
+            {
+                ImageLevel occlusionLevel(IntVector2(occlusionBuffer->Width(), occlusionBuffer->Height()), FMT_R32F, occlusionBuffer->Data());
+                if (occlusionDebugTexture->Width() != occlusionBuffer->Width() || occlusionDebugTexture->Height() != occlusionBuffer->Height())
+                {
+                    occlusionDebugTexture->Define(TEX_2D, IntVector2(occlusionBuffer->Width(), occlusionBuffer->Height()), FMT_R32F, 1, 1, &occlusionLevel);
+                    occlusionDebugTexture->DefineSampler(FILTER_POINT, ADDRESS_CLAMP, ADDRESS_CLAMP, ADDRESS_CLAMP);
+                }
+                else
+                    occlusionDebugTexture->SetData(0, IntRect(0, 0, occlusionBuffer->Width(), occlusionBuffer->Height()), occlusionLevel);
+
+                Matrix4 quadMatrix = Matrix4::IDENTITY;
+                quadMatrix.m00 = 0.33f;
+                quadMatrix.m11 = 0.33f;
+                quadMatrix.m03 = 1.0f - quadMatrix.m00;
+                quadMatrix.m13 = -1.0f + quadMatrix.m11;
+
+                ShaderProgram* program = graphics->SetProgram("Shaders/DebugShadow.glsl");
+                graphics->SetUniform(program, "worldViewProjMatrix", quadMatrix);
+                graphics->SetTexture(0, occlusionDebugTexture);
+                graphics->SetRenderState(BLEND_REPLACE, CULL_NONE, CMP_ALWAYS, true, false);
+                graphics->DrawQuad();
+                graphics->SetTexture(0, nullptr);
+            }
+
             // Blit rendered contents to backbuffer now before presenting
             graphics->Blit(nullptr, IntRect(0, 0, width, height), viewFbo, IntRect(0, 0, width, height), true, false, FILTER_POINT);
         }